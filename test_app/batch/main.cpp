@@ -0,0 +1,577 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "base_screen_obstacle.h"
+#include "labeling/optimizer_factory.h"
+#include "labeling/scene_trace.h"
+
+using namespace geom2;
+using namespace labeling;
+using std::chrono::high_resolution_clock;
+using std::chrono::duration;
+
+namespace
+{
+    const char DEFAULT_OPTIMIZER[] = "conflict_graph";
+    /*
+     * Correct values from 1 to +inf
+     * Points and obstacles read at once. Memory grows linearly with it
+     */
+    const size_t DEFAULT_CHUNK_SIZE = 10000;
+    const char BATCH_MAGIC[4] = {'L', 'B', 'A', 'T'};
+    const uint32_t BATCH_VERSION = 1;
+    const size_t MAX_LINE_LENGTH = 4096;
+
+    /*
+     * Binary input is trace_header with BATCH_MAGIC followed by records.
+     * Every record starts with batch_record_header. A point is a
+     * trace_point and its trace_prefered records, an obstacle is a
+     * trace_obstacle. Ids and versions of the records are ignored
+     */
+    struct batch_record_header
+    {
+        uint32_t kind;
+        uint32_t reserved;
+    };
+
+    enum record_kind
+    {
+        point_record,
+        obstacle_record
+    };
+
+    /*
+     * Binary output has a record per input point in the input order
+     */
+    struct batch_result
+    {
+        int32_t offset_x;
+        int32_t offset_y;
+        int32_t visible;
+        uint32_t reserved;
+    };
+
+    class batch_point_feature : public screen_point_feature
+    {
+    public:
+        batch_point_feature()
+            :
+              fixed(false)
+        {}
+
+        const point_i& get_screen_pivot() const { return pivot; }
+        const size_i& get_label_size() const { return label_size; }
+        const point_i& get_label_offset() const { return offset; }
+        void set_label_offset(const point_i &new_offset)
+        {
+            offset = new_offset;
+        }
+        bool is_label_fixed() const { return fixed; }
+        const prefered_pos_list& get_prefered_positions() const
+        {
+            return prefered;
+        }
+        uint64_t get_version() const { return 1; }
+    public:
+        point_i pivot;
+        size_i label_size;
+        point_i offset;
+        bool fixed;
+        prefered_pos_list prefered;
+    };
+
+    /*
+     * Points and obstacles read at once
+     */
+    struct chunk
+    {
+        std::vector<batch_point_feature> points;
+        std::vector<base_screen_obstacle> obstacles;
+        // visibility of points after best_fit
+        std::vector<char> visible;
+
+        void clear()
+        {
+            points.clear();
+            obstacles.clear();
+            visible.clear();
+        }
+    };
+
+    /*
+     * Reads point and obstacle records one by one
+     */
+    class records_input
+    {
+    public:
+        explicit records_input(FILE *file)
+            :
+              file(file)
+        {}
+        virtual ~records_input() {}
+
+        /*
+         * Reads the next record into point or obstacle
+         *
+         * @return false at the end of the input or on an error
+         */
+        virtual bool next(record_kind &kind,
+                          batch_point_feature &point,
+                          std::unique_ptr<base_screen_obstacle> &obstacle) = 0;
+        /*
+         * @return the error message or an empty string
+         */
+        const std::string& get_error() const { return error; }
+    protected:
+        FILE *file;
+        std::string error;
+    };
+
+    /*
+     * Lines of comma separated values:
+     * p,x,y,w,h,fixed,offset_x,offset_y[,weight,prefered_x,prefered_y]...
+     * b,x,y,w,h for box obstacles
+     * s,start_x,start_y,end_x,end_y for segment obstacles
+     * Empty lines and lines starting with # are skipped
+     */
+    class csv_input : public records_input
+    {
+    public:
+        explicit csv_input(FILE *file)
+            :
+              records_input(file),
+              line_idx(0)
+        {}
+
+        bool next(record_kind &kind,
+                  batch_point_feature &point,
+                  std::unique_ptr<base_screen_obstacle> &obstacle)
+        {
+            char line[MAX_LINE_LENGTH];
+            while(fgets(line, sizeof(line), file) != nullptr)
+            {
+                ++line_idx;
+                if(line[0] == '\n' || line[0] == '\r' || line[0] == '#')
+                {
+                    continue;
+                }
+                if(!parse(line, kind, point, obstacle))
+                {
+                    error = "bad record at line " + std::to_string(line_idx);
+                    return false;
+                }
+                return true;
+            }
+            return false;
+        }
+    private:
+        /*
+         * Reads up to max_count numbers after the record type
+         *
+         * @return count of the numbers read or -1 on a bad value
+         */
+        static int parse_values(const char *str, double *values,
+                                int max_count)
+        {
+            int count = 0;
+            while(*str == ',' && count < max_count)
+            {
+                char *end;
+                values[count++] = strtod(str + 1, &end);
+                if(end == str + 1)
+                {
+                    return -1;
+                }
+                str = end;
+            }
+            while(*str == ' ' || *str == '\r' || *str == '\n')
+            {
+                ++str;
+            }
+            return *str ? -1 : count;
+        }
+
+        bool parse(const char *line, record_kind &kind,
+                   batch_point_feature &point,
+                   std::unique_ptr<base_screen_obstacle> &obstacle)
+        {
+            const int MAX_VALUES = MAX_LINE_LENGTH / 2;
+            double values[MAX_VALUES];
+            int count = parse_values(line + 1, values, MAX_VALUES);
+            if(line[0] == 'p' && count >= 7 && (count - 7) % 3 == 0)
+            {
+                kind = point_record;
+                point.pivot = to_point(values[0], values[1]);
+                point.label_size = size_i{static_cast<int>(values[2]),
+                                          static_cast<int>(values[3])};
+                point.fixed = values[4] != 0;
+                point.offset = to_point(values[5], values[6]);
+                point.prefered.clear();
+                for(int k = 7; k < count; k += 3)
+                {
+                    point.prefered.push_back(
+                                screen_point_feature::prefered_position(
+                                    values[k],
+                                    to_point(values[k + 1], values[k + 2])));
+                }
+                return true;
+            }
+            if((line[0] == 'b' || line[0] == 's') && count == 4)
+            {
+                kind = obstacle_record;
+                point_i first = to_point(values[0], values[1]);
+                point_i second = to_point(values[2], values[3]);
+                if(line[0] == 'b')
+                {
+                    size_i size{second.x, second.y};
+                    obstacle.reset(new base_screen_obstacle(
+                                       rectangle_i{first, size}));
+                } else {
+                    obstacle.reset(new base_screen_obstacle(
+                                       segment_i{first, second}));
+                }
+                return true;
+            }
+            return false;
+        }
+
+        static point_i to_point(double x, double y)
+        {
+            return point_i(static_cast<int>(x), static_cast<int>(y));
+        }
+    private:
+        size_t line_idx;
+    };
+
+    class binary_input : public records_input
+    {
+    public:
+        explicit binary_input(FILE *file)
+            :
+              records_input(file),
+              header_read(false)
+        {}
+
+        bool next(record_kind &kind,
+                  batch_point_feature &point,
+                  std::unique_ptr<base_screen_obstacle> &obstacle)
+        {
+            if(!header_read && !read_header())
+            {
+                return false;
+            }
+            batch_record_header record_header;
+            if(fread(&record_header, sizeof(record_header), 1, file) != 1)
+            {
+                return false;
+            }
+            if(record_header.kind == point_record)
+            {
+                trace_point record;
+                if(!read(&record, sizeof(record)))
+                {
+                    return false;
+                }
+                kind = point_record;
+                point.pivot = point_i(record.pivot_x, record.pivot_y);
+                point.label_size = size_i{record.w, record.h};
+                point.fixed = record.fixed != 0;
+                point.offset = point_i(record.offset_x, record.offset_y);
+                // Positions are appended as they are read, so a corrupt
+                // count ends in the truncated record error instead of a
+                // huge allocation
+                point.prefered.clear();
+                for(uint32_t k = 0; k < record.prefered_count; ++k)
+                {
+                    trace_prefered prefered_record;
+                    if(!read(&prefered_record, sizeof(prefered_record)))
+                    {
+                        return false;
+                    }
+                    point.prefered.push_back(
+                                screen_point_feature::prefered_position(
+                                    prefered_record.weight,
+                                    point_i(prefered_record.x,
+                                            prefered_record.y)));
+                }
+                return true;
+            }
+            if(record_header.kind == obstacle_record)
+            {
+                trace_obstacle record;
+                if(!read(&record, sizeof(record)))
+                {
+                    return false;
+                }
+                kind = obstacle_record;
+                const int32_t *coords = record.coords;
+                point_i first(coords[0], coords[1]);
+                if(record.type == screen_obstacle::segment)
+                {
+                    obstacle.reset(new base_screen_obstacle(
+                            segment_i{first, point_i(coords[2], coords[3])}));
+                } else {
+                    obstacle.reset(new base_screen_obstacle(
+                            rectangle_i{first, size_i{coords[2], coords[3]}}));
+                }
+                return true;
+            }
+            error = "unknown record kind";
+            return false;
+        }
+    private:
+        bool read_header()
+        {
+            header_read = true;
+            trace_header header;
+            if(fread(&header, sizeof(header), 1, file) != 1 ||
+                    memcmp(header.magic, BATCH_MAGIC, sizeof(BATCH_MAGIC)) ||
+                    header.version != BATCH_VERSION)
+            {
+                error = "not a binary batch input";
+                return false;
+            }
+            return true;
+        }
+
+        /*
+         * Reads a part of a record. The input ending inside a record is
+         * an error
+         */
+        bool read(void *dst, size_t size)
+        {
+            if(fread(dst, size, 1, file) != 1)
+            {
+                error = "truncated record";
+                return false;
+            }
+            return true;
+        }
+    private:
+        bool header_read;
+    };
+
+    void write_csv(FILE *file, const batch_point_feature &point,
+                   bool visible)
+    {
+        fprintf(file, "%d,%d,%d\n", point.offset.x, point.offset.y,
+                visible ? 1 : 0);
+    }
+
+    void write_binary(FILE *file, const batch_point_feature &point,
+                      bool visible)
+    {
+        batch_result result = batch_result();
+        result.offset_x = point.offset.x;
+        result.offset_y = point.offset.y;
+        result.visible = visible;
+        fwrite(&result, sizeof(result), 1, file);
+    }
+
+    /*
+     * Reads records until chunk_size points or obstacles are read
+     *
+     * @return false if nothing was read
+     */
+    bool read_chunk(records_input &input, size_t chunk_size, chunk &cur)
+    {
+        cur.clear();
+        batch_point_feature point;
+        std::unique_ptr<base_screen_obstacle> obstacle;
+        record_kind kind;
+        while(cur.points.size() < chunk_size &&
+              cur.obstacles.size() < chunk_size &&
+              input.next(kind, point, obstacle))
+        {
+            if(kind == point_record)
+            {
+                cur.points.push_back(point);
+            } else {
+                cur.obstacles.push_back(*obstacle);
+            }
+        }
+        return !cur.points.empty() || !cur.obstacles.empty();
+    }
+
+    /*
+     * Places labels of cur. Shown labels and obstacles of prev are
+     * registered too, labels of prev as fixed ones, so labels near the
+     * border of two chunks don't overlap
+     */
+    void label_chunk(base_optimizer &optimizer, float time_max,
+                     chunk &prev, chunk &cur,
+                     std::vector<screen_point_feature*> &points,
+                     std::vector<label_handle> &handles,
+                     std::vector<obstacle_handle> &obstacles_handles)
+    {
+        points.clear();
+        for(size_t idx = 0; idx < prev.points.size(); ++idx)
+        {
+            if(prev.visible[idx])
+            {
+                prev.points[idx].fixed = true;
+                points.push_back(&prev.points[idx]);
+            }
+        }
+        size_t context_count = points.size();
+        for(batch_point_feature &point: cur.points)
+        {
+            points.push_back(&point);
+        }
+        obstacles_handles.clear();
+        for(chunk *obstacles_chunk: {&prev, &cur})
+        {
+            for(base_screen_obstacle &obstacle: obstacles_chunk->obstacles)
+            {
+                obstacles_handles.push_back(
+                            optimizer.register_obstacle(&obstacle));
+            }
+        }
+        handles.resize(points.size());
+        optimizer.register_labels(points.data(), points.size(),
+                                  handles.data());
+
+        optimizer.best_fit(time_max);
+
+        cur.visible.resize(cur.points.size());
+        for(size_t idx = 0; idx < cur.points.size(); ++idx)
+        {
+            cur.visible[idx] = optimizer.is_label_visible(
+                        handles[context_count + idx]);
+        }
+        optimizer.unregister_labels(handles.data(), handles.size());
+        for(obstacle_handle handle: obstacles_handles)
+        {
+            optimizer.unregister_obstacle(handle);
+        }
+    }
+
+    void print_usage(const char *name)
+    {
+        printf("usage: %s [-o optimizer] [-t chunk_time_ms] [-j threads] "
+               "[-c chunk_size] [-b] [input [output]]\n"
+               "reads stdin and writes stdout by default\n"
+               "-b reads and writes binary records instead of CSV\n"
+               "optimizers are", name);
+        for(const std::string &optimizer_name: optimizer_names())
+        {
+            printf(" %s", optimizer_name.c_str());
+        }
+        printf(", default is %s\n", DEFAULT_OPTIMIZER);
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string optimizer_name = DEFAULT_OPTIMIZER;
+    float time_max = std::numeric_limits<float>::infinity();
+    size_t threads_count = 0;
+    size_t chunk_size = DEFAULT_CHUNK_SIZE;
+    bool binary = false;
+    std::vector<std::string> paths;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            optimizer_name = argv[++i];
+        } else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+            time_max = static_cast<float>(atof(argv[++i]));
+        } else if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads_count = static_cast<size_t>(atol(argv[++i]));
+        } else if(!strcmp(argv[i], "-c") && i + 1 < argc &&
+                  atol(argv[i + 1]) > 0) {
+            chunk_size = static_cast<size_t>(atol(argv[++i]));
+        } else if(!strcmp(argv[i], "-b")) {
+            binary = true;
+        } else if(paths.size() < 2 && argv[i][0] != '-') {
+            paths.push_back(argv[i]);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    std::unique_ptr<base_optimizer> optimizer(
+                create_optimizer(optimizer_name));
+    if(!optimizer)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    optimizer->set_threads_count(threads_count);
+    // Every chunk is registered anew, so component optimizers lose
+    // nothing the optimizer would keep between chunks
+    optimizer->set_decomposition(true);
+
+    FILE *in = paths.size() > 0 ? fopen(paths[0].c_str(), "rb") : stdin;
+    if(in == nullptr)
+    {
+        fprintf(stderr, "can't read %s\n", paths[0].c_str());
+        return 1;
+    }
+    FILE *out = paths.size() > 1 ? fopen(paths[1].c_str(), "wb") : stdout;
+    if(out == nullptr)
+    {
+        fprintf(stderr, "can't write %s\n", paths[1].c_str());
+        return 1;
+    }
+    std::unique_ptr<records_input> input;
+    if(binary)
+    {
+        input.reset(new binary_input(in));
+    } else {
+        input.reset(new csv_input(in));
+    }
+    auto write_result = binary ? write_binary : write_csv;
+
+    chunk prev, cur;
+    std::vector<screen_point_feature*> points;
+    std::vector<label_handle> handles;
+    std::vector<obstacle_handle> obstacles_handles;
+    size_t labels_count = 0;
+    size_t chunks_count = 0;
+    auto start = high_resolution_clock::now();
+    while(read_chunk(*input, chunk_size, cur))
+    {
+        label_chunk(*optimizer, time_max, prev, cur, points, handles,
+                    obstacles_handles);
+        for(size_t idx = 0; idx < cur.points.size(); ++idx)
+        {
+            write_result(out, cur.points[idx], cur.visible[idx] != 0);
+        }
+        labels_count += cur.points.size();
+        ++chunks_count;
+        std::swap(prev, cur);
+    }
+    double seconds = duration<double>(high_resolution_clock::now() -
+                                      start).count();
+    fflush(out);
+    bool write_failed = ferror(out) != 0;
+    if(in != stdin)
+    {
+        fclose(in);
+    }
+    if(out != stdout)
+    {
+        write_failed = fclose(out) != 0 || write_failed;
+    }
+    if(!input->get_error().empty())
+    {
+        fprintf(stderr, "%s\n", input->get_error().c_str());
+        return 1;
+    }
+    if(write_failed)
+    {
+        fprintf(stderr, "can't write the output\n");
+        return 1;
+    }
+    fprintf(stderr, "%zu labels in %zu chunks, %.3f s, %.0f labels/s\n",
+            labels_count, chunks_count, seconds,
+            seconds > 0 ? labels_count / seconds : 0.0);
+    return 0;
+}
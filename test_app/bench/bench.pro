@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# Benchmarks of geom2 kernels and positions optimizers
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = bench
+TEMPLATE = app
+
+CONFIG += console c++11
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += main.cpp \
+    scene.cpp \
+    ../base_screen_obstacle.cpp
+
+HEADERS += scene.h \
+    ../base_screen_obstacle.h
+
+win32:CONFIG(release, debug|release): LABELING_DIR = $$OUT_PWD/../labeling/release
+else:win32:CONFIG(debug, debug|release): LABELING_DIR = $$OUT_PWD/../labeling/debug
+else: LABELING_DIR = $$OUT_PWD/../labeling
+
+LIBS += -L$$LABELING_DIR -llabeling
+win32-g++|unix: PRE_TARGETDEPS += $$LABELING_DIR/liblabeling.a
+else: PRE_TARGETDEPS += $$LABELING_DIR/labeling.lib
+
+unix: LIBS += -lpthread
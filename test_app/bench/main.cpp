@@ -0,0 +1,460 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <math.h>
+#include <new>
+#include <string>
+#include <vector>
+#include "scene.h"
+#include "labeling/batch_geometry.h"
+#include "labeling/conflict_graph_opt.h"
+#include "labeling/geometry.h"
+#include "labeling/ray_intersection_opt.h"
+#include "labeling/sim_annealing_opt.h"
+#include "labeling/tiled_optimizer.h"
+#include "labeling/utils.h"
+
+using namespace geom2;
+using namespace labeling;
+using std::chrono::high_resolution_clock;
+using std::chrono::duration;
+
+/*
+ * Heap allocations made by the bench. Counted to check that
+ * optimizers reuse their buffers between calls
+ */
+static std::atomic<size_t> allocations_count(0);
+
+void* operator new(size_t size)
+{
+    allocations_count += 1;
+    void *ptr = malloc(size ? size : 1);
+    if(!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+namespace
+{
+    /*
+     * Correct values from 0 to +inf
+     * Every benchmark is repeated until it takes at least
+     * MIN_BENCH_TIME_NS
+     */
+    const double MIN_BENCH_TIME_NS = 2e8;
+    const uint64_t SCENE_SEED = 1;
+    const uint64_t OPTIMIZER_SEED = 1;
+    const size_t DEFAULT_SIZES[] = {100, 1000, 10000, 100000};
+    /*
+     * ray_intersection_opt ignores the time limit and grows about as
+     * labels_count^2, bigger scenes are skipped
+     */
+    const size_t RAY_INTERSECTION_MAX_LABELS = 10000;
+    /*
+     * Correct values from 1 to +inf
+     * Points moved before every incremental best_fit
+     */
+    const size_t INCREMENTAL_MOVED_POINTS = 10;
+    /*
+     * Correct values from 1 to +inf
+     * best_fit calls after the warm-up one that allocations are
+     * counted for
+     */
+    const size_t ALLOCATIONS_CALLS = 3;
+    /*
+     * Correct values from 0 to +inf
+     * time_max in milliseconds of the deadline benchmark. best_fit
+     * should return close to it on scenes that need more time
+     */
+    const float DEADLINE_TIME_MAX = 1;
+
+    // Keeps the compiler from throwing benchmarked calls away
+    volatile double sink;
+
+    /*
+     * Calls ops(count) with growing count until it takes
+     * MIN_BENCH_TIME_NS
+     *
+     * @return nanoseconds per operation
+     */
+    double ns_per_op(const std::function<void(size_t count)> &ops)
+    {
+        size_t count = 1;
+        for(;;)
+        {
+            auto start = high_resolution_clock::now();
+            ops(count);
+            double ns = duration<double, std::nano>(
+                        high_resolution_clock::now() - start).count();
+            if(ns >= MIN_BENCH_TIME_NS)
+            {
+                return ns / count;
+            }
+            double scale = ns > 0 ? MIN_BENCH_TIME_NS / ns * 1.2 : 10;
+            count = static_cast<size_t>(count * std::min(std::max(scale, 2.0),
+                                                         100.0));
+        }
+    }
+
+    /*
+     * Prints results. Scaling is the power of labels count the
+     * time grows with since the previous size
+     */
+    class report
+    {
+    public:
+        report()
+            :
+              failed(false)
+        {
+            printf("%-28s %10s %16s %10s\n",
+                   "benchmark", "labels", "ns/op", "scaling");
+        }
+
+        void add(const std::string &name, size_t labels_count, double ns)
+        {
+            char scaling[32] = "-";
+            auto prev = last.find(name);
+            if(prev != last.end() && prev->second.first != labels_count)
+            {
+                double power = log(ns / prev->second.second) /
+                        log(static_cast<double>(labels_count) /
+                            prev->second.first);
+                snprintf(scaling, sizeof(scaling), "n^%.2f", power);
+            }
+            printf("%-28s %10zu %16.1f %10s\n",
+                   name.c_str(), labels_count, ns, scaling);
+            fflush(stdout);
+            last[name] = std::make_pair(labels_count, ns);
+        }
+
+        /*
+         * Steady state best_fit should not allocate, any allocations fail
+         * the run
+         */
+        void add_allocations(const std::string &name, size_t labels_count,
+                             size_t count)
+        {
+            printf("%-28s %10zu %16zu %10s\n",
+                   name.c_str(), labels_count, count,
+                   count ? "FAILED" : "allocs");
+            fflush(stdout);
+            failed = failed || count > 0;
+        }
+
+        bool has_failures() const
+        {
+            return failed;
+        }
+
+        void skip(const std::string &name, size_t labels_count)
+        {
+            printf("%-28s %10zu %16s %10s\n",
+                   name.c_str(), labels_count, "skipped", "-");
+            fflush(stdout);
+        }
+    private:
+        std::map<std::string, std::pair<size_t, double>> last;
+        bool failed;
+    };
+
+    void bench_geometry(const scene &cur_scene, report &results)
+    {
+        size_t count = cur_scene.points.size();
+        std::vector<rectangle_i> rects(count);
+        std::vector<segment_i> segments(count);
+        std::vector<point_i> pivots(count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            const bench_point_feature *point = cur_scene.points[i].get();
+            rects[i] = to_label_rect(point);
+            pivots[i] = point->get_screen_pivot();
+            // The leader line from the label center to the pivot
+            segments[i] = segment_i{rects[i].center(), pivots[i]};
+        }
+
+        results.add("rectangle_intersection", count,
+                    ns_per_op([&](size_t ops)
+        {
+            long long summ = 0;
+            for(size_t op = 0, i = 0; op < ops; ++op)
+            {
+                size_t j = i + 1 < count ? i + 1 : 0;
+                summ += rectangle_intersection(rects[i], rects[j]);
+                i = j;
+            }
+            sink = static_cast<double>(summ);
+        }));
+
+        results.add("seg_rect_intersection", count,
+                    ns_per_op([&](size_t ops)
+        {
+            long long summ = 0;
+            point_i first, second;
+            for(size_t op = 0, i = 0; op < ops; ++op)
+            {
+                summ += seg_rect_intersection(segments[i], rects[i],
+                                              &first, &second);
+                summ += first.x;
+                i = i + 1 < count ? i + 1 : 0;
+            }
+            sink = static_cast<double>(summ);
+        }));
+
+        // ns per segment, comparable with seg_rect_intersection
+        std::vector<unsigned char> classes(count);
+        results.add("segments_rect_classify", count,
+                    ns_per_op([&](size_t ops)
+        {
+            long long summ = 0;
+            for(size_t op = 0, i = 0; op < ops; op += count)
+            {
+                size_t batch = std::min(count, ops - op);
+                segments_rect_classify(rects[i], segments.data(), batch,
+                                       classes.data());
+                summ += classes[batch - 1];
+                i = i + 1 < count ? i + 1 : 0;
+            }
+            sink = static_cast<double>(summ);
+        }));
+
+        results.add("point_seg_sqr_distance", count,
+                    ns_per_op([&](size_t ops)
+        {
+            long long summ = 0;
+            for(size_t op = 0, i = 0; op < ops; ++op)
+            {
+                size_t j = i + 1 < count ? i + 1 : 0;
+                summ += point_seg_sqr_distance(pivots[j], segments[i]);
+                i = j;
+            }
+            sink = static_cast<double>(summ);
+        }));
+    }
+} // namespace
+
+namespace labeling
+{
+    struct sim_annealing_opt_bench
+    {
+        static double calc_metric(sim_annealing_opt &optimizer)
+        {
+            sim_annealing_opt::chain_t chain;
+            chain.state = optimizer.init_state();
+            if(!chain.state.size())
+            {
+                return 0;
+            }
+            optimizer.update_obstacles();
+            optimizer.init_chain(chain);
+            size_t count = chain.state.size();
+            return ns_per_op([&](size_t ops)
+            {
+                double summ = 0;
+                point_i zero_offset;
+                for(size_t op = 0, i = 0; op < ops; ++op)
+                {
+                    summ += optimizer.calc_metric(chain, i, zero_offset);
+                    i = i + 1 < count ? i + 1 : 0;
+                }
+                sink = summ;
+            });
+        }
+    };
+} // namespace labeling
+
+namespace
+{
+    double bench_best_fit(scene &cur_scene, positions_optimizer &optimizer,
+                          float time_max)
+    {
+        cur_scene.register_in(optimizer);
+        return ns_per_op([&](size_t ops)
+        {
+            for(size_t op = 0; op < ops; ++op)
+            {
+                cur_scene.reset_offsets();
+                optimizer.best_fit(time_max);
+            }
+        });
+    }
+
+    /*
+     * Moves a few points by a pixel before every best_fit, so per call
+     * cost should depend on the moved points count and not on the scene
+     * size in incremental mode
+     */
+    double bench_incremental(scene &cur_scene, positions_optimizer &optimizer,
+                             float time_max, bool incremental = true)
+    {
+        cur_scene.reset_offsets();
+        cur_scene.register_in(optimizer);
+        optimizer.set_incremental(incremental);
+        optimizer.best_fit(time_max);
+        size_t next = 0;
+        int direction = 1;
+        return ns_per_op([&](size_t ops)
+        {
+            for(size_t op = 0; op < ops; ++op)
+            {
+                for(size_t k = 0; k < INCREMENTAL_MOVED_POINTS; ++k)
+                {
+                    cur_scene.points[next]->move_by(point_i(direction, 0));
+                    next = (next + 1) % cur_scene.points.size();
+                    direction = next ? direction : -direction;
+                }
+                optimizer.best_fit(time_max);
+            }
+        });
+    }
+
+    /*
+     * Counts heap allocations of best_fit calls with default settings on
+     * the same scene after the first call
+     *
+     * @return allocations per call
+     */
+    size_t allocations_per_best_fit(scene &cur_scene,
+                                    base_optimizer &optimizer,
+                                    float time_max)
+    {
+        cur_scene.register_in(optimizer);
+        cur_scene.reset_offsets();
+        optimizer.best_fit(time_max);
+        size_t start_count = allocations_count;
+        for(size_t call = 0; call < ALLOCATIONS_CALLS; ++call)
+        {
+            cur_scene.reset_offsets();
+            optimizer.best_fit(time_max);
+        }
+        return (allocations_count - start_count) / ALLOCATIONS_CALLS;
+    }
+
+    void bench_optimizers(scene &cur_scene, float time_max, report &results)
+    {
+        size_t count = cur_scene.points.size();
+        {
+            sim_annealing_opt optimizer;
+            cur_scene.register_in(optimizer);
+            results.add("sim_annealing calc_metric", count,
+                        sim_annealing_opt_bench::calc_metric(optimizer));
+        }
+        {
+            sim_annealing_opt optimizer;
+            optimizer.set_seed(OPTIMIZER_SEED);
+            results.add("sim_annealing best_fit", count,
+                        bench_best_fit(cur_scene, optimizer, time_max));
+        }
+        {
+            sim_annealing_opt optimizer;
+            optimizer.set_seed(OPTIMIZER_SEED);
+            results.add("sim_annealing incremental", count,
+                        bench_incremental(cur_scene, optimizer, time_max));
+        }
+        {
+            // The same moves without incremental mode
+            sim_annealing_opt optimizer;
+            optimizer.set_seed(OPTIMIZER_SEED);
+            results.add("sim_annealing moved full", count,
+                        bench_incremental(cur_scene, optimizer, time_max,
+                                          false));
+        }
+        if(count > RAY_INTERSECTION_MAX_LABELS)
+        {
+            results.skip("ray_intersection best_fit", count);
+            results.skip("ray_intersection allocations", count);
+        } else {
+            {
+                ray_intersection_opt optimizer;
+                results.add("ray_intersection best_fit", count,
+                            bench_best_fit(cur_scene, optimizer, time_max));
+            }
+            {
+                ray_intersection_opt optimizer;
+                results.add_allocations("ray_intersection allocations",
+                                        count,
+                                        allocations_per_best_fit(cur_scene,
+                                                                 optimizer,
+                                                                 time_max));
+            }
+        }
+        {
+            conflict_graph_opt optimizer;
+            results.add("conflict_graph best_fit", count,
+                        bench_best_fit(cur_scene, optimizer, time_max));
+        }
+        {
+            conflict_graph_opt optimizer;
+            results.add("conflict_graph deadline", count,
+                        bench_best_fit(cur_scene, optimizer,
+                                       DEADLINE_TIME_MAX));
+        }
+        {
+            tiled_optimizer optimizer("conflict_graph");
+            results.add("tiled best_fit", count,
+                        bench_best_fit(cur_scene, optimizer, time_max));
+        }
+        {
+            // Only tiles near the moved points are optimized again
+            tiled_optimizer optimizer("conflict_graph");
+            results.add("tiled incremental", count,
+                        bench_incremental(cur_scene, optimizer, time_max));
+        }
+    }
+
+    void print_usage(const char *name)
+    {
+        printf("usage: %s [-t best_fit_time_ms] [labels_count...]\n"
+               "default labels counts are 100 1000 10000 100000\n",
+               name);
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    float time_max = std::numeric_limits<float>::infinity();
+    std::vector<size_t> sizes;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            time_max = static_cast<float>(atof(argv[++i]));
+        } else if(atol(argv[i]) > 0) {
+            sizes.push_back(static_cast<size_t>(atol(argv[i])));
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(sizes.empty())
+    {
+        sizes.assign(std::begin(DEFAULT_SIZES), std::end(DEFAULT_SIZES));
+    }
+
+    report results;
+    for(size_t labels_count: sizes)
+    {
+        scene cur_scene;
+        cur_scene.generate(labels_count, SCENE_SEED);
+        bench_geometry(cur_scene, results);
+        bench_optimizers(cur_scene, time_max, results);
+    }
+    if(results.has_failures())
+    {
+        fprintf(stderr, "best_fit allocates after the warm-up call\n");
+        return 1;
+    }
+    return 0;
+}
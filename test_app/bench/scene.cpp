@@ -0,0 +1,144 @@
+#include "scene.h"
+#include <math.h>
+#include "base_screen_obstacle.h"
+#include "labeling/random_generator.h"
+
+using namespace geom2;
+
+namespace labeling
+{
+    /*
+     * Correct values from 1 to +inf
+     * Field area per point. Default test app window has about 20000
+     */
+    const double AREA_PER_POINT = 20000;
+    /*
+     * Correct values from 0 to 1
+     */
+    const double FIXED_POINT_P = 0.1;
+    /*
+     * Correct values from 0 to +inf
+     * Obstacles count is points count times OBSTACLES_FACTOR
+     */
+    const double OBSTACLES_FACTOR = 0.1;
+    const point_i DEFAULT_OFFSET(40, 40);
+
+    bench_point_feature::bench_point_feature(const point_i &position,
+                                             bool is_fixed)
+        :
+          position(position),
+          label_offset(DEFAULT_OFFSET),
+          is_fixed(is_fixed),
+          version(1)
+    {
+        label_size.h = 40;
+        label_size.w = 100;
+        prefered_positions.push_back(prefered_position(1.0, label_offset));
+        prefered_positions.push_back(prefered_position(1.0, point_i{-40, 40}));
+        prefered_positions.push_back(prefered_position(0.3, point_i{40, -40}));
+    }
+
+    const point_i& bench_point_feature::get_screen_pivot() const
+    {
+        return position;
+    }
+
+    const size_i& bench_point_feature::get_label_size() const
+    {
+        return label_size;
+    }
+
+    const point_i& bench_point_feature::get_label_offset() const
+    {
+        return label_offset;
+    }
+
+    void bench_point_feature::set_label_offset(const point_i &new_offset)
+    {
+        label_offset = new_offset;
+    }
+
+    bool bench_point_feature::is_label_fixed() const
+    {
+        return is_fixed;
+    }
+
+    const bench_point_feature::prefered_pos_list&
+                        bench_point_feature::get_prefered_positions() const
+    {
+        return prefered_positions;
+    }
+
+    uint64_t bench_point_feature::get_version() const
+    {
+        return version;
+    }
+
+    void bench_point_feature::move_by(const point_i &shift)
+    {
+        position = position + shift;
+        ++version;
+    }
+
+    void scene::generate(size_t points_count, uint64_t seed)
+    {
+        random_generator random(seed);
+        // 4:3 field like the test app window
+        double width = sqrt(points_count * AREA_PER_POINT * 4 / 3);
+        field_size.w = static_cast<int>(width) + 1;
+        field_size.h = static_cast<int>(width * 3 / 4) + 1;
+
+        points.clear();
+        for(size_t i = 0; i < points_count; ++i)
+        {
+            point_i pos(random.uniform(0, field_size.w - 1),
+                        random.uniform(0, field_size.h - 1));
+            bool is_fixed = random.uniform_real() < FIXED_POINT_P;
+            points.emplace_back(new bench_point_feature(pos, is_fixed));
+        }
+
+        obstacles.clear();
+        size_t obstacles_count =
+                static_cast<size_t>(points_count * OBSTACLES_FACTOR);
+        for(size_t i = 0; i < obstacles_count; ++i)
+        {
+            point_i pos(random.uniform(0, field_size.w - 1),
+                        random.uniform(0, field_size.h - 1));
+            if(i % 2)
+            {
+                size_i size{random.uniform(50, 199), random.uniform(20, 39)};
+                obstacles.emplace_back(
+                            new base_screen_obstacle(rectangle_i{pos, size}));
+            } else {
+                point_i end = pos + point_i(random.uniform(-50, 50),
+                                            random.uniform(-50, 50));
+                obstacles.emplace_back(
+                            new base_screen_obstacle(segment_i{pos, end}));
+            }
+        }
+    }
+
+    void scene::register_in(positions_optimizer &optimizer) const
+    {
+        std::vector<screen_point_feature*> points_ptrs;
+        points_ptrs.reserve(points.size());
+        for(const auto &point: points)
+        {
+            points_ptrs.push_back(point.get());
+        }
+        optimizer.register_labels(points_ptrs.data(), points_ptrs.size(),
+                                  nullptr);
+        for(const auto &obstacle: obstacles)
+        {
+            optimizer.register_obstacle(obstacle.get());
+        }
+    }
+
+    void scene::reset_offsets()
+    {
+        for(const auto &point: points)
+        {
+            point->set_label_offset(DEFAULT_OFFSET);
+        }
+    }
+} // namespace labeling
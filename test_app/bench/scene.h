@@ -0,0 +1,62 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <memory>
+#include <vector>
+#include "labeling/positions_optimizer.h"
+#include "labeling/screen_point_feature.h"
+#include "labeling/screen_obstacle.h"
+
+namespace labeling
+{
+    /*
+     * Point with the same label and prefered positions as
+     * test_point_feature that moves only by move_by. Keeps no track, so
+     * 100k of them are cheap
+     */
+    class bench_point_feature : public screen_point_feature
+    {
+    public:
+        bench_point_feature(const geom2::point_i &position, bool is_fixed);
+
+        const geom2::point_i& get_screen_pivot() const;
+        const geom2::size_i& get_label_size() const;
+
+        const geom2::point_i& get_label_offset() const;
+        void set_label_offset(const geom2::point_i&);
+
+        bool is_label_fixed() const;
+
+        const prefered_pos_list& get_prefered_positions() const;
+        uint64_t get_version() const;
+
+        void move_by(const geom2::point_i &shift);
+    private:
+        geom2::point_i position;
+        geom2::size_i label_size;
+        geom2::point_i label_offset;
+        prefered_pos_list prefered_positions;
+        bool is_fixed;
+        uint64_t version;
+    };
+
+    /*
+     * Randomly generated scene. Field grows with the points count,
+     * so the labels density stays the same for every size
+     */
+    struct scene
+    {
+        geom2::size_i field_size;
+        std::vector<std::unique_ptr<bench_point_feature>> points;
+        std::vector<std::unique_ptr<screen_obstacle>> obstacles;
+
+        void generate(size_t points_count, uint64_t seed);
+        void register_in(positions_optimizer &optimizer) const;
+        /*
+         * Moves all labels back to the default position
+         */
+        void reset_offsets();
+    };
+} // namespace labeling
+
+#endif // SCENE_H
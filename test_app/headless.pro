@@ -0,0 +1,14 @@
+#-------------------------------------------------
+#
+# Labeling library, benchmarks, the trace replay and the batch labeler
+# without Qt and a display
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS = labeling bench replay batch
+
+bench.depends = labeling
+replay.depends = labeling
+batch.depends = labeling
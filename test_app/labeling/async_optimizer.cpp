@@ -0,0 +1,440 @@
+#include "async_optimizer.h"
+#include <algorithm>
+#include <utility>
+
+using namespace geom2;
+
+namespace labeling
+{
+    static const size_t NO_BUDGET = static_cast<size_t>(-1);
+
+    /*
+     * Copy of a registered label seen by the wrapped optimizer
+     */
+    struct async_optimizer::point_proxy : public screen_point_feature
+    {
+        // nullptr after the label is unregistered
+        screen_point_feature *source;
+        label_handle handle;
+        bool registered;
+        double priority;
+        bool priority_changed;
+        // visibility in the last applied results
+        bool visible;
+
+        point_i pivot;
+        size_i label_size;
+        point_i offset;
+        bool fixed;
+        prefered_pos_list prefered;
+        uint64_t version;
+
+        explicit point_proxy(screen_point_feature *source)
+            :
+              source(source),
+              handle(),
+              registered(false),
+              priority(1),
+              priority_changed(false),
+              visible(true),
+              fixed(false),
+              version(0)
+        {}
+
+        void capture()
+        {
+            pivot = source->get_screen_pivot();
+            label_size = source->get_label_size();
+            offset = source->get_label_offset();
+            fixed = source->is_label_fixed();
+            prefered = source->get_prefered_positions();
+            version = source->get_version();
+        }
+
+        const point_i& get_screen_pivot() const { return pivot; }
+        const size_i& get_label_size() const { return label_size; }
+        const point_i& get_label_offset() const { return offset; }
+        void set_label_offset(const point_i &new_offset)
+        {
+            offset = new_offset;
+        }
+        bool is_label_fixed() const { return fixed; }
+        const prefered_pos_list& get_prefered_positions() const
+        {
+            return prefered;
+        }
+        uint64_t get_version() const { return version; }
+    };
+
+    /*
+     * Copy of a registered obstacle seen by the wrapped optimizer
+     */
+    struct async_optimizer::obstacle_proxy : public screen_obstacle
+    {
+        screen_obstacle *source;
+        obstacle_handle handle;
+        bool registered;
+
+        type t;
+        rectangle_i box;
+        segment_i segment;
+        uint64_t version;
+
+        explicit obstacle_proxy(screen_obstacle *source)
+            :
+              source(source),
+              handle(),
+              registered(false),
+              t(source->get_type()),
+              version(0)
+        {}
+
+        void capture()
+        {
+            t = source->get_type();
+            if(t == screen_obstacle::box)
+            {
+                box = *source->get_box();
+            } else {
+                segment = *source->get_segment();
+            }
+            version = source->get_version();
+        }
+
+        type get_type() const { return t; }
+        const rectangle_i* get_box() const { return &box; }
+        const segment_i* get_segment() const { return &segment; }
+        uint64_t get_version() const { return version; }
+    };
+
+    async_optimizer::async_optimizer(positions_optimizer *optimizer)
+        :
+          optimizer(optimizer),
+          incremental(false),
+          has_viewport(false),
+          labels_budget(NO_BUDGET),
+          settings_changed(false),
+          front(0),
+          job_started(false),
+          busy(false),
+          job_ready(false),
+          job_time(0),
+          stopping(false)
+    {
+        worker = std::thread(&async_optimizer::worker_loop, this);
+    }
+
+    async_optimizer::~async_optimizer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_one();
+        worker.join();
+    }
+
+    label_handle async_optimizer::register_label(
+            screen_point_feature *point_ptr)
+    {
+        label_handle handle = {points_handles.push_back()};
+        points.push_back(std::unique_ptr<point_proxy>(
+                             new point_proxy(point_ptr)));
+        points_by_ptr[point_ptr] = handle;
+        return handle;
+    }
+
+    void async_optimizer::unregister_label(screen_point_feature *point_ptr)
+    {
+        auto pos = points_by_ptr.find(point_ptr);
+        if(pos != points_by_ptr.end())
+        {
+            unregister_label(pos->second);
+        }
+    }
+
+    void async_optimizer::unregister_label(label_handle handle)
+    {
+        size_t idx = points_handles.get_index(handle.value);
+        if(idx == handles_table::NO_INDEX)
+        {
+            return;
+        }
+        std::unique_ptr<point_proxy> &proxy = points[idx];
+        points_by_ptr.erase(proxy->source);
+        // The source might be deleted right after unregistration
+        proxy->source = nullptr;
+        if(proxy->registered)
+        {
+            removed_points.push_back(std::move(proxy));
+        }
+        size_t last = points.size() - 1;
+        std::swap(points[idx], points[last]);
+        points_handles.swap(idx, last);
+        points.pop_back();
+        points_handles.pop_back();
+    }
+
+    void async_optimizer::register_labels(screen_point_feature *const *points,
+                                          size_t count,
+                                          label_handle *handles)
+    {
+        for(size_t k = 0; k < count; ++k)
+        {
+            label_handle handle = register_label(points[k]);
+            if(handles != nullptr)
+            {
+                handles[k] = handle;
+            }
+        }
+    }
+
+    void async_optimizer::unregister_labels(const label_handle *handles,
+                                            size_t count)
+    {
+        for(size_t k = 0; k < count; ++k)
+        {
+            unregister_label(handles[k]);
+        }
+    }
+
+    obstacle_handle async_optimizer::register_obstacle(
+            screen_obstacle *obstacle_ptr)
+    {
+        obstacle_handle handle = {obstacles_handles.push_back()};
+        obstacles.push_back(std::unique_ptr<obstacle_proxy>(
+                                new obstacle_proxy(obstacle_ptr)));
+        obstacles_by_ptr[obstacle_ptr] = handle;
+        return handle;
+    }
+
+    void async_optimizer::unregister_obstacle(screen_obstacle *obstacle_ptr)
+    {
+        auto pos = obstacles_by_ptr.find(obstacle_ptr);
+        if(pos != obstacles_by_ptr.end())
+        {
+            unregister_obstacle(pos->second);
+        }
+    }
+
+    void async_optimizer::unregister_obstacle(obstacle_handle handle)
+    {
+        size_t idx = obstacles_handles.get_index(handle.value);
+        if(idx == handles_table::NO_INDEX)
+        {
+            return;
+        }
+        std::unique_ptr<obstacle_proxy> &proxy = obstacles[idx];
+        obstacles_by_ptr.erase(proxy->source);
+        proxy->source = nullptr;
+        if(proxy->registered)
+        {
+            removed_obstacles.push_back(std::move(proxy));
+        }
+        size_t last = obstacles.size() - 1;
+        std::swap(obstacles[idx], obstacles[last]);
+        obstacles_handles.swap(idx, last);
+        obstacles.pop_back();
+        obstacles_handles.pop_back();
+    }
+
+    void async_optimizer::best_fit(float time_max)
+    {
+        if(busy.load(std::memory_order_acquire))
+        {
+            // The previous call is still running
+            return;
+        }
+        apply_results();
+        prepare_job();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job_time = time_max;
+            job_ready = true;
+            busy.store(true, std::memory_order_relaxed);
+        }
+        job_started = true;
+        start_cv.notify_one();
+    }
+
+    void async_optimizer::finish()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done_cv.wait(lock, [this]()
+            {
+                return !busy.load(std::memory_order_relaxed);
+            });
+        }
+        apply_results();
+    }
+
+    void async_optimizer::set_incremental(bool new_incremental)
+    {
+        incremental = new_incremental;
+        settings_changed = true;
+    }
+
+    void async_optimizer::set_viewport(const rectangle_i &new_viewport)
+    {
+        has_viewport = true;
+        viewport = new_viewport;
+        settings_changed = true;
+    }
+
+    void async_optimizer::reset_viewport()
+    {
+        has_viewport = false;
+        settings_changed = true;
+    }
+
+    void async_optimizer::set_label_priority(label_handle handle,
+                                             double priority)
+    {
+        size_t idx = points_handles.get_index(handle.value);
+        if(idx != handles_table::NO_INDEX)
+        {
+            points[idx]->priority = priority;
+            points[idx]->priority_changed = true;
+        }
+    }
+
+    void async_optimizer::set_labels_budget(size_t max_count)
+    {
+        labels_budget = max_count;
+        settings_changed = true;
+    }
+
+    bool async_optimizer::is_label_visible(
+            screen_point_feature *point_ptr) const
+    {
+        auto pos = points_by_ptr.find(point_ptr);
+        return pos != points_by_ptr.end() && is_label_visible(pos->second);
+    }
+
+    bool async_optimizer::is_label_visible(label_handle handle) const
+    {
+        size_t idx = points_handles.get_index(handle.value);
+        return idx != handles_table::NO_INDEX && points[idx]->visible;
+    }
+
+    const optimizer_stats& async_optimizer::get_stats() const
+    {
+        return stats;
+    }
+
+    void async_optimizer::worker_loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            start_cv.wait(lock, [this]() { return stopping || job_ready; });
+            if(stopping)
+            {
+                return;
+            }
+            job_ready = false;
+            lock.unlock();
+            run_job();
+            lock.lock();
+            busy.store(false, std::memory_order_release);
+            done_cv.notify_all();
+        }
+    }
+
+    void async_optimizer::run_job()
+    {
+        int back = 1 - front.load(std::memory_order_relaxed);
+        results_buffer &buffer = results[back];
+        optimizer->best_fit(job_time);
+        for(size_t k = 0; k < buffer.labels.size(); ++k)
+        {
+            const point_proxy *proxy = buffer.labels[k];
+            buffer.offsets[k] = proxy->get_label_offset();
+            buffer.visible[k] = optimizer->is_label_visible(proxy->handle);
+        }
+        buffer.stats = optimizer->get_stats();
+        front.store(back, std::memory_order_release);
+    }
+
+    void async_optimizer::apply_results()
+    {
+        if(!job_started)
+        {
+            return;
+        }
+        job_started = false;
+        const results_buffer &buffer =
+                results[front.load(std::memory_order_acquire)];
+        for(size_t k = 0; k < buffer.labels.size(); ++k)
+        {
+            point_proxy *proxy = buffer.labels[k];
+            // Labels unregistered during the call are skipped
+            if(proxy->source != nullptr)
+            {
+                proxy->source->set_label_offset(buffer.offsets[k]);
+                proxy->visible = buffer.visible[k] != 0;
+            }
+        }
+        // The buffer is rewritten by the call after the next one
+        stats = buffer.stats;
+    }
+
+    void async_optimizer::prepare_job()
+    {
+        for(const std::unique_ptr<point_proxy> &proxy: removed_points)
+        {
+            optimizer->unregister_label(proxy->handle);
+        }
+        removed_points.clear();
+        for(const std::unique_ptr<obstacle_proxy> &proxy: removed_obstacles)
+        {
+            optimizer->unregister_obstacle(proxy->handle);
+        }
+        removed_obstacles.clear();
+
+        if(settings_changed)
+        {
+            optimizer->set_incremental(incremental);
+            if(has_viewport)
+            {
+                optimizer->set_viewport(viewport);
+            } else {
+                optimizer->reset_viewport();
+            }
+            optimizer->set_labels_budget(labels_budget);
+            settings_changed = false;
+        }
+
+        results_buffer &buffer =
+                results[1 - front.load(std::memory_order_relaxed)];
+        buffer.labels.resize(points.size());
+        buffer.offsets.resize(points.size());
+        buffer.visible.resize(points.size());
+        for(size_t idx = 0; idx < points.size(); ++idx)
+        {
+            point_proxy &proxy = *points[idx];
+            proxy.capture();
+            if(!proxy.registered)
+            {
+                proxy.handle = optimizer->register_label(&proxy);
+                proxy.registered = true;
+            }
+            if(proxy.priority_changed)
+            {
+                optimizer->set_label_priority(proxy.handle, proxy.priority);
+                proxy.priority_changed = false;
+            }
+            buffer.labels[idx] = &proxy;
+        }
+        for(const std::unique_ptr<obstacle_proxy> &proxy: obstacles)
+        {
+            proxy->capture();
+            if(!proxy->registered)
+            {
+                proxy->handle = optimizer->register_obstacle(proxy.get());
+                proxy->registered = true;
+            }
+        }
+    }
+} // namespace labeling
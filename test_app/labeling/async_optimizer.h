@@ -0,0 +1,141 @@
+#ifndef ASYNC_OPTIMIZER_H
+#define ASYNC_OPTIMIZER_H
+#include "positions_optimizer.h"
+#include "handles_table.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace labeling
+{
+    /*
+     * Runs best_fit of another optimizer on a dedicated thread
+     *
+     * The wrapped optimizer works on snapshots of the registered labels
+     * and obstacles, so the caller may move points while their labels
+     * are optimized. best_fit never waits for the optimization. If the
+     * previous call has finished, it applies the found offsets to the
+     * labels, takes new snapshots and starts the next call. Registration
+     * and settings reach the wrapped optimizer before the next call.
+     * All methods should be called from one thread
+     */
+    class async_optimizer : public positions_optimizer
+    {
+    public:
+        /*
+         * Takes ownership of the optimizer
+         */
+        explicit async_optimizer(positions_optimizer *optimizer);
+        /*
+         * Waits for the running best_fit
+         */
+        ~async_optimizer();
+
+        label_handle register_label(screen_point_feature *);
+        void unregister_label(screen_point_feature *);
+        void unregister_label(label_handle);
+        void register_labels(screen_point_feature *const *points,
+                             size_t count,
+                             label_handle *handles);
+        void unregister_labels(const label_handle *handles, size_t count);
+
+        obstacle_handle register_obstacle(screen_obstacle *);
+        void unregister_obstacle(screen_obstacle *);
+        void unregister_obstacle(obstacle_handle);
+
+        /*
+         * Starts best_fit of the wrapped optimizer with time_max if the
+         * previous one has finished. Offsets of a call are applied by the
+         * next best_fit or finish after it
+         */
+        void best_fit(float time_max);
+        /*
+         * Waits for the running best_fit and applies its offsets
+         */
+        void finish();
+
+        void set_incremental(bool incremental);
+        void set_viewport(const geom2::rectangle_i &viewport);
+        void reset_viewport();
+        void set_label_priority(label_handle handle, double priority);
+        void set_labels_budget(size_t max_count);
+        /*
+         * @return visibility of the label in the last applied best_fit
+         */
+        bool is_label_visible(screen_point_feature *point_ptr) const;
+        bool is_label_visible(label_handle handle) const;
+
+        /*
+         * @return statistics of the last applied best_fit. The worker
+         * never writes them, they change only in best_fit and finish
+         */
+        const optimizer_stats& get_stats() const;
+    private:
+        struct point_proxy;
+        struct obstacle_proxy;
+        /*
+         * Offsets found by a best_fit call for labels[k]. Results are
+         * double buffered, the worker fills one buffer while the other
+         * one is read by the caller
+         */
+        struct results_buffer
+        {
+            std::vector<point_proxy*> labels;
+            std::vector<geom2::point_i> offsets;
+            std::vector<char> visible;
+            optimizer_stats stats;
+        };
+    private:
+        void worker_loop();
+        void run_job();
+        void apply_results();
+        /*
+         * Passes registration and settings to the wrapped optimizer and
+         * captures snapshots. Called only while the worker is idle
+         */
+        void prepare_job();
+    private:
+        std::unique_ptr<positions_optimizer> optimizer;
+
+        // Dense lists of proxies mirrored by the handles tables
+        std::vector<std::unique_ptr<point_proxy>> points;
+        handles_table points_handles;
+        std::unordered_map<screen_point_feature*, label_handle> points_by_ptr;
+        std::vector<std::unique_ptr<obstacle_proxy>> obstacles;
+        handles_table obstacles_handles;
+        std::unordered_map<screen_obstacle*, obstacle_handle>
+            obstacles_by_ptr;
+        // Unregistered proxies still registered in the wrapped optimizer
+        std::vector<std::unique_ptr<point_proxy>> removed_points;
+        std::vector<std::unique_ptr<obstacle_proxy>> removed_obstacles;
+
+        bool incremental;
+        bool has_viewport;
+        geom2::rectangle_i viewport;
+        size_t labels_budget;
+        // settings are not passed to the wrapped optimizer yet
+        bool settings_changed;
+
+        results_buffer results[2];
+        // buffer with the last finished results
+        std::atomic<int> front;
+        // copy of the applied results stats owned by the caller thread
+        optimizer_stats stats;
+        // results of the finished call are not applied yet
+        bool job_started;
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable start_cv;
+        std::condition_variable done_cv;
+        std::atomic<bool> busy;
+        bool job_ready;
+        float job_time;
+        bool stopping;
+    };
+} // namespace labeling
+#endif // ASYNC_OPTIMIZER_H
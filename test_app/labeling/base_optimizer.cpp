@@ -1,76 +1,819 @@
 #include "base_optimizer.h"
+#include "utils.h"
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <utility>
 
 using namespace geom2;
+using std::chrono::high_resolution_clock;
+using std::chrono::duration;
+
+namespace labeling
+{
+    /*
+     * Correct values from 1 to +inf
+     * Smaller components are packed together until a task has
+     * MIN_TASK_LABELS labels, so isolated labels don't cost an optimizer
+     * each
+     */
+    static const size_t MIN_TASK_LABELS = 64;
+    /*
+     * Correct values from 0 to +inf
+     * Incremental mode optimizes scenes with less than
+     * MIN_INCREMENTAL_LABELS not fixed labels as a whole. Finding the
+     * changes of such a scene costs about as much as optimizing it
+     */
+    static const size_t MIN_INCREMENTAL_LABELS = 64;
+} // namespace labeling
 
 namespace labeling
 {
     base_optimizer::base_optimizer()
+        :
+          obstacles_changed(false),
+          threads_count(0),
+          decomposition(false),
+          incremental(false),
+          bounded(false),
+          posted_sequence(0),
+          drained_sequence(0)
     {}
 
     base_optimizer::~base_optimizer()
     {}
 
-    void base_optimizer::register_label(screen_point_feature *point_ptr)
+    void base_optimizer::best_fit(float time_max)
+    {
+        auto start = high_resolution_clock::now();
+        drain_commands();
+        check_obstacles();
+        if(!(decomposition || incremental) || !can_decompose() ||
+                !decompose(start, time_max))
+        {
+            double decompose_time = ms_since(start);
+            optimize(time_max - static_cast<float>(decompose_time));
+            stats.init_time += decompose_time;
+        }
+        if(incremental)
+        {
+            remember_labels();
+        }
+        changed_rects.clear();
+        // Commands posted during the optimization are applied before
+        // best_fit returns
+        drain_commands();
+    }
+
+    void base_optimizer::set_decomposition(bool new_decomposition)
+    {
+        decomposition = new_decomposition;
+    }
+
+    void base_optimizer::set_incremental(bool new_incremental)
+    {
+        incremental = new_incremental;
+    }
+
+    void base_optimizer::set_viewport(const rectangle_i &new_viewport)
+    {
+        visibility.set_viewport(new_viewport);
+    }
+
+    void base_optimizer::reset_viewport()
+    {
+        visibility.reset_viewport();
+    }
+
+    void base_optimizer::set_label_priority(label_handle handle,
+                                            double priority)
+    {
+        size_t idx = points_handles.get_index(handle.value);
+        if(idx != handles_table::NO_INDEX)
+        {
+            points_info[idx].priority = priority;
+        }
+    }
+
+    void base_optimizer::set_labels_budget(size_t max_count)
+    {
+        visibility.set_labels_budget(max_count);
+    }
+
+    bool base_optimizer::is_label_visible(
+            screen_point_feature *point_ptr) const
+    {
+        auto pos = points_by_ptr.find(point_ptr);
+        return pos != points_by_ptr.end() && is_label_visible(pos->second);
+    }
+
+    bool base_optimizer::is_label_visible(label_handle handle) const
+    {
+        size_t idx = points_handles.get_index(handle.value);
+        return idx != handles_table::NO_INDEX && points_info[idx].visible;
+    }
+
+    size_t base_optimizer::select_visible()
+    {
+        size_t count = points_list.size();
+        if(visibility.selects_all())
+        {
+            for(label_info &info: points_info)
+            {
+                info.visible = true;
+            }
+            return count;
+        }
+
+        visibility.clear();
+        for(size_t idx = 0; idx < count; ++idx)
+        {
+            visibility.add(points_list[idx], points_info[idx].priority,
+                           points_info[idx].visible,
+                           points_handles.get_handle(idx));
+        }
+        visibility.select();
+        for(size_t idx = 0; idx < count; ++idx)
+        {
+            if(visibility.is_visible(idx))
+            {
+                points_info[idx].visible = true;
+            } else {
+                hide_label(idx);
+            }
+        }
+
+        size_t visible_end = 0;
+        for(size_t idx = 0; idx < count; ++idx)
+        {
+            if(points_info[idx].visible)
+            {
+                swap_points(visible_end, idx);
+                ++visible_end;
+            }
+        }
+        return visible_end;
+    }
+
+    void base_optimizer::hide_label(size_t idx)
+    {
+        label_info &info = points_info[idx];
+        // The label leaves free space and will be new when it is shown
+        if(incremental && info.visible && info.record.seen)
+        {
+            changed_rects.push_back(info.record.rect);
+        }
+        info.visible = false;
+        info.record.seen = false;
+    }
+
+    bool base_optimizer::can_decompose() const
+    {
+        return true;
+    }
+
+    bool base_optimizer::decompose(time_point_t start, float time_max)
+    {
+        state_t state = init_state();
+        size_t free_count = state.size();
+        if(free_count < (incremental ? MIN_INCREMENTAL_LABELS :
+                                       2 * MIN_TASK_LABELS))
+        {
+            return false;
+        }
+        update_obstacles();
+
+        reach_rects.resize(labels.size());
+        for(size_t idx = 0; idx < labels.size(); ++idx)
+        {
+            reach_rects[idx] = idx < free_count ? get_component_reach(idx) :
+                                                  get_label_rect(state, idx);
+        }
+        reach_grid.build(reach_rects);
+        size_t active_count = free_count;
+        if(incremental)
+        {
+            active_count = find_active(free_count);
+        } else {
+            active.assign(free_count, 1);
+        }
+        if(!active_count)
+        {
+            stats.clear();
+            stats.init_time = ms_since(start);
+            return true;
+        }
+
+        // Union-find over the active labels that might interact. Fixed
+        // and not active labels don't join components, they are shared by
+        // them
+        parents.resize(free_count);
+        pairs_count.assign(free_count, 0);
+        for(size_t idx = 0; idx < free_count; ++idx)
+        {
+            parents[idx] = idx;
+        }
+        for(size_t idx = 0; idx < free_count; ++idx)
+        {
+            // Without time for the components optimize gets no time too
+            // and keeps the offsets
+            if(idx % MIN_TASK_LABELS == 0 && ms_since(start) >= time_max)
+            {
+                return false;
+            }
+            if(!active[idx])
+            {
+                continue;
+            }
+            const rectangle_i &reach = reach_rects[idx];
+            reach_grid.for_each(reach, [&](size_t j)
+            {
+                if(j <= idx || j >= free_count || !active[j] ||
+                        !rectangle_intersection(reach, reach_rects[j]))
+                {
+                    return;
+                }
+                pairs_count[idx] += 1;
+                size_t l_root = find_root(idx);
+                size_t r_root = find_root(j);
+                if(l_root != r_root)
+                {
+                    parents[std::max(l_root, r_root)] =
+                            std::min(l_root, r_root);
+                }
+            });
+        }
+        init_tasks(free_count);
+        if(tasks.size() < 2 && active_count == free_count)
+        {
+            return false;
+        }
+
+        // Tasks are sorted by difficulty, so the pool starts the hardest
+        // ones first. A starting task gets the share of the time left that
+        // it would get if the workers were loaded evenly with the tasks
+        // not started yet, so time saved by finished tasks is reused
+        std::vector<std::unique_ptr<base_optimizer>> optimizers(tasks.size());
+        for(size_t task_idx = 0; task_idx < tasks.size(); ++task_idx)
+        {
+            optimizers[task_idx].reset(create_component_optimizer(task_idx));
+        }
+        stats.clear();
+        stats.init_time = ms_since(start);
+        double difficulty_left = 0;
+        for(const component_task &task: tasks)
+        {
+            difficulty_left += static_cast<double>(task.difficulty);
+        }
+        double threads = static_cast<double>(get_pool().get_threads_count());
+        std::mutex budget_mutex;
+
+        auto optimization_start = high_resolution_clock::now();
+        get_pool().run(tasks.size(), [&](size_t task_idx, size_t)
+        {
+            component_task &task = tasks[task_idx];
+            double budget;
+            {
+                std::lock_guard<std::mutex> lock(budget_mutex);
+                double difficulty = static_cast<double>(task.difficulty);
+                budget = (time_max - ms_since(start)) *
+                        std::min(1.0, threads * difficulty / difficulty_left);
+                difficulty_left -= difficulty;
+            }
+            // Labels of tasks started after time_max keep their offsets
+            if(budget <= 0)
+            {
+                task.stats.clear();
+                return;
+            }
+            run_task(task, *optimizers[task_idx], static_cast<float>(budget));
+        });
+        stats.optimization_time = ms_since(optimization_start);
+
+        for(const component_task &task: tasks)
+        {
+            stats.add_counters(task.stats);
+            stats.initial_metric += task.stats.initial_metric;
+            stats.final_metric += task.stats.final_metric;
+            stats.apply_time += task.stats.apply_time;
+            stats.unplaced_labels += task.stats.unplaced_labels;
+            stats.scratch_memory += task.stats.scratch_memory;
+        }
+        stats.scratch_memory += get_memory_usage() +
+                reach_rects.capacity() * sizeof(rectangle_i) +
+                active.capacity() * sizeof(char) +
+                points_info.capacity() * sizeof(label_info) +
+                obstacles_records.capacity() * sizeof(change_record) +
+                (parents.capacity() + pairs_count.capacity()) *
+                sizeof(size_t) + visibility.get_memory_usage() +
+                reach_grid.get_memory_usage() +
+                tasks.capacity() * sizeof(component_task);
+        return true;
+    }
+
+    size_t base_optimizer::find_active(size_t free_count)
+    {
+        active.assign(free_count, 0);
+        // Changed labels mark their previous rectangles and their reach as
+        // changed regions
+        for(size_t idx = 0; idx < labels.size(); ++idx)
+        {
+            change_record &record = points_info[idx].record;
+            rectangle_i rect{labels.get_pivot(idx) + labels.get_offset(idx),
+                             labels.get_size(idx)};
+            if(!is_changed(record, points_list[idx]->get_version(), rect))
+            {
+                continue;
+            }
+            if(record.seen)
+            {
+                changed_rects.push_back(record.rect);
+            }
+            changed_rects.push_back(reach_rects[idx]);
+        }
+        // Labels in reach of the changed regions are active
+        size_t active_count = 0;
+        for(const rectangle_i &rect: changed_rects)
+        {
+            reach_grid.for_each(rect, [&](size_t j)
+            {
+                if(j < free_count && !active[j] &&
+                        rectangle_intersection(rect, reach_rects[j]))
+                {
+                    active[j] = 1;
+                    ++active_count;
+                }
+            });
+        }
+        return active_count;
+    }
+
+    void base_optimizer::remember_labels()
+    {
+        for(size_t idx = 0; idx < points_list.size(); ++idx)
+        {
+            const screen_point_feature *point = points_list[idx];
+            if(points_info[idx].visible)
+            {
+                points_info[idx].record = change_record{
+                        point->get_version(), to_label_rect(point), true};
+            }
+        }
+    }
+
+    void base_optimizer::check_obstacles()
+    {
+        for(size_t idx = 0; idx < obstacles_list.size(); ++idx)
+        {
+            change_record &record = obstacles_records[idx];
+            uint64_t version = obstacles_list[idx]->get_version();
+            if(record.seen && record.version == version)
+            {
+                continue;
+            }
+            rectangle_i box = to_obstacle_box(obstacles_list[idx]);
+            if(record.seen)
+            {
+                obstacles_changed = true;
+            }
+            if(incremental)
+            {
+                if(record.seen)
+                {
+                    changed_rects.push_back(record.rect);
+                }
+                changed_rects.push_back(box);
+            }
+            record = change_record{version, box, true};
+        }
+    }
+
+    bool base_optimizer::is_changed(const change_record &record,
+                                    uint64_t version,
+                                    const rectangle_i &rect)
+    {
+        return !record.seen || !version || record.version != version ||
+                record.rect.left_bottom.x != rect.left_bottom.x ||
+                record.rect.left_bottom.y != rect.left_bottom.y ||
+                record.rect.sz.w != rect.sz.w ||
+                record.rect.sz.h != rect.sz.h;
+    }
+
+    rectangle_i base_optimizer::get_component_reach(size_t idx) const
+    {
+        point_i pivot = labels.get_pivot(idx);
+        point_i min_offset = labels.get_offset(idx);
+        point_i max_offset = min_offset;
+        for(size_t k = labels.prefered_begin[idx];
+            k < labels.prefered_begin[idx + 1]; ++k)
+        {
+            min_offset.x = std::min(min_offset.x, labels.prefered_x[k]);
+            min_offset.y = std::min(min_offset.y, labels.prefered_y[k]);
+            max_offset.x = std::max(max_offset.x, labels.prefered_x[k]);
+            max_offset.y = std::max(max_offset.y, labels.prefered_y[k]);
+        }
+        return get_reach_rect(pivot, labels.get_size(idx), min_offset,
+                              max_offset);
+    }
+
+    size_t base_optimizer::find_root(size_t idx)
+    {
+        while(parents[idx] != idx)
+        {
+            parents[idx] = parents[parents[idx]];
+            idx = parents[idx];
+        }
+        return idx;
+    }
+
+    void base_optimizer::init_tasks(size_t free_count)
+    {
+        // Components are numbered by their roots
+        std::vector<component_task> components;
+        std::vector<size_t> component_of(free_count);
+        for(size_t idx = 0; idx < free_count; ++idx)
+        {
+            if(!active[idx])
+            {
+                continue;
+            }
+            size_t root = find_root(idx);
+            if(root == idx)
+            {
+                component_of[idx] = components.size();
+                components.push_back(component_task());
+                components.back().difficulty = 0;
+            }
+            component_task &component = components[component_of[root]];
+            component.labels.push_back(idx);
+            component.difficulty += 1 + pairs_count[idx];
+        }
+        std::stable_sort(components.begin(), components.end(),
+                         [](const component_task &l, const component_task &r)
+        {
+            return l.difficulty > r.difficulty;
+        });
+
+        tasks.clear();
+        bool packing = false;
+        for(component_task &component: components)
+        {
+            if(!packing)
+            {
+                tasks.push_back(component_task());
+                tasks.back().difficulty = 0;
+            }
+            component_task &task = tasks.back();
+            task.labels.insert(task.labels.end(), component.labels.begin(),
+                               component.labels.end());
+            task.difficulty += component.difficulty;
+            packing = task.labels.size() < MIN_TASK_LABELS ||
+                    !decomposition;
+        }
+        std::stable_sort(tasks.begin(), tasks.end(),
+                         [](const component_task &l, const component_task &r)
+        {
+            return l.difficulty > r.difficulty;
+        });
+    }
+
+    void base_optimizer::run_task(component_task &task,
+                                  base_optimizer &optimizer,
+                                  float time_max) const
+    {
+        auto start = high_resolution_clock::now();
+        // Fixed labels and obstacles in reach of the task labels are
+        // registered in the task optimizer too
+        size_t free_count = task.labels.size();
+        std::vector<size_t> fixed;
+        std::vector<size_t> near_obstacles;
+        for(size_t idx: task.labels)
+        {
+            const rectangle_i &reach = reach_rects[idx];
+            reach_grid.for_each(reach, [&](size_t j)
+            {
+                if((j >= active.size() || !active[j]) &&
+                        rectangle_intersection(reach, reach_rects[j]))
+                {
+                    fixed.push_back(j);
+                }
+            });
+            obstacles.for_each(reach, [&](const obstacles_tree::item &item)
+            {
+                near_obstacles.push_back(item.source);
+            });
+        }
+        std::sort(fixed.begin(), fixed.end());
+        fixed.erase(std::unique(fixed.begin(), fixed.end()), fixed.end());
+        std::sort(near_obstacles.begin(), near_obstacles.end());
+        near_obstacles.erase(std::unique(near_obstacles.begin(),
+                                         near_obstacles.end()),
+                             near_obstacles.end());
+
+        optimizer.set_threads_count(1);
+        optimizer.set_decomposition(false);
+        std::vector<screen_point_feature*> task_points;
+        task_points.reserve(free_count + fixed.size());
+        for(size_t idx: task.labels)
+        {
+            task_points.push_back(points_list[idx]);
+        }
+        for(size_t idx: fixed)
+        {
+            task_points.push_back(points_list[idx]);
+        }
+        optimizer.register_labels(task_points.data(), task_points.size(),
+                                  nullptr);
+        optimizer.bounded = true;
+        for(size_t k = 0; k < free_count; ++k)
+        {
+            size_t idx = task.labels[k];
+            const rectangle_i &reach = reach_rects[idx];
+            optimizer.points_info[k].offset_bounds = rectangle_i{
+                    reach.left_bottom - labels.get_pivot(idx),
+                    size_i{reach.sz.w - labels.w[idx],
+                           reach.sz.h - labels.h[idx]}};
+        }
+        for(size_t k = free_count; k < task_points.size(); ++k)
+        {
+            optimizer.points_info[k].frozen = true;
+        }
+        for(size_t obstacle_idx: near_obstacles)
+        {
+            optimizer.register_obstacle(obstacles_list[obstacle_idx]);
+        }
+        // Registration is a part of the task budget
+        optimizer.best_fit(time_max - static_cast<float>(ms_since(start)));
+        task.stats = optimizer.get_stats();
+    }
+
+    label_handle base_optimizer::register_label(
+            screen_point_feature *point_ptr)
     {
+        label_handle handle = {points_handles.push_back()};
         points_list.push_back(point_ptr);
+        label_info info = label_info();
+        info.priority = 1;
+        info.visible = true;
+        points_info.push_back(info);
+        points_by_ptr[point_ptr] = handle;
+        return handle;
     }
 
     void base_optimizer::unregister_label(screen_point_feature *point_ptr)
     {
-        auto pos = std::find(points_list.begin(),
-               points_list.end(),
-               point_ptr);
-        if(pos == points_list.end())
+        auto pos = points_by_ptr.find(point_ptr);
+        if(pos == points_by_ptr.end())
+        {
+            return;
+        }
+        remove_point(points_handles.get_index(pos->second.value));
+    }
+
+    void base_optimizer::unregister_label(label_handle handle)
+    {
+        size_t idx = points_handles.get_index(handle.value);
+        if(idx == handles_table::NO_INDEX)
         {
             return;
         }
-        points_list.erase(pos);
+        remove_point(idx);
+    }
+
+    void base_optimizer::register_labels(screen_point_feature *const *points,
+                                         size_t count,
+                                         label_handle *handles)
+    {
+        points_list.reserve(points_list.size() + count);
+        points_by_ptr.reserve(points_by_ptr.size() + count);
+        for(size_t k = 0; k < count; ++k)
+        {
+            label_handle handle = register_label(points[k]);
+            if(handles != nullptr)
+            {
+                handles[k] = handle;
+            }
+        }
+    }
+
+    void base_optimizer::unregister_labels(const label_handle *handles,
+                                           size_t count)
+    {
+        for(size_t k = 0; k < count; ++k)
+        {
+            unregister_label(handles[k]);
+        }
+    }
+
+    void base_optimizer::remove_point(size_t idx)
+    {
+        points_by_ptr.erase(points_list[idx]);
+        const label_info &info = points_info[idx];
+        if(incremental && info.visible && info.record.seen)
+        {
+            changed_rects.push_back(info.record.rect);
+        }
+        swap_points(idx, points_list.size() - 1);
+        points_list.pop_back();
+        points_handles.pop_back();
+        points_info.pop_back();
     }
 
-    void base_optimizer::register_obstacle(screen_obstacle *obstacle_ptr)
+    void base_optimizer::swap_points(size_t l_idx, size_t r_idx)
     {
+        std::swap(points_list[l_idx], points_list[r_idx]);
+        std::swap(points_info[l_idx], points_info[r_idx]);
+        points_handles.swap(l_idx, r_idx);
+    }
+
+    obstacle_handle base_optimizer::register_obstacle(
+            screen_obstacle *obstacle_ptr)
+    {
+        obstacle_handle handle = {obstacles_handles.push_back()};
         obstacles_list.push_back(obstacle_ptr);
+        obstacles_records.push_back(change_record());
+        obstacles_by_ptr[obstacle_ptr] = handle;
+        obstacles_changed = true;
+        return handle;
     }
 
     void base_optimizer::unregister_obstacle(screen_obstacle *obstacle_ptr)
     {
-        auto pos = std::find(obstacles_list.begin(),
-                             obstacles_list.end(),
-                             obstacle_ptr);
-        if(pos == obstacles_list.end())
+        auto pos = obstacles_by_ptr.find(obstacle_ptr);
+        if(pos == obstacles_by_ptr.end())
+        {
+            return;
+        }
+        remove_obstacle(obstacles_handles.get_index(pos->second.value));
+    }
+
+    void base_optimizer::unregister_obstacle(obstacle_handle handle)
+    {
+        size_t idx = obstacles_handles.get_index(handle.value);
+        if(idx == handles_table::NO_INDEX)
+        {
+            return;
+        }
+        remove_obstacle(idx);
+    }
+
+    uint64_t base_optimizer::post_register_label(
+            screen_point_feature *point_ptr)
+    {
+        return post_command(command{command::add_label, point_ptr, nullptr,
+                                    0, 0});
+    }
+
+    uint64_t base_optimizer::post_unregister_label(
+            screen_point_feature *point_ptr)
+    {
+        return post_command(command{command::remove_label, point_ptr,
+                                    nullptr, 0, 0});
+    }
+
+    uint64_t base_optimizer::post_register_obstacle(
+            screen_obstacle *obstacle_ptr)
+    {
+        return post_command(command{command::add_obstacle, nullptr,
+                                    obstacle_ptr, 0, 0});
+    }
+
+    uint64_t base_optimizer::post_unregister_obstacle(
+            screen_obstacle *obstacle_ptr)
+    {
+        return post_command(command{command::remove_obstacle, nullptr,
+                                    obstacle_ptr, 0, 0});
+    }
+
+    uint64_t base_optimizer::post_label_priority(
+            screen_point_feature *point_ptr, double priority)
+    {
+        return post_command(command{command::label_priority, point_ptr,
+                                    nullptr, priority, 0});
+    }
+
+    uint64_t base_optimizer::post_command(command cur)
+    {
+        cur.sequence = posted_sequence.fetch_add(
+                    1, std::memory_order_relaxed) + 1;
+        commands.push(cur);
+        return cur.sequence;
+    }
+
+    void base_optimizer::drain_commands()
+    {
+        command cur;
+        while(commands.pop(cur))
+        {
+            switch(cur.t)
+            {
+            case command::add_label:
+                register_label(cur.point);
+                break;
+            case command::remove_label:
+                unregister_label(cur.point);
+                break;
+            case command::add_obstacle:
+                register_obstacle(cur.obstacle);
+                break;
+            case command::remove_obstacle:
+                unregister_obstacle(cur.obstacle);
+                break;
+            case command::label_priority:
+            {
+                auto pos = points_by_ptr.find(cur.point);
+                if(pos != points_by_ptr.end())
+                {
+                    set_label_priority(pos->second, cur.priority);
+                }
+                break;
+            }
+            }
+            finish_command(cur.sequence);
+        }
+    }
+
+    void base_optimizer::finish_command(uint64_t sequence)
+    {
+        uint64_t drained = drained_sequence.load(std::memory_order_relaxed);
+        if(sequence != drained + 1)
         {
+            drained_ahead.push_back(sequence);
             return;
         }
-        obstacles_list.erase(pos);
+        drained = sequence;
+        for(auto pos = drained_ahead.begin(); pos != drained_ahead.end();)
+        {
+            if(*pos == drained + 1)
+            {
+                drained += 1;
+                drained_ahead.erase(pos);
+                pos = drained_ahead.begin();
+            } else {
+                ++pos;
+            }
+        }
+        drained_sequence.store(drained, std::memory_order_release);
+    }
+
+    uint64_t base_optimizer::get_drained_sequence() const
+    {
+        return drained_sequence.load(std::memory_order_acquire);
+    }
+
+    void base_optimizer::remove_obstacle(size_t idx)
+    {
+        obstacles_by_ptr.erase(obstacles_list[idx]);
+        if(incremental && obstacles_records[idx].seen)
+        {
+            changed_rects.push_back(obstacles_records[idx].rect);
+        }
+        size_t last = obstacles_list.size() - 1;
+        std::swap(obstacles_list[idx], obstacles_list[last]);
+        std::swap(obstacles_records[idx], obstacles_records[last]);
+        obstacles_handles.swap(idx, last);
+        obstacles_list.pop_back();
+        obstacles_records.pop_back();
+        obstacles_handles.pop_back();
+        obstacles_changed = true;
     }
 
-    base_optimizer::points_list_t::iterator base_optimizer::move_fixed_to_end()
+    base_optimizer::points_list_t::iterator base_optimizer::move_fixed_to_end(
+            size_t count)
     {
-        auto fixed_beg = points_list.begin();
-        // Move point with fixed labels to the end
-        for(auto it = points_list.begin(); it != points_list.end(); ++it)
+        size_t fixed_beg = 0;
+        // Move points with fixed or frozen labels to the end
+        for(size_t idx = 0; idx < count; ++idx)
         {
-            if (!(*it)->is_label_fixed()) {
-                auto tmp = *fixed_beg;
-                *fixed_beg = *it;
-                *it = tmp;
+            if(!points_list[idx]->is_label_fixed() && !points_info[idx].frozen)
+            {
+                swap_points(fixed_beg, idx);
                 ++fixed_beg;
             }
         }
-        return fixed_beg;
+        return points_list.begin() + fixed_beg;
     }
 
 
     base_optimizer::state_t base_optimizer::init_state()
     {
         state_t state;
-        auto fixed_beg = move_fixed_to_end();
-        state.reserve(fixed_beg - points_list.begin());
-        for(auto it = points_list.begin(); it != fixed_beg; ++it)
+        init_state(state);
+        return state;
+    }
+
+    void base_optimizer::init_state(state_t &state)
+    {
+        size_t visible_count = select_visible();
+        auto fixed_beg = move_fixed_to_end(visible_count);
+        labels.capture(points_list, visible_count);
+        state.resize(fixed_beg - points_list.begin());
+        std::fill(labels.fixed.begin() + state.size(), labels.fixed.end(),
+                  1);
+        for(size_t idx = 0; idx < state.size(); ++idx)
         {
-            state.push_back((*it)->get_label_offset());
+            state[idx] = labels.get_offset(idx);
         }
-        return state;
     }
 
     void base_optimizer::apply_state(const state_t &state)
@@ -80,4 +823,112 @@ namespace labeling
             points_list[i]->set_label_offset(state[i]);
         }
     }
+
+    rectangle_i base_optimizer::get_label_rect(const state_t &state,
+                                               size_t idx) const
+    {
+        point_i offset = idx < state.size() ? state[idx] : labels.get_offset(idx);
+        return rectangle_i{offset + labels.get_pivot(idx),
+                           labels.get_size(idx)};
+    }
+
+    point_i base_optimizer::clamp_offset(size_t idx,
+                                         const point_i &offset) const
+    {
+        if(!bounded)
+        {
+            return offset;
+        }
+        const rectangle_i &bounds = points_info[idx].offset_bounds;
+        return point_i(std::min(std::max(offset.x, bounds.left_bottom.x),
+                                bounds.left_bottom.x + bounds.sz.w),
+                       std::min(std::max(offset.y, bounds.left_bottom.y),
+                                bounds.left_bottom.y + bounds.sz.h));
+    }
+
+    void base_optimizer::init_grid(const state_t &state)
+    {
+        get_label_rects(state, grid_rects);
+        grid.build(grid_rects);
+    }
+
+    void base_optimizer::init_grid(const state_t &state,
+                                   labels_grid &state_grid) const
+    {
+        std::vector<rectangle_i> rects;
+        get_label_rects(state, rects);
+        state_grid.build(rects);
+    }
+
+    void base_optimizer::get_label_rects(const state_t &state,
+                                         std::vector<rectangle_i> &rects) const
+    {
+        rects.resize(labels.size());
+        for(size_t idx = 0; idx < labels.size(); ++idx)
+        {
+            rects[idx] = get_label_rect(state, idx);
+        }
+    }
+
+    void base_optimizer::set_state_offset(state_t &state, size_t idx,
+                                          const point_i &offset)
+    {
+        set_state_offset(state, grid, idx, offset);
+    }
+
+    void base_optimizer::set_state_offset(state_t &state,
+                                          labels_grid &state_grid,
+                                          size_t idx,
+                                          const point_i &offset) const
+    {
+        rectangle_i old_rect = get_label_rect(state, idx);
+        state[idx] = offset;
+        state_grid.update(idx, old_rect, get_label_rect(state, idx));
+    }
+
+    void base_optimizer::update_obstacles()
+    {
+        if(!obstacles_changed)
+        {
+            return;
+        }
+        obstacles.build(obstacles_list);
+        obstacles_changed = false;
+    }
+
+    void base_optimizer::set_threads_count(size_t count)
+    {
+        if(count == threads_count)
+        {
+            return;
+        }
+        threads_count = count;
+        pool.reset();
+    }
+
+    thread_pool& base_optimizer::get_pool()
+    {
+        if(!pool)
+        {
+            pool.reset(new thread_pool(threads_count));
+        }
+        return *pool;
+    }
+
+    const optimizer_stats& base_optimizer::get_stats() const
+    {
+        return stats;
+    }
+
+    size_t base_optimizer::get_memory_usage() const
+    {
+        return labels.get_memory_usage() + grid.get_memory_usage() +
+                obstacles.get_memory_usage();
+    }
+
+    double base_optimizer::ms_since(time_point_t start)
+    {
+        return duration<double, std::milli>(
+                    high_resolution_clock::now() - start).count();
+    }
 } // namespace labeling
@@ -1,6 +1,17 @@
 #ifndef BASE_OPTIMIZER_H
 #define BASE_OPTIMIZER_H
 #include "positions_optimizer.h"
+#include "labels_grid.h"
+#include "labels_snapshot.h"
+#include "obstacles_tree.h"
+#include "thread_pool.h"
+#include "handles_table.h"
+#include "mpsc_queue.h"
+#include "visibility_selector.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
 
 namespace labeling
 {
@@ -10,22 +21,337 @@ namespace labeling
         base_optimizer();
         ~base_optimizer();
 
-        void register_label(screen_point_feature *);
+        /*
+         * With decomposition splits labels into components that can't
+         * interact and optimizes every component by a separate optimizer
+         * on the thread pool. Time is split in proportion to the
+         * components difficulty. Labels that form one component are
+         * optimized by optimize() directly
+         */
+        void best_fit(float time_max);
+        /*
+         * Enables splitting of labels into components in best_fit.
+         * Component optimizers are created by every call, so they don't
+         * reuse caches and buffers of previous calls. Labels of a
+         * component don't leave its reach. Off by default
+         */
+        void set_decomposition(bool decomposition);
+        /*
+         * Incremental mode compares labels and obstacles with the
+         * previous call by their version stamps and rectangles. Labels
+         * that changed and labels in reach of changes are optimized as
+         * components, the others stay where they are. Small scenes are
+         * optimized as a whole. Off by default
+         */
+        void set_incremental(bool incremental);
+
+        void set_viewport(const geom2::rectangle_i &viewport);
+        void reset_viewport();
+        void set_label_priority(label_handle handle, double priority);
+        void set_labels_budget(size_t max_count);
+        bool is_label_visible(screen_point_feature *point_ptr) const;
+        bool is_label_visible(label_handle handle) const;
+
+        /*
+         * Labels are kept in a dense list, unregistration moves the last
+         * label to the freed place. A label should be registered once.
+         * Grids and the labels snapshot are rebuilt in bulk by the next
+         * best_fit, so batch calls cost O(count)
+         */
+        label_handle register_label(screen_point_feature *);
         void unregister_label(screen_point_feature *);
+        void unregister_label(label_handle);
+        void register_labels(screen_point_feature *const *points,
+                             size_t count,
+                             label_handle *handles);
+        void unregister_labels(const label_handle *handles, size_t count);
 
-        void register_obstacle(screen_obstacle *);
+        /*
+         * Obstacles are copied to the obstacles tree on the next best_fit
+         * after registration. Their geometry is expected to stay the same
+         * while they are registered
+         */
+        obstacle_handle register_obstacle(screen_obstacle *);
         void unregister_obstacle(screen_obstacle *);
+        void unregister_obstacle(obstacle_handle);
+
+        /*
+         * Registration commands that might be posted from any threads at
+         * any time, even while best_fit is running. They never wait and
+         * are applied in the posting order by drain_commands. best_fit
+         * drains commands before and after the optimization
+         *
+         * The optimizer keeps the passed pointer until the command is
+         * drained. A registered label or obstacle is used until its
+         * unregistration is drained, it might be destroyed when
+         * get_drained_sequence() is not less than the sequence returned
+         * by its post_unregister call. Commands not drained when the
+         * optimizer is destroyed are dropped
+         *
+         * @return sequence number of the command
+         */
+        uint64_t post_register_label(screen_point_feature *);
+        uint64_t post_unregister_label(screen_point_feature *);
+        uint64_t post_register_obstacle(screen_obstacle *);
+        uint64_t post_unregister_obstacle(screen_obstacle *);
+        uint64_t post_label_priority(screen_point_feature *,
+                                     double priority);
+        /*
+         * Applies posted commands. Should be called from the thread that
+         * calls best_fit
+         */
+        void drain_commands();
+        /*
+         * Might be called from any thread
+         *
+         * @return sequence number up to which all posted commands are
+         * applied
+         */
+        uint64_t get_drained_sequence() const;
+
+        /*
+         * Sets the number of threads used by best_fit. 0 means hardware
+         * concurrency(default)
+         */
+        void set_threads_count(size_t threads_count);
+
+        const optimizer_stats& get_stats() const;
     protected:
         typedef std::vector<screen_point_feature*> points_list_t;
         typedef std::vector<geom2::point_i> state_t;
         typedef std::vector<screen_obstacle*> obstacles_list_t;
+        typedef std::chrono::high_resolution_clock::time_point time_point_t;
     protected:
+        /*
+         * Optimizes all registered labels
+         */
+        virtual void optimize(float time_max) = 0;
+        /*
+         * @return new optimizer with the same settings for component
+         * task_idx of the current best_fit call
+         */
+        virtual base_optimizer* create_component_optimizer(
+                size_t task_idx) = 0;
+        /*
+         * @return false if labels should not be split into components now
+         */
+        virtual bool can_decompose() const;
+
         void apply_state(const state_t &state);
+        /*
+         * Moves hidden labels to the end of points_list and fixed labels
+         * before them, captures snapshot of visible labels and returns
+         * offsets of not fixed visible labels
+         */
         state_t init_state();
-        points_list_t::iterator move_fixed_to_end();
+        /*
+         * Same as init_state() but reuses memory of state
+         */
+        void init_state(state_t &state);
+        /*
+         * @return end of not fixed labels among the first count labels
+         */
+        points_list_t::iterator move_fixed_to_end(size_t count);
+
+        /*
+         * Label rectangle of points_list[idx]. Labels that are not fixed
+         * take their offsets from state
+         */
+        geom2::rectangle_i get_label_rect(const state_t &state,
+                                          size_t idx) const;
+        /*
+         * Offsets of not fixed labels should pass through it. Labels of
+         * component optimizers are kept in the reach they were split by,
+         * so labels of different components never overlap
+         *
+         * @return offset clamped to the offsets label idx might take
+         */
+        geom2::point_i clamp_offset(size_t idx,
+                                    const geom2::point_i &offset) const;
+        /*
+         * Indexes all labels in grid. Should be called after init_state
+         */
+        void init_grid(const state_t &state);
+        void init_grid(const state_t &state, labels_grid &state_grid) const;
+        void get_label_rects(const state_t &state,
+                             std::vector<geom2::rectangle_i> &rects) const;
+        /*
+         * Changes state[idx] keeping grid up to date
+         */
+        void set_state_offset(state_t &state, size_t idx,
+                              const geom2::point_i &offset);
+        void set_state_offset(state_t &state, labels_grid &state_grid,
+                              size_t idx, const geom2::point_i &offset) const;
+        /*
+         * Rebuilds obstacles tree if obstacles list was changed
+         */
+        void update_obstacles();
+        thread_pool& get_pool();
+        /*
+         * @return bytes allocated by labels snapshot, grid and obstacles
+         * tree
+         */
+        size_t get_memory_usage() const;
+        static double ms_since(time_point_t start);
     protected:
         points_list_t points_list;
         obstacles_list_t obstacles_list;
+        /*
+         * Labels data captured by init_state. Optimizers should read
+         * labels from it instead of points_list
+         */
+        labels_snapshot labels;
+        labels_grid grid;
+        obstacles_tree obstacles;
+        bool obstacles_changed;
+        /*
+         * Should be filled by best_fit
+         */
+        optimizer_stats stats;
+    private:
+        /*
+         * Labels of one or several small components optimized by one
+         * component optimizer
+         */
+        struct component_task
+        {
+            std::vector<size_t> labels;
+            size_t difficulty;
+            optimizer_stats stats;
+        };
+        /*
+         * Label or obstacle as it was seen by the previous best_fit
+         */
+        struct change_record
+        {
+            uint64_t version;
+            geom2::rectangle_i rect;
+            bool seen;
+        };
+        struct label_info
+        {
+            change_record record;
+            double priority;
+            // fixed by the parent optimizer
+            bool frozen;
+            bool visible;
+            // offsets allowed by the parent optimizer if bounded
+            geom2::rectangle_i offset_bounds;
+        };
+        /*
+         * Posted registration command
+         */
+        struct command
+        {
+            enum type
+            {
+                add_label,
+                remove_label,
+                add_obstacle,
+                remove_obstacle,
+                label_priority
+            };
+
+            type t;
+            screen_point_feature *point;
+            screen_obstacle *obstacle;
+            double priority;
+            uint64_t sequence;
+        };
+    private:
+        /*
+         * Finds components of the active labels and optimizes them if
+         * there are several or if some labels are not active.
+         * @return false if optimize() should be called for all labels
+         */
+        bool decompose(time_point_t start, float time_max);
+        /*
+         * Marks not fixed labels that changed or are in reach of changes
+         * as active. @return active labels count
+         */
+        size_t find_active(size_t free_count);
+        /*
+         * Records versions and rectangles of labels after best_fit
+         */
+        void remember_labels();
+        /*
+         * Compares obstacles with their records, the tree is rebuilt if
+         * any of them changed
+         */
+        void check_obstacles();
+        static bool is_changed(const change_record &record,
+                               uint64_t version,
+                               const geom2::rectangle_i &rect);
+        /*
+         * Chooses visible labels by the viewport, the budget and the
+         * priorities and moves them to the beginning of points_list.
+         * @return visible labels count
+         */
+        size_t select_visible();
+        void hide_label(size_t idx);
+        /*
+         * Reach of the label from its current offset to its prefered
+         * positions
+         */
+        geom2::rectangle_i get_component_reach(size_t idx) const;
+        void init_tasks(size_t free_count);
+        void run_task(component_task &task, base_optimizer &optimizer,
+                      float time_max) const;
+        size_t find_root(size_t idx);
+        /*
+         * Swaps labels keeping their handles valid
+         */
+        void swap_points(size_t l_idx, size_t r_idx);
+        void remove_point(size_t idx);
+        void remove_obstacle(size_t idx);
+        /*
+         * Numbers and queues a command
+         * @return its sequence number
+         */
+        uint64_t post_command(command cur);
+        /*
+         * Moves drained_sequence past the drained command if all the
+         * commands before it are drained
+         */
+        void finish_command(uint64_t sequence);
+    private:
+        size_t threads_count;
+        std::unique_ptr<thread_pool> pool;
+        handles_table points_handles;
+        handles_table obstacles_handles;
+        std::unordered_map<screen_point_feature*, label_handle> points_by_ptr;
+        std::unordered_map<screen_obstacle*, obstacle_handle> obstacles_by_ptr;
+
+        bool decomposition;
+        bool incremental;
+        // labels are kept in their offset_bounds
+        bool bounded;
+        // info of points_list items
+        std::vector<label_info> points_info;
+        // records of obstacles_list items
+        std::vector<change_record> obstacles_records;
+        // regions that changed since the previous call
+        std::vector<geom2::rectangle_i> changed_rects;
+        visibility_selector visibility;
+        // init_grid buffer
+        std::vector<geom2::rectangle_i> grid_rects;
+        // decompose buffers
+        std::vector<char> active;
+        std::vector<geom2::rectangle_i> reach_rects;
+        labels_grid reach_grid;
+        // union-find parents of not fixed labels
+        std::vector<size_t> parents;
+        std::vector<size_t> pairs_count;
+        std::vector<component_task> tasks;
+        mpsc_queue<command> commands;
+        std::atomic<uint64_t> posted_sequence;
+        std::atomic<uint64_t> drained_sequence;
+        /*
+         * Sequences of drained commands above drained_sequence. Posts
+         * racing each other might reach the queue not in their sequences
+         * order
+         */
+        std::vector<uint64_t> drained_ahead;
     };
 } // namespace labeling
 #endif // BASE_OPTIMIZER_H
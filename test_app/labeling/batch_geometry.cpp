@@ -0,0 +1,421 @@
+#include "batch_geometry.h"
+
+#if defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86)
+#define GEOM2_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GEOM2_TARGET(name)
+#else
+#define GEOM2_TARGET(name) __attribute__((target(name)))
+#endif
+#endif
+
+namespace geom2
+{
+    enum cpu_level
+    {
+        cpu_scalar,
+        cpu_sse41,
+        cpu_avx2
+    };
+
+    static cpu_level detect_cpu_level()
+    {
+#if defined(GEOM2_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+        __cpuid(info, 1);
+        bool sse41 = (info[2] & (1 << 19)) != 0;
+        bool os_avx = (info[2] & (1 << 27)) != 0 &&
+                (info[2] & (1 << 28)) != 0 &&
+                (_xgetbv(0) & 6) == 6;
+        bool avx2 = false;
+        if(max_leaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = os_avx && (info[1] & (1 << 5)) != 0;
+        }
+        return avx2 ? cpu_avx2 : (sse41 ? cpu_sse41 : cpu_scalar);
+#elif defined(GEOM2_X86)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+        {
+            return cpu_avx2;
+        }
+        if(__builtin_cpu_supports("sse4.1"))
+        {
+            return cpu_sse41;
+        }
+        return cpu_scalar;
+#else
+        return cpu_scalar;
+#endif
+    }
+
+    static cpu_level get_cpu_level()
+    {
+        static const cpu_level level = detect_cpu_level();
+        return level;
+    }
+
+    template<class T>
+    static rectangle<T> get_rect(const rectangles_soa<T> &rects, size_t k)
+    {
+        return rectangle<T>{point<T>(rects.x[k], rects.y[k]),
+                            size<T>{rects.w[k], rects.h[k]}};
+    }
+
+    template<class T, class S>
+    static S intersection_summ_scalar(const rectangle<T> &rect,
+                                      const rectangles_soa<T> &rects,
+                                      size_t begin)
+    {
+        S summ = S();
+        for(size_t k = begin; k < rects.size(); ++k)
+        {
+            summ += rectangle_intersection(rect, get_rect(rects, k));
+        }
+        return summ;
+    }
+
+    template<class T>
+    static void touch_mask_scalar(const rectangle<T> &rect,
+                                  const rectangles_soa<T> &rects,
+                                  size_t begin,
+                                  unsigned char *mask)
+    {
+        T x2 = rect.left_bottom.x + rect.sz.w;
+        T y2 = rect.left_bottom.y + rect.sz.h;
+        for(size_t k = begin; k < rects.size(); ++k)
+        {
+            mask[k] = rects.x[k] <= x2 &&
+                    rect.left_bottom.x <= rects.x[k] + rects.w[k] &&
+                    rects.y[k] <= y2 &&
+                    rect.left_bottom.y <= rects.y[k] + rects.h[k];
+        }
+    }
+
+    /*
+     * @param lt is the mask of segment coordinates less than the
+     * rectangle minimum, bits are start x, start y, end x, end y
+     * @param gt is the same mask for coordinates greater than the maximum
+     */
+    static unsigned char segment_class(int lt, int gt)
+    {
+        int outside = ((lt & (lt >> 2)) | (gt & (gt >> 2))) & 3;
+        int inside = (lt | gt) == 0;
+        return static_cast<unsigned char>(
+                    (outside == 0) * (seg_crossing - inside));
+    }
+
+    static void classify_scalar(const rectangle_i &rect,
+                                const segment_i *segs,
+                                size_t begin,
+                                size_t count,
+                                unsigned char *classes)
+    {
+        int x_min = rect.left_bottom.x;
+        int y_min = rect.left_bottom.y;
+        int x_max = x_min + rect.sz.w;
+        int y_max = y_min + rect.sz.h;
+        for(size_t k = begin; k < count; ++k)
+        {
+            const segment_i &seg = segs[k];
+            int lt = (seg.start.x < x_min) | (seg.start.y < y_min) << 1 |
+                    (seg.end.x < x_min) << 2 | (seg.end.y < y_min) << 3;
+            int gt = (seg.start.x > x_max) | (seg.start.y > y_max) << 1 |
+                    (seg.end.x > x_max) << 2 | (seg.end.y > y_max) << 3;
+            classes[k] = segment_class(lt, gt);
+        }
+    }
+
+#ifdef GEOM2_X86
+    GEOM2_TARGET("avx2")
+    static long long intersection_summ_avx2(const rectangle_i &rect,
+                                            const rectangles_soa_i &rects)
+    {
+        const __m256i qx = _mm256_set1_epi32(rect.left_bottom.x);
+        const __m256i qy = _mm256_set1_epi32(rect.left_bottom.y);
+        const __m256i qx2 = _mm256_set1_epi32(rect.left_bottom.x + rect.sz.w);
+        const __m256i qy2 = _mm256_set1_epi32(rect.left_bottom.y + rect.sz.h);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i summ = _mm256_setzero_si256();
+        size_t k = 0;
+        for(; k + 8 <= rects.size(); k += 8)
+        {
+            __m256i x = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&rects.x[k]));
+            __m256i y = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&rects.y[k]));
+            __m256i w = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&rects.w[k]));
+            __m256i h = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&rects.h[k]));
+            __m256i x_top = _mm256_max_epi32(qx, x);
+            __m256i y_top = _mm256_max_epi32(qy, y);
+            __m256i x_bot = _mm256_min_epi32(qx2, _mm256_add_epi32(x, w));
+            __m256i y_bot = _mm256_min_epi32(qy2, _mm256_add_epi32(y, h));
+            // Empty intersections get zero width or height
+            __m256i dx = _mm256_max_epi32(_mm256_sub_epi32(x_bot, x_top), zero);
+            __m256i dy = _mm256_max_epi32(_mm256_sub_epi32(y_bot, y_top), zero);
+            __m256i area = _mm256_mullo_epi32(dx, dy);
+            summ = _mm256_add_epi64(summ, _mm256_cvtepi32_epi64(
+                                        _mm256_castsi256_si128(area)));
+            summ = _mm256_add_epi64(summ, _mm256_cvtepi32_epi64(
+                                        _mm256_extracti128_si256(area, 1)));
+        }
+        long long lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), summ);
+        // Avoid AVX-SSE transition penalties in the calling code
+        _mm256_zeroupper();
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+                intersection_summ_scalar<int, long long>(rect, rects, k);
+    }
+
+    GEOM2_TARGET("sse4.1")
+    static long long intersection_summ_sse41(const rectangle_i &rect,
+                                             const rectangles_soa_i &rects)
+    {
+        const __m128i qx = _mm_set1_epi32(rect.left_bottom.x);
+        const __m128i qy = _mm_set1_epi32(rect.left_bottom.y);
+        const __m128i qx2 = _mm_set1_epi32(rect.left_bottom.x + rect.sz.w);
+        const __m128i qy2 = _mm_set1_epi32(rect.left_bottom.y + rect.sz.h);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i summ = _mm_setzero_si128();
+        size_t k = 0;
+        for(; k + 4 <= rects.size(); k += 4)
+        {
+            __m128i x = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&rects.x[k]));
+            __m128i y = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&rects.y[k]));
+            __m128i w = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&rects.w[k]));
+            __m128i h = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&rects.h[k]));
+            __m128i x_top = _mm_max_epi32(qx, x);
+            __m128i y_top = _mm_max_epi32(qy, y);
+            __m128i x_bot = _mm_min_epi32(qx2, _mm_add_epi32(x, w));
+            __m128i y_bot = _mm_min_epi32(qy2, _mm_add_epi32(y, h));
+            __m128i dx = _mm_max_epi32(_mm_sub_epi32(x_bot, x_top), zero);
+            __m128i dy = _mm_max_epi32(_mm_sub_epi32(y_bot, y_top), zero);
+            __m128i area = _mm_mullo_epi32(dx, dy);
+            summ = _mm_add_epi64(summ, _mm_cvtepi32_epi64(area));
+            summ = _mm_add_epi64(summ, _mm_cvtepi32_epi64(
+                                     _mm_srli_si128(area, 8)));
+        }
+        long long lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), summ);
+        return lanes[0] + lanes[1] +
+                intersection_summ_scalar<int, long long>(rect, rects, k);
+    }
+
+    GEOM2_TARGET("avx2")
+    static void touch_mask_avx2(const rectangle_i &rect,
+                                const rectangles_soa_i &rects,
+                                unsigned char *mask)
+    {
+        const __m256i qx = _mm256_set1_epi32(rect.left_bottom.x);
+        const __m256i qy = _mm256_set1_epi32(rect.left_bottom.y);
+        const __m256i qx2 = _mm256_set1_epi32(rect.left_bottom.x + rect.sz.w);
+        const __m256i qy2 = _mm256_set1_epi32(rect.left_bottom.y + rect.sz.h);
+        size_t k = 0;
+        for(; k + 8 <= rects.size(); k += 8)
+        {
+            __m256i x = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&rects.x[k]));
+            __m256i y = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&rects.y[k]));
+            __m256i w = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&rects.w[k]));
+            __m256i h = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&rects.h[k]));
+            __m256i miss = _mm256_or_si256(
+                        _mm256_or_si256(
+                            _mm256_cmpgt_epi32(x, qx2),
+                            _mm256_cmpgt_epi32(qx, _mm256_add_epi32(x, w))),
+                        _mm256_or_si256(
+                            _mm256_cmpgt_epi32(y, qy2),
+                            _mm256_cmpgt_epi32(qy, _mm256_add_epi32(y, h))));
+            int bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(miss));
+            for(int lane = 0; lane < 8; ++lane)
+            {
+                mask[k + lane] = (bits >> lane) & 1;
+            }
+        }
+        _mm256_zeroupper();
+        touch_mask_scalar(rect, rects, k, mask);
+    }
+
+    GEOM2_TARGET("sse4.1")
+    static void touch_mask_sse41(const rectangle_i &rect,
+                                 const rectangles_soa_i &rects,
+                                 unsigned char *mask)
+    {
+        const __m128i qx = _mm_set1_epi32(rect.left_bottom.x);
+        const __m128i qy = _mm_set1_epi32(rect.left_bottom.y);
+        const __m128i qx2 = _mm_set1_epi32(rect.left_bottom.x + rect.sz.w);
+        const __m128i qy2 = _mm_set1_epi32(rect.left_bottom.y + rect.sz.h);
+        size_t k = 0;
+        for(; k + 4 <= rects.size(); k += 4)
+        {
+            __m128i x = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&rects.x[k]));
+            __m128i y = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&rects.y[k]));
+            __m128i w = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&rects.w[k]));
+            __m128i h = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&rects.h[k]));
+            __m128i miss = _mm_or_si128(
+                        _mm_or_si128(
+                            _mm_cmpgt_epi32(x, qx2),
+                            _mm_cmpgt_epi32(qx, _mm_add_epi32(x, w))),
+                        _mm_or_si128(
+                            _mm_cmpgt_epi32(y, qy2),
+                            _mm_cmpgt_epi32(qy, _mm_add_epi32(y, h))));
+            int bits = ~_mm_movemask_ps(_mm_castsi128_ps(miss));
+            for(int lane = 0; lane < 4; ++lane)
+            {
+                mask[k + lane] = (bits >> lane) & 1;
+            }
+        }
+        touch_mask_scalar(rect, rects, k, mask);
+    }
+
+    // Segment is loaded as 4 ints: start x, start y, end x, end y
+    static_assert(sizeof(segment_i) == 4 * sizeof(int),
+                  "segment_i should have no padding");
+
+    GEOM2_TARGET("avx2")
+    static void classify_avx2(const rectangle_i &rect,
+                              const segment_i *segs,
+                              size_t count,
+                              unsigned char *classes)
+    {
+        int x_min = rect.left_bottom.x;
+        int y_min = rect.left_bottom.y;
+        int x_max = x_min + rect.sz.w;
+        int y_max = y_min + rect.sz.h;
+        const __m256i lo = _mm256_setr_epi32(x_min, y_min, x_min, y_min,
+                                             x_min, y_min, x_min, y_min);
+        const __m256i hi = _mm256_setr_epi32(x_max, y_max, x_max, y_max,
+                                             x_max, y_max, x_max, y_max);
+        size_t k = 0;
+        for(; k + 2 <= count; k += 2)
+        {
+            // Two segments per register
+            __m256i ends = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i*>(&segs[k]));
+            int lt = _mm256_movemask_ps(_mm256_castsi256_ps(
+                                            _mm256_cmpgt_epi32(lo, ends)));
+            int gt = _mm256_movemask_ps(_mm256_castsi256_ps(
+                                            _mm256_cmpgt_epi32(ends, hi)));
+            classes[k] = segment_class(lt & 15, gt & 15);
+            classes[k + 1] = segment_class(lt >> 4, gt >> 4);
+        }
+        _mm256_zeroupper();
+        classify_scalar(rect, segs, k, count, classes);
+    }
+
+    GEOM2_TARGET("sse4.1")
+    static void classify_sse41(const rectangle_i &rect,
+                               const segment_i *segs,
+                               size_t count,
+                               unsigned char *classes)
+    {
+        int x_min = rect.left_bottom.x;
+        int y_min = rect.left_bottom.y;
+        int x_max = x_min + rect.sz.w;
+        int y_max = y_min + rect.sz.h;
+        const __m128i lo = _mm_setr_epi32(x_min, y_min, x_min, y_min);
+        const __m128i hi = _mm_setr_epi32(x_max, y_max, x_max, y_max);
+        for(size_t k = 0; k < count; ++k)
+        {
+            __m128i ends = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&segs[k]));
+            int lt = _mm_movemask_ps(_mm_castsi128_ps(
+                                         _mm_cmpgt_epi32(lo, ends)));
+            int gt = _mm_movemask_ps(_mm_castsi128_ps(
+                                         _mm_cmpgt_epi32(ends, hi)));
+            classes[k] = segment_class(lt, gt);
+        }
+    }
+#endif // GEOM2_X86
+
+    long long rectangles_intersection_summ(const rectangle_i &rect,
+                                           const rectangles_soa_i &rects)
+    {
+#ifdef GEOM2_X86
+        // Vector versions are slower than the scalar one for the spans
+        // shorter than the vector width
+        cpu_level level = get_cpu_level();
+        if(level == cpu_avx2 && rects.size() >= 8)
+        {
+            return intersection_summ_avx2(rect, rects);
+        }
+        if(level >= cpu_sse41 && rects.size() >= 4)
+        {
+            return intersection_summ_sse41(rect, rects);
+        }
+#endif
+        return intersection_summ_scalar<int, long long>(rect, rects, 0);
+    }
+
+    double rectangles_intersection_summ(const rectangle_f &rect,
+                                        const rectangles_soa_f &rects)
+    {
+        return intersection_summ_scalar<float, double>(rect, rects, 0);
+    }
+
+    void rectangles_touch_mask(const rectangle_i &rect,
+                               const rectangles_soa_i &rects,
+                               unsigned char *mask)
+    {
+#ifdef GEOM2_X86
+        cpu_level level = get_cpu_level();
+        if(level == cpu_avx2 && rects.size() >= 8)
+        {
+            touch_mask_avx2(rect, rects, mask);
+            return;
+        }
+        if(level >= cpu_sse41 && rects.size() >= 4)
+        {
+            touch_mask_sse41(rect, rects, mask);
+            return;
+        }
+#endif
+        touch_mask_scalar(rect, rects, 0, mask);
+    }
+
+    void rectangles_touch_mask(const rectangle_f &rect,
+                               const rectangles_soa_f &rects,
+                               unsigned char *mask)
+    {
+        touch_mask_scalar(rect, rects, 0, mask);
+    }
+
+    void segments_rect_classify(const rectangle_i &rect,
+                                const segment_i *segs,
+                                size_t count,
+                                unsigned char *classes)
+    {
+#ifdef GEOM2_X86
+        cpu_level level = get_cpu_level();
+        if(level == cpu_avx2 && count >= 2)
+        {
+            classify_avx2(rect, segs, count, classes);
+            return;
+        }
+        if(level >= cpu_sse41)
+        {
+            classify_sse41(rect, segs, count, classes);
+            return;
+        }
+#endif
+        classify_scalar(rect, segs, 0, count, classes);
+    }
+} // namespace geom2
@@ -0,0 +1,128 @@
+#ifndef BATCH_GEOMETRY_H
+#define BATCH_GEOMETRY_H
+#include <vector>
+#include "geometry.h"
+
+namespace geom2
+{
+    /*
+     * Structure of arrays of rectangles for batch functions
+     */
+    template<class T>
+    struct rectangles_soa
+    {
+        std::vector<T> x;
+        std::vector<T> y;
+        std::vector<T> w;
+        std::vector<T> h;
+
+        size_t size() const;
+        void clear();
+        void push_back(const rectangle<T> &rect);
+        rectangle<T> get(size_t k) const;
+        size_t get_memory_usage() const;
+    };
+
+    template<class T>
+    size_t rectangles_soa<T>::size() const
+    {
+        return x.size();
+    }
+
+    template<class T>
+    void rectangles_soa<T>::clear()
+    {
+        x.clear();
+        y.clear();
+        w.clear();
+        h.clear();
+    }
+
+    template<class T>
+    void rectangles_soa<T>::push_back(const rectangle<T> &rect)
+    {
+        x.push_back(rect.left_bottom.x);
+        y.push_back(rect.left_bottom.y);
+        w.push_back(rect.sz.w);
+        h.push_back(rect.sz.h);
+    }
+
+    template<class T>
+    rectangle<T> rectangles_soa<T>::get(size_t k) const
+    {
+        rectangle<T> rect;
+        rect.left_bottom = point<T>(x[k], y[k]);
+        rect.sz.w = w[k];
+        rect.sz.h = h[k];
+        return rect;
+    }
+
+    template<class T>
+    size_t rectangles_soa<T>::get_memory_usage() const
+    {
+        return (x.capacity() + y.capacity() + w.capacity() + h.capacity()) *
+                sizeof(T);
+    }
+
+    typedef rectangles_soa<int> rectangles_soa_i;
+    typedef rectangles_soa<float> rectangles_soa_f;
+
+    /*
+     * Calculates summ of rectangle_intersection(rect, rects[k]) for all k
+     *
+     * Integer version uses AVX2 or SSE4.1 if the CPU supports them.
+     * The result is the same as of the scalar rectangle_intersection
+     */
+    long long rectangles_intersection_summ(const rectangle_i &rect,
+                                           const rectangles_soa_i &rects);
+    double rectangles_intersection_summ(const rectangle_f &rect,
+                                        const rectangles_soa_f &rects);
+
+    /*
+     * Checks rect intersection with each of rects including borders
+     *
+     * @param mask is output parameter. mask[k] is set to 1 if rects[k]
+     * touches rect and to 0 otherwise. Should contain at least
+     * rects.size() items
+     * For a rect of zero size located at point p mask[k] is
+     * point_in_rect(p, rects[k])
+     *
+     * Integer version uses AVX2 or SSE4.1 if the CPU supports them
+     */
+    void rectangles_touch_mask(const rectangle_i &rect,
+                               const rectangles_soa_i &rects,
+                               unsigned char *mask);
+    void rectangles_touch_mask(const rectangle_f &rect,
+                               const rectangles_soa_f &rects,
+                               unsigned char *mask);
+
+    /*
+     * Segment position relative to a rectangle by Cohen–Sutherland
+     * outcodes of its ends
+     */
+    enum seg_rect_class
+    {
+        // both ends are outside of the same rectangle border
+        seg_outside,
+        // both ends are inside of the rectangle including borders
+        seg_inside,
+        // segment might cross the rectangle borders
+        seg_crossing
+    };
+
+    /*
+     * Classifies each of segs against rect by seg_rect_class.
+     * seg_rect_intersection finds no intersections for seg_outside and
+     * seg_inside segments, only seg_crossing ones should be clipped by it
+     *
+     * @param classes is output parameter. classes[k] is set to the class
+     * of segs[k]. Should contain at least count items
+     *
+     * Uses AVX2 or SSE4.1 if the CPU supports them
+     */
+    void segments_rect_classify(const rectangle_i &rect,
+                                const segment_i *segs,
+                                size_t count,
+                                unsigned char *classes);
+} // namespace geom2
+#endif // BATCH_GEOMETRY_H
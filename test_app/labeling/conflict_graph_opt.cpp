@@ -0,0 +1,567 @@
+#include "conflict_graph_opt.h"
+#include <chrono>
+#include <algorithm>
+#include <limits>
+
+using namespace geom2;
+using std::chrono::high_resolution_clock;
+typedef std::numeric_limits<double> double_limits;
+
+namespace labeling
+{
+    /*
+     * Correct values from 0 to +inf
+     * Metric weights. Same meaning as in sim_annealing_opt
+     */
+    static const double OFFSET_FACTOR = 10;
+    static const double LABELS_INTERSECTION_PENALTY = 4;
+    static const double OBSTACLES_INTERSECTION_PENALTY = 1;
+    static const double PREFERED_POSITIONS_PENALTY = 5;
+    /*
+     * Correct values from 1 to +inf
+     * Generated candidates are the current offset shifted by
+     * label size / SHIFT_FACTOR in four directions. The bigger the
+     * smaller the shifts
+     */
+    static const int SHIFT_FACTOR = 4;
+    /*
+     * Correct values from 1 to +inf
+     * Local search stops after MAX_LOCAL_SEARCH_ROUNDS passes over all
+     * labels or after a pass that moved nothing
+     */
+    static const int MAX_LOCAL_SEARCH_ROUNDS = 20;
+    /*
+     * Correct values from 1 to +inf
+     * Labels scored by one thread pool task. time_max is also checked
+     * once per CHUNK_SIZE labels in every phase
+     */
+    static const size_t CHUNK_SIZE = 256;
+    static const size_t NO_CANDIDATE = static_cast<size_t>(-1);
+} // namespace labeling
+
+namespace labeling
+{
+    conflict_graph_opt::conflict_graph_opt()
+    {}
+
+    conflict_graph_opt::~conflict_graph_opt()
+    {}
+
+    base_optimizer* conflict_graph_opt::create_component_optimizer(
+            size_t /*task_idx*/)
+    {
+        return new conflict_graph_opt();
+    }
+
+    void conflict_graph_opt::optimize(float time_max)
+    {
+        auto start = high_resolution_clock::now();
+        stats.clear();
+
+        state_t state = init_state();
+        update_obstacles();
+        // Labels keep the current offsets if the graph is not complete
+        // by time_max
+        bool in_time = init_candidates(state, start, time_max);
+        if(in_time)
+        {
+            in_time = init_conflicts(state, start, time_max);
+            for(const worker_scratch &scratch: scratches)
+            {
+                stats.add_counters(scratch.stats);
+            }
+        }
+        if(!in_time)
+        {
+            stats.init_time = ms_since(start);
+            stats.scratch_memory = get_memory_usage() + get_buffers_memory();
+            return;
+        }
+        // The first candidate of every label is its current offset
+        for(size_t pos = 0; pos < state.size(); ++pos)
+        {
+            chosen[pos] = candidates_begin[pos];
+        }
+        stats.initial_metric = get_energy();
+        stats.init_time = ms_since(start);
+
+        auto optimization_start = high_resolution_clock::now();
+        in_time = select_greedy(start, time_max);
+        if(get_energy() > stats.initial_metric)
+        {
+            // Local search starts from the current offsets then
+            for(size_t pos = 0; pos < state.size(); ++pos)
+            {
+                chosen[pos] = candidates_begin[pos];
+            }
+        }
+        for(int round = 0; round < MAX_LOCAL_SEARCH_ROUNDS && in_time;
+            ++round)
+        {
+            bool moved = false;
+            for(size_t pos = 0; pos < state.size(); ++pos)
+            {
+                if(pos % CHUNK_SIZE == 0 && ms_since(start) >= time_max)
+                {
+                    in_time = false;
+                    break;
+                }
+                moved = improve(pos) || moved;
+            }
+            if(!moved)
+            {
+                break;
+            }
+        }
+        stats.optimization_time = ms_since(optimization_start);
+
+        auto apply_start = high_resolution_clock::now();
+        for(size_t pos = 0; pos < state.size(); ++pos)
+        {
+            state[labels_order[pos]] = candidate_offset[chosen[pos]];
+        }
+        apply_state(state);
+        stats.apply_time = ms_since(apply_start);
+
+        stats.final_metric = get_energy();
+        stats.unplaced_labels = count_unplaced();
+        stats.scratch_memory = get_memory_usage() + get_buffers_memory();
+    }
+
+    void conflict_graph_opt::init_order(const state_t &state)
+    {
+        // Labels are sorted by rows of the average label height and by x
+        // in a row, so labels that are close on the screen are close in
+        // the candidates arrays too
+        long long h_summ = 0;
+        point_i min_point(std::numeric_limits<int>::max(),
+                          std::numeric_limits<int>::max());
+        for(size_t idx = 0; idx < state.size(); ++idx)
+        {
+            h_summ += labels.h[idx];
+            min_point.x = std::min(min_point.x, labels.pivot_x[idx]);
+            min_point.y = std::min(min_point.y, labels.pivot_y[idx]);
+        }
+        long long row_h = std::max(1LL, h_summ / std::max<long long>(
+                                       static_cast<long long>(state.size()),
+                                       1));
+        order.resize(state.size());
+        for(size_t idx = 0; idx < state.size(); ++idx)
+        {
+            long long row = (labels.pivot_y[idx] - min_point.y) / row_h;
+            long long x = labels.pivot_x[idx] - min_point.x;
+            order[idx].first = static_cast<double>((row << 32) + x);
+            order[idx].second = idx;
+        }
+        std::sort(order.begin(), order.end());
+        // Fixed labels keep their indices
+        labels_order.resize(labels.size());
+        for(size_t pos = 0; pos < labels.size(); ++pos)
+        {
+            labels_order[pos] = pos < state.size() ? order[pos].second : pos;
+        }
+    }
+
+    bool conflict_graph_opt::init_candidates(const state_t &state,
+                                             time_point_t start,
+                                             float time_max)
+    {
+        if(ms_since(start) >= time_max)
+        {
+            return false;
+        }
+        init_order(state);
+        candidates_begin.resize(state.size() + 1);
+        candidate_pos.clear();
+        candidate_offset.clear();
+        candidate_rects.clear();
+        for(size_t pos = 0; pos < state.size(); ++pos)
+        {
+            if(pos % CHUNK_SIZE == 0 && ms_since(start) >= time_max)
+            {
+                return false;
+            }
+            size_t idx = labels_order[pos];
+            candidates_begin[pos] = candidate_pos.size();
+            add_candidate(pos, state[idx]);
+            for(size_t k = labels.prefered_begin[idx];
+                k < labels.prefered_begin[idx + 1]; ++k)
+            {
+                add_candidate(pos, point_i(labels.prefered_x[k],
+                                           labels.prefered_y[k]));
+            }
+            int shift_x = labels.w[idx] / SHIFT_FACTOR;
+            int shift_y = labels.h[idx] / SHIFT_FACTOR;
+            add_candidate(pos, state[idx] + point_i(shift_x, 0));
+            add_candidate(pos, state[idx] + point_i(-shift_x, 0));
+            add_candidate(pos, state[idx] + point_i(0, shift_y));
+            add_candidate(pos, state[idx] + point_i(0, -shift_y));
+        }
+        candidates_begin[state.size()] = candidate_pos.size();
+
+        // Reach rectangle of a not fixed label bounds all its candidates
+        reach_rects.resize(labels.size());
+        for(size_t pos = 0; pos < labels.size(); ++pos)
+        {
+            reach_rects[pos] = get_label_rect(state, labels_order[pos]);
+        }
+        for(size_t candidate = 0; candidate < candidate_pos.size();
+            ++candidate)
+        {
+            rectangle_i &reach = reach_rects[candidate_pos[candidate]];
+            point_i right_up = reach.right_up();
+            const rectangle_i &rect = candidate_rects[candidate];
+            reach.left_bottom.x = std::min(reach.left_bottom.x,
+                                           rect.left_bottom.x);
+            reach.left_bottom.y = std::min(reach.left_bottom.y,
+                                           rect.left_bottom.y);
+            right_up.x = std::max(right_up.x, rect.right_up().x);
+            right_up.y = std::max(right_up.y, rect.right_up().y);
+            reach.sz.w = right_up.x - reach.left_bottom.x;
+            reach.sz.h = right_up.y - reach.left_bottom.y;
+        }
+        reach_grid.build(reach_rects);
+        return true;
+    }
+
+    void conflict_graph_opt::add_candidate(size_t pos,
+                                           const point_i &new_offset)
+    {
+        size_t idx = labels_order[pos];
+        point_i offset = clamp_offset(idx, new_offset);
+        for(size_t candidate = candidates_begin[pos];
+            candidate < candidate_pos.size(); ++candidate)
+        {
+            if(candidate_offset[candidate].x == offset.x &&
+                    candidate_offset[candidate].y == offset.y)
+            {
+                return;
+            }
+        }
+        candidate_pos.push_back(pos);
+        candidate_offset.push_back(offset);
+        candidate_rects.push_back(rectangle_i{offset + labels.get_pivot(idx),
+                                              labels.get_size(idx)});
+    }
+
+    bool conflict_graph_opt::init_conflicts(const state_t &state,
+                                            time_point_t start,
+                                            float time_max)
+    {
+        size_t candidates_count = candidate_pos.size();
+        candidate_cost.resize(candidates_count);
+        candidate_blocked.resize(candidates_count);
+        conflicts_begin.resize(candidates_count);
+        conflicts_end.resize(candidates_count);
+        chosen.assign(state.size(), NO_CANDIDATE);
+
+        size_t chunks_count = (state.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        chunks_conflicts.resize(chunks_count);
+        scratches.resize(get_pool().get_threads_count());
+        for(worker_scratch &scratch: scratches)
+        {
+            scratch.stats.clear();
+            scratch.timed_out = false;
+        }
+        get_pool().run(chunks_count, [&](size_t chunk, size_t worker_idx)
+        {
+            worker_scratch &scratch = scratches[worker_idx];
+            if(ms_since(start) < time_max)
+            {
+                score_chunk(state, chunk, scratch);
+            } else {
+                scratch.timed_out = true;
+            }
+        });
+        for(const worker_scratch &scratch: scratches)
+        {
+            if(scratch.timed_out)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void conflict_graph_opt::score_chunk(const state_t &state,
+                                         size_t chunk,
+                                         worker_scratch &scratch)
+    {
+        size_t free_count = state.size();
+        conflicts_list_t &chunk_conflicts = chunks_conflicts[chunk];
+        chunk_conflicts.clear();
+        size_t chunk_end = std::min((chunk + 1) * CHUNK_SIZE, free_count);
+        for(size_t pos = chunk * CHUNK_SIZE; pos < chunk_end; ++pos)
+        {
+            size_t idx = labels_order[pos];
+            // Candidates of two labels might intersect only if the labels
+            // reach rectangles do
+            scratch.neighbours.clear();
+            const rectangle_i &reach = reach_rects[pos];
+            reach_grid.for_each(reach, [&](size_t j)
+            {
+                if(j != pos && rectangle_intersection(reach, reach_rects[j]))
+                {
+                    scratch.neighbours.push_back(j);
+                }
+            });
+            // Most labels are far from obstacles, their candidates are not
+            // checked one by one
+            bool near_obstacles = false;
+            obstacles.for_each(reach, [&](const obstacles_tree::item &)
+            {
+                near_obstacles = true;
+            });
+            scratch.stats.obstacles_queries += 1;
+
+            for(size_t candidate = candidates_begin[pos];
+                candidate < candidates_begin[pos + 1]; ++candidate)
+            {
+                const point_i &offset = candidate_offset[candidate];
+                const rectangle_i &rect = candidate_rects[candidate];
+                double obstacles_intersection = 0;
+                if(near_obstacles)
+                {
+                    obstacles_intersection = obstacles.intersection(rect);
+                    scratch.stats.obstacles_queries += 1;
+                }
+                long long fixed_intersection = 0;
+                conflicts_begin[candidate] = chunk_conflicts.size();
+                for(size_t j: scratch.neighbours)
+                {
+                    long long area = rectangle_intersection(rect,
+                                                            reach_rects[j]);
+                    scratch.stats.rectangle_intersection_calls += 1;
+                    if(j >= free_count)
+                    {
+                        fixed_intersection += area;
+                        continue;
+                    }
+                    if(area <= 0)
+                    {
+                        continue;
+                    }
+                    for(size_t other = candidates_begin[j];
+                        other < candidates_begin[j + 1]; ++other)
+                    {
+                        area = rectangle_intersection(
+                                    rect, candidate_rects[other]);
+                        if(area > 0)
+                        {
+                            chunk_conflicts.push_back(
+                                        conflict_t{other, area});
+                        }
+                    }
+                    scratch.stats.rectangle_intersection_calls +=
+                            candidates_begin[j + 1] - candidates_begin[j];
+                }
+                conflicts_end[candidate] = chunk_conflicts.size();
+
+                candidate_cost[candidate] =
+                        OFFSET_FACTOR * sqr_points_distance(
+                            offset, labels.get_offset(idx)) +
+                        PREFERED_POSITIONS_PENALTY *
+                        point_to_points_metric(offset, idx) +
+                        OBSTACLES_INTERSECTION_PENALTY *
+                        obstacles_intersection +
+                        LABELS_INTERSECTION_PENALTY *
+                        static_cast<double>(fixed_intersection);
+                candidate_blocked[candidate] = obstacles_intersection > 0 ||
+                        fixed_intersection > 0;
+                scratch.stats.metric_calls += 1;
+            }
+        }
+    }
+
+    bool conflict_graph_opt::select_greedy(time_point_t start,
+                                           float time_max)
+    {
+        // Cheap candidates with few conflicts go first, like in the
+        // greedy weighted independent set algorithm
+        size_t candidates_count = candidate_pos.size();
+        order.resize(candidates_count);
+        for(size_t candidate = 0; candidate < candidates_count; ++candidate)
+        {
+            size_t degree = conflicts_end[candidate] -
+                    conflicts_begin[candidate];
+            order[candidate].first = (candidate_cost[candidate] + 1) *
+                    static_cast<double>(degree + 1);
+            order[candidate].second = candidate;
+        }
+        std::sort(order.begin(), order.end());
+
+        // Chosen candidates are only compared with each other, the
+        // current offsets are forgotten
+        std::fill(chosen.begin(), chosen.end(), NO_CANDIDATE);
+        bool in_time = true;
+        for(size_t k = 0; k < order.size(); ++k)
+        {
+            if(k % CHUNK_SIZE == 0 && ms_since(start) >= time_max)
+            {
+                in_time = false;
+                break;
+            }
+            size_t candidate = order[k].second;
+            size_t pos = candidate_pos[candidate];
+            if(chosen[pos] != NO_CANDIDATE || has_conflicts(candidate))
+            {
+                continue;
+            }
+            chosen[pos] = candidate;
+            stats.iterations += 1;
+            stats.accepted_moves += 1;
+        }
+
+        // Labels without a free candidate take the least intersecting one.
+        // Labels not reached in time keep the current offsets
+        for(size_t pos = 0; pos < chosen.size(); ++pos)
+        {
+            if(chosen[pos] != NO_CANDIDATE)
+            {
+                continue;
+            }
+            chosen[pos] = candidates_begin[pos];
+            if(in_time)
+            {
+                improve(pos);
+            }
+        }
+        return in_time;
+    }
+
+    bool conflict_graph_opt::improve(size_t pos)
+    {
+        size_t best = chosen[pos];
+        double best_score = get_score(best);
+        for(size_t candidate = candidates_begin[pos];
+            candidate < candidates_begin[pos + 1]; ++candidate)
+        {
+            if(candidate == chosen[pos])
+            {
+                continue;
+            }
+            double score = get_score(candidate);
+            if(score < best_score)
+            {
+                best = candidate;
+                best_score = score;
+            }
+        }
+        stats.iterations += 1;
+        if(best == chosen[pos])
+        {
+            stats.rejected_moves += 1;
+            return false;
+        }
+        chosen[pos] = best;
+        stats.accepted_moves += 1;
+        return true;
+    }
+
+    double conflict_graph_opt::get_score(size_t candidate) const
+    {
+        long long intersection = 0;
+        const conflicts_list_t &list = get_conflicts_list(candidate);
+        for(size_t k = conflicts_begin[candidate];
+            k < conflicts_end[candidate]; ++k)
+        {
+            const conflict_t &conflict = list[k];
+            if(chosen[candidate_pos[conflict.idx]] == conflict.idx)
+            {
+                intersection += conflict.area;
+            }
+        }
+        // Intersection of two not fixed labels is a part of both labels
+        // metrics
+        return candidate_cost[candidate] + 2 * LABELS_INTERSECTION_PENALTY *
+                static_cast<double>(intersection);
+    }
+
+    bool conflict_graph_opt::has_conflicts(size_t candidate) const
+    {
+        const conflicts_list_t &list = get_conflicts_list(candidate);
+        for(size_t k = conflicts_begin[candidate];
+            k < conflicts_end[candidate]; ++k)
+        {
+            const conflict_t &conflict = list[k];
+            if(chosen[candidate_pos[conflict.idx]] == conflict.idx)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    double conflict_graph_opt::get_energy() const
+    {
+        double energy = 0;
+        for(size_t candidate: chosen)
+        {
+            // get_score counts every intersection twice
+            energy += (get_score(candidate) + candidate_cost[candidate]) / 2;
+        }
+        return energy;
+    }
+
+    size_t conflict_graph_opt::count_unplaced() const
+    {
+        size_t unplaced = 0;
+        for(size_t candidate: chosen)
+        {
+            if(candidate_blocked[candidate] || has_conflicts(candidate))
+            {
+                ++unplaced;
+            }
+        }
+        return unplaced;
+    }
+
+    const conflict_graph_opt::conflicts_list_t&
+            conflict_graph_opt::get_conflicts_list(size_t candidate) const
+    {
+        return chunks_conflicts[candidate_pos[candidate] / CHUNK_SIZE];
+    }
+
+    double conflict_graph_opt::point_to_points_metric(const point_i &point,
+                                                      size_t idx) const
+    {
+        double min_distance = double_limits::max();
+        for(size_t k = labels.prefered_begin[idx];
+            k < labels.prefered_begin[idx + 1]; ++k)
+        {
+            double cur_distance =
+                    labels.prefered_weight[k] *
+                    sqr_points_distance(point, point_i(labels.prefered_x[k],
+                                                       labels.prefered_y[k]));
+            min_distance = std::min(min_distance, cur_distance);
+        }
+        return min_distance;
+    }
+
+    size_t conflict_graph_opt::get_buffers_memory() const
+    {
+        size_t memory =
+                (labels_order.capacity() + candidates_begin.capacity() +
+                 candidate_pos.capacity() +
+                 conflicts_begin.capacity() + conflicts_end.capacity() +
+                 chosen.capacity()) * sizeof(size_t) +
+                candidate_offset.capacity() * sizeof(point_i) +
+                candidate_rects.capacity() * sizeof(rectangle_i) +
+                candidate_cost.capacity() * sizeof(double) +
+                order.capacity() * sizeof(order_item_t) +
+                candidate_blocked.capacity() +
+                reach_rects.capacity() * sizeof(rectangle_i) +
+                reach_grid.get_memory_usage() +
+                chunks_conflicts.capacity() * sizeof(conflicts_list_t) +
+                scratches.capacity() * sizeof(worker_scratch);
+        for(const conflicts_list_t &chunk_conflicts: chunks_conflicts)
+        {
+            memory += chunk_conflicts.capacity() * sizeof(conflict_t);
+        }
+        for(const worker_scratch &scratch: scratches)
+        {
+            memory += scratch.neighbours.capacity() * sizeof(size_t);
+        }
+        return memory;
+    }
+} // namespace labeling
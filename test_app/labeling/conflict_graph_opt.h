@@ -0,0 +1,147 @@
+#ifndef CONFLICT_GRAPH_OPT_H
+#define CONFLICT_GRAPH_OPT_H
+
+#include "positions_optimizer.h"
+#include "base_optimizer.h"
+
+namespace labeling
+{
+    /*
+     * Positions optimizer that chooses every label position from a small
+     * set of candidates
+     *
+     * Candidates of a label are its current offset, its prefered
+     * positions and the current offset shifted by a part of the label
+     * size. Candidates of different labels that intersect are connected
+     * in a conflict graph. Candidates that intersect fixed labels or
+     * obstacles are penalized. best_fit greedily picks an independent set
+     * of cheap candidates with few conflicts and then improves it with
+     * local search. Time per call grows about linearly with the labels
+     * count
+     */
+    class conflict_graph_opt : public base_optimizer
+    {
+    public:
+        conflict_graph_opt();
+        ~conflict_graph_opt();
+    protected:
+        void optimize(float time_max);
+        base_optimizer* create_component_optimizer(size_t task_idx);
+    private:
+        /*
+         * Intersection area of a candidate with candidate idx
+         */
+        struct conflict_t
+        {
+            size_t idx;
+            long long area;
+        };
+        typedef std::vector<conflict_t> conflicts_list_t;
+        typedef std::pair<double, size_t> order_item_t;
+        /*
+         * Per worker buffer for labels near the scored one
+         */
+        struct worker_scratch
+        {
+            std::vector<size_t> neighbours;
+            // kernels counters of the worker
+            optimizer_stats stats;
+            // the worker skipped chunks after time_max
+            bool timed_out;
+        };
+    private:
+        void init_order(const state_t &state);
+        /*
+         * @return false if time_max was over before candidates of all
+         * labels were generated
+         */
+        bool init_candidates(const state_t &state, time_point_t start,
+                             float time_max);
+        void add_candidate(size_t pos, const geom2::point_i &offset);
+        /*
+         * Scores candidates and builds the conflict graph
+         * @return false if time_max was over before all chunks were
+         * scored
+         */
+        bool init_conflicts(const state_t &state, time_point_t start,
+                            float time_max);
+        void score_chunk(const state_t &state, size_t chunk,
+                         worker_scratch &scratch);
+        /*
+         * @return false if time_max was over before all candidates were
+         * tried
+         */
+        bool select_greedy(time_point_t start, float time_max);
+        /*
+         * Moves label labels_order[pos] to its best candidate if it is
+         * better than the chosen one
+         * @return true if the label was moved
+         */
+        bool improve(size_t pos);
+        /*
+         * Cost of candidate plus penalty for intersections with the
+         * chosen candidates of other labels
+         */
+        double get_score(size_t candidate) const;
+        bool has_conflicts(size_t candidate) const;
+        /*
+         * Summ of chosen candidates scores
+         */
+        double get_energy() const;
+        size_t count_unplaced() const;
+        /*
+         * @return list that stores conflicts of candidate
+         */
+        const conflicts_list_t& get_conflicts_list(size_t candidate) const;
+        /*
+         * Minimal weighted squared distance from point to label idx
+         * prefered positions
+         */
+        double point_to_points_metric(const geom2::point_i &point,
+                                      size_t idx) const;
+        /*
+         * @return bytes allocated by candidates and the conflict graph
+         */
+        size_t get_buffers_memory() const;
+    private:
+        /*
+         * Not fixed labels sorted by their position on the screen. Fixed
+         * labels follow them in the original order. Per label buffers are
+         * indexed by positions in labels_order
+         */
+        std::vector<size_t> labels_order;
+        /*
+         * Candidates of label labels_order[pos] are
+         * [candidates_begin[pos], candidates_begin[pos + 1]). The first
+         * one is the current offset
+         */
+        std::vector<size_t> candidates_begin;
+        std::vector<size_t> candidate_pos;
+        std::vector<geom2::point_i> candidate_offset;
+        std::vector<geom2::rectangle_i> candidate_rects;
+        std::vector<double> candidate_cost;
+        // candidate intersects fixed labels or obstacles
+        std::vector<char> candidate_blocked;
+        /*
+         * Grid of labels reach rectangles. Reach rectangle of a not fixed
+         * label bounds all its candidates, fixed labels reach only their
+         * own rectangles
+         */
+        std::vector<geom2::rectangle_i> reach_rects;
+        labels_grid reach_grid;
+        /*
+         * Conflicts are found in parallel by chunks of labels and stay
+         * in the chunks lists. Conflicts of candidate c are
+         * [conflicts_begin[c], conflicts_end[c]) of its chunk list
+         */
+        std::vector<conflicts_list_t> chunks_conflicts;
+        std::vector<size_t> conflicts_begin;
+        std::vector<size_t> conflicts_end;
+        std::vector<worker_scratch> scratches;
+        // chosen candidate of every not fixed label
+        std::vector<size_t> chosen;
+        // labels or candidates sorted by the key
+        std::vector<order_item_t> order;
+    };
+} // namespace labeling
+#endif // CONFLICT_GRAPH_OPT_H
@@ -36,12 +36,12 @@ namespace geom2
     template<class T>
     T rectangle_intersection(const rectangle<T> &l, const rectangle<T> &r)
     {
-        const T &x_top = std::max(l.left_bottom.x, r.left_bottom.x);
-        const T &y_top = std::max(l.left_bottom.y, r.left_bottom.y);
-        const T &x_bot = std::min(l.left_bottom.x + l.sz.w,
-                                  r.left_bottom.x + r.sz.w);
-        const T &y_bot = std::min(l.left_bottom.y + l.sz.h,
-                                  r.left_bottom.y + r.sz.h);
+        T x_top = std::max(l.left_bottom.x, r.left_bottom.x);
+        T y_top = std::max(l.left_bottom.y, r.left_bottom.y);
+        T x_bot = std::min(l.left_bottom.x + l.sz.w,
+                           r.left_bottom.x + r.sz.w);
+        T y_bot = std::min(l.left_bottom.y + l.sz.h,
+                           r.left_bottom.y + r.sz.h);
         if(x_top >= x_bot || y_top >= y_bot)
         {
             return T();
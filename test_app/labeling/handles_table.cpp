@@ -0,0 +1,59 @@
+#include "handles_table.h"
+#include <limits>
+#include <utility>
+
+namespace labeling
+{
+    const size_t handles_table::NO_INDEX;
+    const uint64_t handles_table::SLOT_MASK;
+
+    uint64_t handles_table::push_back()
+    {
+        uint32_t slot;
+        if(free_slots.empty())
+        {
+            slot = static_cast<uint32_t>(indices.size());
+            indices.push_back(NO_INDEX);
+            generations.push_back(1);
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        uint64_t handle = (static_cast<uint64_t>(generations[slot]) << 32) |
+                slot;
+        indices[slot] = handles.size();
+        handles.push_back(handle);
+        return handle;
+    }
+
+    void handles_table::pop_back()
+    {
+        uint32_t slot = static_cast<uint32_t>(handles.back() & SLOT_MASK);
+        handles.pop_back();
+        indices[slot] = NO_INDEX;
+        // A slot with the last generation is not reused, so its handles
+        // can't be repeated
+        if(generations[slot] < std::numeric_limits<uint32_t>::max())
+        {
+            ++generations[slot];
+            free_slots.push_back(slot);
+        }
+    }
+
+    void handles_table::swap(size_t l_idx, size_t r_idx)
+    {
+        std::swap(handles[l_idx], handles[r_idx]);
+        indices[handles[l_idx] & SLOT_MASK] = l_idx;
+        indices[handles[r_idx] & SLOT_MASK] = r_idx;
+    }
+
+    size_t handles_table::get_index(uint64_t handle) const
+    {
+        uint64_t slot = handle & SLOT_MASK;
+        if(slot >= indices.size() || generations[slot] != (handle >> 32))
+        {
+            return NO_INDEX;
+        }
+        return indices[slot];
+    }
+} // namespace labeling
@@ -0,0 +1,63 @@
+#ifndef HANDLES_TABLE_H
+#define HANDLES_TABLE_H
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace labeling
+{
+    /*
+     * Stable handles of items stored in a dense array
+     *
+     * The owner keeps items in a vector and mirrors every change of their
+     * order here. Items are removed by swapping with the last one, so all
+     * operations are O(1) and handles keep pointing to the same items.
+     * Low 32 bits of a handle are its slot, high ones are the generation
+     * of the slot. Slots of removed items are reused with the next
+     * generation, so handles of removed items stay invalid. Handle 0 is
+     * never valid
+     */
+    class handles_table
+    {
+    public:
+        static const size_t NO_INDEX = static_cast<size_t>(-1);
+    public:
+        /*
+         * @return handle of the item appended to the array
+         */
+        uint64_t push_back();
+        /*
+         * Removes the last item and frees its handle
+         */
+        void pop_back();
+        void swap(size_t l_idx, size_t r_idx);
+
+        /*
+         * @return index of the item or NO_INDEX if handle is not valid
+         */
+        size_t get_index(uint64_t handle) const;
+        uint64_t get_handle(size_t idx) const;
+        size_t size() const;
+    private:
+        static const uint64_t SLOT_MASK = 0xffffffffULL;
+    private:
+        // index of the item in every slot, NO_INDEX for free ones
+        std::vector<size_t> indices;
+        // generation of every slot
+        std::vector<uint32_t> generations;
+        // handle of every item
+        std::vector<uint64_t> handles;
+        std::vector<uint32_t> free_slots;
+    };
+
+    inline uint64_t handles_table::get_handle(size_t idx) const
+    {
+        return handles[idx];
+    }
+
+    inline size_t handles_table::size() const
+    {
+        return handles.size();
+    }
+} // namespace labeling
+#endif // HANDLES_TABLE_H
@@ -0,0 +1,52 @@
+# Labeling core sources. Included by the projects that compile the core
+# into themselves, labeling.pro in this directory builds it as a library
+
+SOURCES += \
+    $$PWD/sim_annealing_opt.cpp \
+    $$PWD/utils.cpp \
+    $$PWD/ray_intersection_opt.cpp \
+    $$PWD/base_optimizer.cpp \
+    $$PWD/geometry.cpp \
+    $$PWD/labels_grid.cpp \
+    $$PWD/obstacles_tree.cpp \
+    $$PWD/thread_pool.cpp \
+    $$PWD/labels_snapshot.cpp \
+    $$PWD/batch_geometry.cpp \
+    $$PWD/random_generator.cpp \
+    $$PWD/optimizer_stats.cpp \
+    $$PWD/handles_table.cpp \
+    $$PWD/conflict_graph_opt.cpp \
+    $$PWD/async_optimizer.cpp \
+    $$PWD/scene_trace.cpp \
+    $$PWD/optimizer_factory.cpp \
+    $$PWD/tiled_optimizer.cpp \
+    $$PWD/visibility_selector.cpp
+
+HEADERS += \
+    $$PWD/geometry.h \
+    $$PWD/point.h \
+    $$PWD/positions_optimizer.h \
+    $$PWD/rectangle.h \
+    $$PWD/screen_obstacle.h \
+    $$PWD/screen_point_feature.h \
+    $$PWD/segment.h \
+    $$PWD/sim_annealing_opt.h \
+    $$PWD/size.h \
+    $$PWD/utils.h \
+    $$PWD/ray_intersection_opt.h \
+    $$PWD/base_optimizer.h \
+    $$PWD/labels_grid.h \
+    $$PWD/obstacles_tree.h \
+    $$PWD/thread_pool.h \
+    $$PWD/labels_snapshot.h \
+    $$PWD/batch_geometry.h \
+    $$PWD/random_generator.h \
+    $$PWD/optimizer_stats.h \
+    $$PWD/handles_table.h \
+    $$PWD/conflict_graph_opt.h \
+    $$PWD/async_optimizer.h \
+    $$PWD/mpsc_queue.h \
+    $$PWD/scene_trace.h \
+    $$PWD/optimizer_factory.h \
+    $$PWD/tiled_optimizer.h \
+    $$PWD/visibility_selector.h
@@ -0,0 +1,15 @@
+#-------------------------------------------------
+#
+# Labeling core as a static library without Qt
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = labeling
+TEMPLATE = lib
+
+CONFIG += staticlib c++11
+CONFIG -= qt
+
+include(labeling.pri)
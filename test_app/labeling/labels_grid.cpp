@@ -0,0 +1,158 @@
+#include "labels_grid.h"
+#include <limits>
+
+using namespace geom2;
+
+namespace labeling
+{
+    /*
+     * Correct values from 1 to +inf
+     * Max cells count per indexed rectangle. Limits grid memory for
+     * sparse scenes
+     */
+    static const size_t MAX_CELLS_PER_ITEM = 4;
+
+    bool labels_grid::cells_range::operator==(const cells_range &other) const
+    {
+        return col_min == other.col_min && row_min == other.row_min &&
+                col_max == other.col_max && row_max == other.row_max;
+    }
+
+    labels_grid::labels_grid()
+        :
+          cell_size{1, 1},
+          cols(0),
+          rows(0)
+    {}
+
+    void labels_grid::build(const std::vector<rectangle_i> &rects)
+    {
+        // Cells are emptied but keep their memory for the next build
+        for(cell_t &cell: cells)
+        {
+            cell.clear();
+        }
+        cols = 0;
+        rows = 0;
+        if(rects.empty())
+        {
+            return;
+        }
+
+        point_i min_point(std::numeric_limits<int>::max(),
+                          std::numeric_limits<int>::max());
+        point_i max_point(std::numeric_limits<int>::min(),
+                          std::numeric_limits<int>::min());
+        long long w_summ = 0;
+        long long h_summ = 0;
+        for(const rectangle_i &rect: rects)
+        {
+            min_point.x = std::min(min_point.x, rect.left_bottom.x);
+            min_point.y = std::min(min_point.y, rect.left_bottom.y);
+            max_point.x = std::max(max_point.x, rect.right_up().x);
+            max_point.y = std::max(max_point.y, rect.right_up().y);
+            w_summ += rect.sz.w;
+            h_summ += rect.sz.h;
+        }
+
+        origin = min_point;
+        cell_size.w = std::max(1, static_cast<int>(w_summ / rects.size()));
+        cell_size.h = std::max(1, static_cast<int>(h_summ / rects.size()));
+        size_t max_cells = MAX_CELLS_PER_ITEM * rects.size();
+        while(true)
+        {
+            cols = (max_point.x - min_point.x) / cell_size.w + 1;
+            rows = (max_point.y - min_point.y) / cell_size.h + 1;
+            if(static_cast<size_t>(cols) * rows <= max_cells)
+            {
+                break;
+            }
+            cell_size.w *= 2;
+            cell_size.h *= 2;
+        }
+
+        cells.resize(cols * rows);
+        for(size_t idx = 0; idx < rects.size(); ++idx)
+        {
+            insert(idx, get_range(rects[idx]));
+        }
+    }
+
+    void labels_grid::update(size_t idx,
+                             const rectangle_i &old_rect,
+                             const rectangle_i &new_rect)
+    {
+        cells_range old_range = get_range(old_rect);
+        cells_range new_range = get_range(new_rect);
+        if(old_range == new_range)
+        {
+            return;
+        }
+        remove(idx, old_range);
+        insert(idx, new_range);
+    }
+
+    size_t labels_grid::get_memory_usage() const
+    {
+        size_t memory = cells.capacity() * sizeof(cell_t);
+        for(const cell_t &cell: cells)
+        {
+            memory += cell.capacity() * sizeof(cell_item);
+        }
+        return memory;
+    }
+
+    int labels_grid::get_col(int x) const
+    {
+        int col = (x - origin.x) / cell_size.w;
+        return std::min(std::max(col, 0), cols - 1);
+    }
+
+    int labels_grid::get_row(int y) const
+    {
+        int row = (y - origin.y) / cell_size.h;
+        return std::min(std::max(row, 0), rows - 1);
+    }
+
+    labels_grid::cells_range labels_grid::get_range(
+            const rectangle_i &rect) const
+    {
+        point_i right_up = rect.right_up();
+        return cells_range{get_col(rect.left_bottom.x),
+                           get_row(rect.left_bottom.y),
+                           get_col(right_up.x),
+                           get_row(right_up.y)};
+    }
+
+    void labels_grid::insert(size_t idx, const cells_range &range)
+    {
+        for(int row = range.row_min; row <= range.row_max; ++row)
+        {
+            for(int col = range.col_min; col <= range.col_max; ++col)
+            {
+                cells[row * cols + col].push_back(
+                            cell_item{idx, range.col_min, range.row_min});
+            }
+        }
+    }
+
+    void labels_grid::remove(size_t idx, const cells_range &range)
+    {
+        for(int row = range.row_min; row <= range.row_max; ++row)
+        {
+            for(int col = range.col_min; col <= range.col_max; ++col)
+            {
+                cell_t &cell = cells[row * cols + col];
+                for(size_t i = 0; i < cell.size(); ++i)
+                {
+                    if(cell[i].idx == idx)
+                    {
+                        cell[i] = cell.back();
+                        cell.pop_back();
+                        break;
+                    }
+                }
+            }
+        }
+    }
+} // namespace labeling
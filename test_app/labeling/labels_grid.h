@@ -0,0 +1,106 @@
+#ifndef LABELS_GRID_H
+#define LABELS_GRID_H
+#include <vector>
+#include "geometry.h"
+
+namespace labeling
+{
+    /*
+     * Uniform grid over label rectangles
+     *
+     * Used by optimizers to find labels that might intersect a rectangle
+     * without checking every registered label. Items are identified by
+     * index and every item is stored in each cell its rectangle touches.
+     * Rectangle borders are inclusive so touching rectangles are always
+     * reported
+     *
+     * Cell size is the average size of indexed rectangles. Rectangles that
+     * leave the initial grid bounds are clamped to the border cells, so
+     * the grid stays correct(but slower) until the next build
+     */
+    class labels_grid
+    {
+    public:
+        labels_grid();
+
+        /*
+         * Rebuilds grid. Item idx gets rectangle rects[idx]
+         */
+        void build(const std::vector<geom2::rectangle_i> &rects);
+
+        /*
+         * Moves item idx from old_rect to new_rect
+         */
+        void update(size_t idx,
+                    const geom2::rectangle_i &old_rect,
+                    const geom2::rectangle_i &new_rect);
+
+        /*
+         * Calls f(idx) exactly once for every item that might intersect
+         * rect. Does not change the grid so it is safe to call it from
+         * several threads at once
+         */
+        template<class F>
+        void for_each(const geom2::rectangle_i &rect, F f) const;
+
+        /*
+         * @return bytes allocated by the grid
+         */
+        size_t get_memory_usage() const;
+    private:
+        struct cells_range
+        {
+            int col_min;
+            int row_min;
+            int col_max;
+            int row_max;
+            bool operator==(const cells_range &other) const;
+        };
+        struct cell_item
+        {
+            size_t idx;
+            // first cell of the item rectangle. Used to report an item
+            // only once when rectangle covers several cells
+            int col_min;
+            int row_min;
+        };
+        typedef std::vector<cell_item> cell_t;
+    private:
+        cells_range get_range(const geom2::rectangle_i &rect) const;
+        int get_col(int x) const;
+        int get_row(int y) const;
+        void insert(size_t idx, const cells_range &range);
+        void remove(size_t idx, const cells_range &range);
+    private:
+        geom2::point_i origin;
+        geom2::size_i cell_size;
+        int cols;
+        int rows;
+        std::vector<cell_t> cells;
+    };
+
+    template<class F>
+    void labels_grid::for_each(const geom2::rectangle_i &rect, F f) const
+    {
+        if(!cols)
+        {
+            return;
+        }
+        cells_range range = get_range(rect);
+        for(int row = range.row_min; row <= range.row_max; ++row)
+        {
+            for(int col = range.col_min; col <= range.col_max; ++col)
+            {
+                for(const cell_item &item: cells[row * cols + col])
+                {
+                    if(std::max(item.col_min, range.col_min) == col &&
+                            std::max(item.row_min, range.row_min) == row)
+                    {
+                        f(item.idx);
+                    }
+                }
+            }
+        }
+    }
+} // namespace labeling
+#endif // LABELS_GRID_H
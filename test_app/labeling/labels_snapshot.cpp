@@ -0,0 +1,97 @@
+#include "labels_snapshot.h"
+
+using namespace geom2;
+
+namespace labeling
+{
+    void labels_snapshot::capture(
+            const std::vector<screen_point_feature*> &points, size_t count)
+    {
+        pivot_x.resize(count);
+        pivot_y.resize(count);
+        w.resize(count);
+        h.resize(count);
+        offset_x.resize(count);
+        offset_y.resize(count);
+        fixed.resize(count);
+        prefered_begin.resize(count + 1);
+        prefered_weight.clear();
+        prefered_x.clear();
+        prefered_y.clear();
+
+        for(size_t idx = 0; idx < count; ++idx)
+        {
+            const screen_point_feature *point = points[idx];
+            const point_i &pivot = point->get_screen_pivot();
+            const size_i &label_size = point->get_label_size();
+            const point_i &offset = point->get_label_offset();
+            pivot_x[idx] = pivot.x;
+            pivot_y[idx] = pivot.y;
+            w[idx] = label_size.w;
+            h[idx] = label_size.h;
+            offset_x[idx] = offset.x;
+            offset_y[idx] = offset.y;
+            fixed[idx] = point->is_label_fixed();
+
+            prefered_begin[idx] = prefered_weight.size();
+            const screen_point_feature::prefered_pos_list &prefered =
+                    point->get_prefered_positions();
+            if(prefered.empty())
+            {
+                prefered_weight.push_back(1.0);
+                prefered_x.push_back(0);
+                prefered_y.push_back(0);
+                continue;
+            }
+            for(const screen_point_feature::prefered_position &pos: prefered)
+            {
+                prefered_weight.push_back(pos.first);
+                prefered_x.push_back(pos.second.x);
+                prefered_y.push_back(pos.second.y);
+            }
+        }
+        prefered_begin[count] = prefered_weight.size();
+    }
+
+    bool labels_snapshot::same_label(size_t idx,
+                                     const labels_snapshot &other,
+                                     size_t other_idx) const
+    {
+        if(pivot_x[idx] != other.pivot_x[other_idx] ||
+                pivot_y[idx] != other.pivot_y[other_idx] ||
+                w[idx] != other.w[other_idx] ||
+                h[idx] != other.h[other_idx] ||
+                fixed[idx] != other.fixed[other_idx])
+        {
+            return false;
+        }
+        size_t count = prefered_begin[idx + 1] - prefered_begin[idx];
+        size_t other_first = other.prefered_begin[other_idx];
+        if(count != other.prefered_begin[other_idx + 1] - other_first)
+        {
+            return false;
+        }
+        for(size_t k = 0; k < count; ++k)
+        {
+            size_t cur = prefered_begin[idx] + k;
+            size_t oth = other_first + k;
+            if(prefered_weight[cur] != other.prefered_weight[oth] ||
+                    prefered_x[cur] != other.prefered_x[oth] ||
+                    prefered_y[cur] != other.prefered_y[oth])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t labels_snapshot::get_memory_usage() const
+    {
+        return (pivot_x.capacity() + pivot_y.capacity() + w.capacity() +
+                h.capacity() + offset_x.capacity() + offset_y.capacity() +
+                prefered_x.capacity() + prefered_y.capacity()) * sizeof(int) +
+                fixed.capacity() * sizeof(char) +
+                prefered_begin.capacity() * sizeof(size_t) +
+                prefered_weight.capacity() * sizeof(double);
+    }
+} // namespace labeling
@@ -0,0 +1,91 @@
+#ifndef LABELS_SNAPSHOT_H
+#define LABELS_SNAPSHOT_H
+#include <vector>
+#include "screen_point_feature.h"
+
+namespace labeling
+{
+    /*
+     * Structure of arrays copy of labels data
+     *
+     * Optimizers capture it once per best_fit and read labels from it
+     * instead of calling screen_point_feature virtual methods in hot loops.
+     * Buffers are reused between captures
+     */
+    struct labels_snapshot
+    {
+        std::vector<int> pivot_x;
+        std::vector<int> pivot_y;
+        std::vector<int> w;
+        std::vector<int> h;
+        /*
+         * Label offsets at the capture time
+         */
+        std::vector<int> offset_x;
+        std::vector<int> offset_y;
+        std::vector<char> fixed;
+        /*
+         * Prefered positions of label idx are stored in
+         * [prefered_begin[idx], prefered_begin[idx + 1]). Empty lists are
+         * replaced by one item (1.0, {0, 0})
+         */
+        std::vector<size_t> prefered_begin;
+        std::vector<double> prefered_weight;
+        std::vector<int> prefered_x;
+        std::vector<int> prefered_y;
+
+        /*
+         * Captures the first count points
+         */
+        void capture(const std::vector<screen_point_feature*> &points,
+                     size_t count);
+
+        size_t size() const;
+        geom2::point_i get_pivot(size_t idx) const;
+        geom2::size_i get_size(size_t idx) const;
+        geom2::point_i get_offset(size_t idx) const;
+        /*
+         * @return prefered position with the biggest priority in the
+         * original list order(the first one)
+         */
+        geom2::point_i get_first_prefered(size_t idx) const;
+        /*
+         * Compares everything but the offsets of label idx and label
+         * other_idx of other snapshot
+         */
+        bool same_label(size_t idx, const labels_snapshot &other,
+                        size_t other_idx) const;
+        /*
+         * @return bytes allocated by the snapshot
+         */
+        size_t get_memory_usage() const;
+    };
+
+    inline size_t labels_snapshot::size() const
+    {
+        return pivot_x.size();
+    }
+
+    inline geom2::point_i labels_snapshot::get_pivot(size_t idx) const
+    {
+        return geom2::point_i(pivot_x[idx], pivot_y[idx]);
+    }
+
+    inline geom2::size_i labels_snapshot::get_size(size_t idx) const
+    {
+        return geom2::size_i{w[idx], h[idx]};
+    }
+
+    inline geom2::point_i labels_snapshot::get_offset(size_t idx) const
+    {
+        return geom2::point_i(offset_x[idx], offset_y[idx]);
+    }
+
+    inline geom2::point_i labels_snapshot::get_first_prefered(
+            size_t idx) const
+    {
+        size_t first = prefered_begin[idx];
+        return geom2::point_i(prefered_x[first], prefered_y[first]);
+    }
+} // namespace labeling
+#endif // LABELS_SNAPSHOT_H
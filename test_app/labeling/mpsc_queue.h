@@ -0,0 +1,166 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace labeling
+{
+    /*
+     * Unbounded multi producer single consumer queue
+     *
+     * Producers append nodes by one atomic exchange and never wait for
+     * each other or for the consumer. While a producer is between the
+     * exchange and linking its node, values from it on are left to the
+     * later pop calls. Dmitry Vyukov's non-intrusive node based queue.
+     * Nodes are taken from a pool of pool_size nodes and given back to
+     * it by pop, so push allocates only while more than pool_size values
+     * are in the queue
+     */
+    template<class T>
+    class mpsc_queue
+    {
+    public:
+        explicit mpsc_queue(size_t pool_size = 256);
+        ~mpsc_queue();
+        mpsc_queue(const mpsc_queue&) = delete;
+        mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+        /*
+         * Might be called from any thread
+         */
+        void push(const T &value);
+        /*
+         * Should be called from one thread at a time
+         *
+         * @return false if there are no values to pop
+         */
+        bool pop(T &value);
+    private:
+        struct node
+        {
+            std::atomic<node*> next;
+            T value;
+            // index in the pool, NO_INDEX for heap nodes
+            uint32_t pool_idx;
+            // index + 1 of the next free pool node, 0 ends the list
+            std::atomic<uint32_t> free_next;
+        };
+        static const uint32_t NO_INDEX = static_cast<uint32_t>(-1);
+        static const uint64_t INDEX_MASK = 0xffffffffULL;
+    private:
+        node* alloc_node();
+        void free_node(node *cur);
+    private:
+        // the last pushed node
+        std::atomic<node*> head;
+        // the node before the first not popped one
+        node *tail;
+        std::unique_ptr<node[]> pool;
+        /*
+         * Free pool nodes stack. Low 32 bits are the top index + 1, high
+         * ones are changed by every push and pop of the stack, so a
+         * producer can't take a node that was taken and given back while
+         * it was reading the top
+         */
+        std::atomic<uint64_t> free_top;
+    };
+
+    template<class T>
+    mpsc_queue<T>::mpsc_queue(size_t pool_size)
+        :
+          pool(new node[pool_size])
+    {
+        for(size_t idx = 0; idx < pool_size; ++idx)
+        {
+            pool[idx].pool_idx = static_cast<uint32_t>(idx);
+            pool[idx].free_next.store(idx + 1 < pool_size ?
+                                          static_cast<uint32_t>(idx + 2) : 0,
+                                      std::memory_order_relaxed);
+        }
+        free_top.store(pool_size ? 1 : 0, std::memory_order_relaxed);
+        node *stub = alloc_node();
+        stub->next.store(nullptr, std::memory_order_relaxed);
+        head.store(stub, std::memory_order_relaxed);
+        tail = stub;
+    }
+
+    template<class T>
+    mpsc_queue<T>::~mpsc_queue()
+    {
+        T value;
+        while(pop(value))
+        {}
+        free_node(tail);
+    }
+
+    template<class T>
+    void mpsc_queue<T>::push(const T &value)
+    {
+        node *new_node = alloc_node();
+        new_node->next.store(nullptr, std::memory_order_relaxed);
+        new_node->value = value;
+        node *prev = head.exchange(new_node, std::memory_order_acq_rel);
+        prev->next.store(new_node, std::memory_order_release);
+    }
+
+    template<class T>
+    bool mpsc_queue<T>::pop(T &value)
+    {
+        node *next = tail->next.load(std::memory_order_acquire);
+        if(next == nullptr)
+        {
+            return false;
+        }
+        value = next->value;
+        // The popped node becomes the stub
+        free_node(tail);
+        tail = next;
+        return true;
+    }
+
+    template<class T>
+    typename mpsc_queue<T>::node* mpsc_queue<T>::alloc_node()
+    {
+        uint64_t top = free_top.load(std::memory_order_acquire);
+        while(top & INDEX_MASK)
+        {
+            node *cur = &pool[(top & INDEX_MASK) - 1];
+            // cur might be taken by another producer meanwhile, then the
+            // exchange fails on the changed stamp
+            uint64_t next = (((top >> 32) + 1) << 32) |
+                    cur->free_next.load(std::memory_order_relaxed);
+            if(free_top.compare_exchange_weak(top, next,
+                                              std::memory_order_acquire,
+                                              std::memory_order_acquire))
+            {
+                return cur;
+            }
+        }
+        node *cur = new node();
+        cur->pool_idx = NO_INDEX;
+        return cur;
+    }
+
+    template<class T>
+    void mpsc_queue<T>::free_node(node *cur)
+    {
+        if(cur->pool_idx == NO_INDEX)
+        {
+            delete cur;
+            return;
+        }
+        uint64_t top = free_top.load(std::memory_order_relaxed);
+        uint64_t new_top;
+        do
+        {
+            cur->free_next.store(static_cast<uint32_t>(top & INDEX_MASK),
+                                 std::memory_order_relaxed);
+            new_top = (((top >> 32) + 1) << 32) | (cur->pool_idx + 1);
+        } while(!free_top.compare_exchange_weak(top, new_top,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+    }
+} // namespace labeling
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,159 @@
+#include "obstacles_tree.h"
+#include <algorithm>
+
+using namespace geom2;
+
+namespace labeling
+{
+    /*
+     * Correct values from 1 to +inf
+     * Max obstacles count in one leaf node
+     */
+    static const size_t MAX_LEAF_SIZE = 4;
+
+    bool obstacles_tree::bounds::intersects(const bounds &other) const
+    {
+        return min_x <= other.max_x && other.min_x <= max_x &&
+                min_y <= other.max_y && other.min_y <= max_y;
+    }
+
+    obstacles_tree::obstacles_tree()
+    {}
+
+    obstacles_tree::bounds obstacles_tree::get_bounds(const item &obstacle)
+    {
+        switch (obstacle.t) {
+        case screen_obstacle::box:
+        {
+            point_i right_up = obstacle.box.right_up();
+            return bounds{obstacle.box.left_bottom.x,
+                          obstacle.box.left_bottom.y,
+                          right_up.x, right_up.y};
+        }
+        case screen_obstacle::segment:
+            break;
+        }
+        const segment_i &seg = obstacle.segment;
+        return bounds{std::min(seg.start.x, seg.end.x),
+                      std::min(seg.start.y, seg.end.y),
+                      std::max(seg.start.x, seg.end.x),
+                      std::max(seg.start.y, seg.end.y)};
+    }
+
+    void obstacles_tree::build(const std::vector<screen_obstacle*> &obstacles)
+    {
+        items.clear();
+        items_bounds.clear();
+        nodes.clear();
+        if(obstacles.empty())
+        {
+            return;
+        }
+
+        std::vector<item> unordered_items;
+        unordered_items.reserve(obstacles.size());
+        for(const screen_obstacle *obstacle_ptr: obstacles)
+        {
+            item obstacle;
+            obstacle.source = unordered_items.size();
+            obstacle.t = obstacle_ptr->get_type();
+            switch (obstacle.t) {
+            case screen_obstacle::box:
+                obstacle.box = *(obstacle_ptr->get_box());
+                break;
+            case screen_obstacle::segment:
+                obstacle.segment = *(obstacle_ptr->get_segment());
+                break;
+            }
+            unordered_items.push_back(obstacle);
+            items_bounds.push_back(get_bounds(obstacle));
+        }
+
+        std::vector<size_t> order(obstacles.size());
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        nodes.reserve(2 * obstacles.size() / MAX_LEAF_SIZE + 1);
+        build_node(order, 0, order.size());
+
+        // Store items in leafs order
+        std::vector<bounds> unordered_bounds;
+        unordered_bounds.swap(items_bounds);
+        items.reserve(order.size());
+        items_bounds.reserve(order.size());
+        for(size_t idx: order)
+        {
+            items.push_back(unordered_items[idx]);
+            items_bounds.push_back(unordered_bounds[idx]);
+        }
+    }
+
+    void obstacles_tree::build_node(std::vector<size_t> &order,
+                                    size_t begin, size_t end)
+    {
+        bounds box = items_bounds[order[begin]];
+        for(size_t i = begin + 1; i < end; ++i)
+        {
+            const bounds &cur = items_bounds[order[i]];
+            box.min_x = std::min(box.min_x, cur.min_x);
+            box.min_y = std::min(box.min_y, cur.min_y);
+            box.max_x = std::max(box.max_x, cur.max_x);
+            box.max_y = std::max(box.max_y, cur.max_y);
+        }
+
+        size_t node_idx = nodes.size();
+        nodes.push_back(node{box, begin, end - begin});
+        if(end - begin <= MAX_LEAF_SIZE)
+        {
+            return;
+        }
+
+        // Split by the median of bounds centers along the longer axis
+        bool split_x = box.max_x - box.min_x >= box.max_y - box.min_y;
+        const std::vector<bounds> &all_bounds = items_bounds;
+        size_t middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin,
+                         order.begin() + middle,
+                         order.begin() + end,
+                         [&all_bounds, split_x](size_t l, size_t r)
+        {
+            const bounds &lb = all_bounds[l];
+            const bounds &rb = all_bounds[r];
+            if(split_x)
+            {
+                return lb.min_x + lb.max_x < rb.min_x + rb.max_x;
+            }
+            return lb.min_y + lb.max_y < rb.min_y + rb.max_y;
+        });
+
+        build_node(order, begin, middle);
+        nodes[node_idx].first = nodes.size();
+        nodes[node_idx].count = 0;
+        build_node(order, middle, end);
+    }
+
+    double obstacles_tree::intersection(const rectangle_i &rect) const
+    {
+        double summ = 0;
+        for_each(rect, [&](const item &obstacle)
+        {
+            switch (obstacle.t) {
+            case screen_obstacle::box:
+                summ += rectangle_intersection(rect, obstacle.box);
+                break;
+            case screen_obstacle::segment:
+                summ += get_sqr_seg_rect_intersection(obstacle.segment, rect);
+                break;
+            }
+        });
+        return summ;
+    }
+
+    size_t obstacles_tree::get_memory_usage() const
+    {
+        return items.capacity() * sizeof(item) +
+                items_bounds.capacity() * sizeof(bounds) +
+                nodes.capacity() * sizeof(node);
+    }
+} // namespace labeling
@@ -0,0 +1,117 @@
+#ifndef OBSTACLES_TREE_H
+#define OBSTACLES_TREE_H
+#include <vector>
+#include "screen_obstacle.h"
+
+namespace labeling
+{
+    /*
+     * Static bounding volume hierarchy over obstacles
+     *
+     * Obstacles are copied into a flat array of box/segment items at build
+     * time, so queries do not call screen_obstacle virtual methods. The tree
+     * is built in bulk and has to be rebuilt when obstacles change
+     */
+    class obstacles_tree
+    {
+    public:
+        /*
+         * Copy of a screen_obstacle. Only the member matching t is valid
+         */
+        struct item
+        {
+            screen_obstacle::type t;
+            geom2::rectangle_i box;
+            geom2::segment_i segment;
+            // index of the obstacle in the list passed to build
+            size_t source;
+        };
+    public:
+        obstacles_tree();
+
+        void build(const std::vector<screen_obstacle*> &obstacles);
+
+        /*
+         * Calls f(item) for every obstacle whose bounds intersect rect.
+         * Bounds are inclusive
+         */
+        template<class F>
+        void for_each(const geom2::rectangle_i &rect, F f) const;
+
+        /*
+         * Summ of rect intersections with obstacles: intersection area
+         * for boxes and squared intersection length for segments
+         */
+        double intersection(const geom2::rectangle_i &rect) const;
+
+        /*
+         * @return bytes allocated by the tree
+         */
+        size_t get_memory_usage() const;
+    private:
+        struct bounds
+        {
+            int min_x;
+            int min_y;
+            int max_x;
+            int max_y;
+            bool intersects(const bounds &other) const;
+        };
+        /*
+         * Nodes are stored in depth-first order. Left child of an inner
+         * node is the next node, right child is nodes[first]. Leaf nodes
+         * contain items[first, first + count)
+         */
+        struct node
+        {
+            bounds box;
+            size_t first;
+            size_t count;
+        };
+    private:
+        static bounds get_bounds(const item &obstacle);
+        void build_node(std::vector<size_t> &order, size_t begin, size_t end);
+    private:
+        std::vector<item> items;
+        std::vector<bounds> items_bounds;
+        std::vector<node> nodes;
+    };
+
+    template<class F>
+    void obstacles_tree::for_each(const geom2::rectangle_i &rect, F f) const
+    {
+        if(nodes.empty())
+        {
+            return;
+        }
+        geom2::point_i right_up = rect.right_up();
+        bounds rect_bounds = {rect.left_bottom.x, rect.left_bottom.y,
+                              right_up.x, right_up.y};
+        // depth of a tree built by halving is at most 64
+        size_t stack[64];
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while(stack_size)
+        {
+            const node &cur = nodes[stack[--stack_size]];
+            if(!cur.box.intersects(rect_bounds))
+            {
+                continue;
+            }
+            if(cur.count)
+            {
+                for(size_t i = cur.first; i < cur.first + cur.count; ++i)
+                {
+                    if(items_bounds[i].intersects(rect_bounds))
+                    {
+                        f(items[i]);
+                    }
+                }
+                continue;
+            }
+            stack[stack_size++] = cur.first;
+            stack[stack_size++] = &cur - nodes.data() + 1;
+        }
+    }
+} // namespace labeling
+#endif // OBSTACLES_TREE_H
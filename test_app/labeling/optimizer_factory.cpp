@@ -0,0 +1,29 @@
+#include "optimizer_factory.h"
+#include "conflict_graph_opt.h"
+#include "ray_intersection_opt.h"
+#include "sim_annealing_opt.h"
+
+namespace labeling
+{
+    base_optimizer* create_optimizer(const std::string &name)
+    {
+        if(name == "sim_annealing")
+        {
+            return new sim_annealing_opt();
+        }
+        if(name == "ray_intersection")
+        {
+            return new ray_intersection_opt();
+        }
+        if(name == "conflict_graph")
+        {
+            return new conflict_graph_opt();
+        }
+        return nullptr;
+    }
+
+    std::vector<std::string> optimizer_names()
+    {
+        return {"sim_annealing", "ray_intersection", "conflict_graph"};
+    }
+} // namespace labeling
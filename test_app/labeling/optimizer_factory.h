@@ -0,0 +1,21 @@
+#ifndef OPTIMIZER_FACTORY_H
+#define OPTIMIZER_FACTORY_H
+#include <string>
+#include <vector>
+#include "base_optimizer.h"
+
+namespace labeling
+{
+    /*
+     * Creates an optimizer by its name, so tools may pick one from the
+     * command line
+     *
+     * @return nullptr if the name is unknown. The caller owns the result
+     */
+    base_optimizer* create_optimizer(const std::string &name);
+    /*
+     * @return names accepted by create_optimizer
+     */
+    std::vector<std::string> optimizer_names();
+} // namespace labeling
+#endif // OPTIMIZER_FACTORY_H
@@ -0,0 +1,38 @@
+#include "optimizer_stats.h"
+
+namespace labeling
+{
+    optimizer_stats::optimizer_stats()
+    {
+        clear();
+    }
+
+    void optimizer_stats::clear()
+    {
+        iterations = 0;
+        accepted_moves = 0;
+        rejected_moves = 0;
+        initial_metric = 0;
+        final_metric = 0;
+        metric_calls = 0;
+        rectangle_intersection_calls = 0;
+        seg_rect_intersection_calls = 0;
+        obstacles_queries = 0;
+        init_time = 0;
+        optimization_time = 0;
+        apply_time = 0;
+        unplaced_labels = 0;
+        scratch_memory = 0;
+    }
+
+    void optimizer_stats::add_counters(const optimizer_stats &other)
+    {
+        iterations += other.iterations;
+        accepted_moves += other.accepted_moves;
+        rejected_moves += other.rejected_moves;
+        metric_calls += other.metric_calls;
+        rectangle_intersection_calls += other.rectangle_intersection_calls;
+        seg_rect_intersection_calls += other.seg_rect_intersection_calls;
+        obstacles_queries += other.obstacles_queries;
+    }
+} // namespace labeling
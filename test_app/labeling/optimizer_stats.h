@@ -0,0 +1,69 @@
+#ifndef OPTIMIZER_STATS_H
+#define OPTIMIZER_STATS_H
+#include <stddef.h>
+
+namespace labeling
+{
+    /*
+     * Statistics of the last best_fit call
+     *
+     * Optimizers only increment thread local counters and read the clock
+     * between phases, so the statistics are collected in release builds
+     * too
+     */
+    struct optimizer_stats
+    {
+        /*
+         * Optimization steps. Annealing iterations for sim_annealing_opt,
+         * label placements for ray_intersection_opt, greedy picks and
+         * local search visits for conflict_graph_opt
+         */
+        long long iterations;
+        long long accepted_moves;
+        long long rejected_moves;
+        /*
+         * Total metric before and after the optimization. Lower is
+         * better. sim_annealing_opt and conflict_graph_opt report their
+         * energy, ray_intersection_opt the number of not placed labels
+         */
+        double initial_metric;
+        double final_metric;
+
+        /*
+         * Kernels calls. Metric calls are calc_metric calls for
+         * sim_annealing_opt, tried placements for ray_intersection_opt
+         * and scored candidates for conflict_graph_opt
+         */
+        long long metric_calls;
+        long long rectangle_intersection_calls;
+        long long seg_rect_intersection_calls;
+        long long obstacles_queries;
+
+        /*
+         * Time of best_fit phases in milliseconds
+         */
+        double init_time;
+        double optimization_time;
+        double apply_time;
+
+        /*
+         * Labels that still intersect other labels or obstacles
+         * (sim_annealing_opt, conflict_graph_opt) or have no available
+         * position(ray_intersection_opt)
+         */
+        size_t unplaced_labels;
+        /*
+         * Bytes held by the optimizer buffers and indices
+         */
+        size_t scratch_memory;
+
+        optimizer_stats();
+        void clear();
+        /*
+         * Adds iterations, moves and kernels counters of other. Used to
+         * merge counters of workers and replicas
+         */
+        void add_counters(const optimizer_stats &other);
+    };
+} // namespace labeling
+#endif // OPTIMIZER_STATS_H
@@ -2,21 +2,90 @@
 #define POSITIONS_OPTIMIZER
 #include "screen_point_feature.h"
 #include "screen_obstacle.h"
+#include "optimizer_stats.h"
+#include <stdint.h>
 
 namespace labeling
 {
+    /*
+     * Handles of labels and obstacles are distinct types, so one can't be
+     * passed instead of the other. A handle of an unregistered item is
+     * never given out again. Value initialized handles are not valid
+     */
+    struct label_handle
+    {
+        uint64_t value;
+    };
+    struct obstacle_handle
+    {
+        uint64_t value;
+    };
+
     class positions_optimizer
     {
     public:
         virtual ~positions_optimizer() {}
 
-        virtual void register_label(screen_point_feature *) = 0;
+        /*
+         * Registration returns a handle that stays valid until the
+         * label is unregistered. Calls with handles that are not valid
+         * do nothing. Unregistration by handle or by pointer takes O(1)
+         */
+        virtual label_handle register_label(screen_point_feature *) = 0;
         virtual void unregister_label(screen_point_feature *) = 0;
+        virtual void unregister_label(label_handle) = 0;
 
-        virtual void register_obstacle(screen_obstacle *) = 0;
+        /*
+         * Registers count labels at once. If handles is not nullptr it
+         * receives count handles of the labels
+         */
+        virtual void register_labels(screen_point_feature *const *points,
+                                     size_t count,
+                                     label_handle *handles) = 0;
+        virtual void unregister_labels(const label_handle *handles,
+                                       size_t count) = 0;
+
+        virtual obstacle_handle register_obstacle(screen_obstacle *) = 0;
         virtual void unregister_obstacle(screen_obstacle *) = 0;
+        virtual void unregister_obstacle(obstacle_handle) = 0;
 
         virtual void best_fit(float time_max) = 0;
+
+        /*
+         * Incremental best_fit optimizes only labels near labels and
+         * obstacles that changed since the previous call. Other labels
+         * are treated as fixed
+         */
+        virtual void set_incremental(bool incremental) = 0;
+
+        /*
+         * Labels with pivots outside of the viewport are hidden. Hidden
+         * labels are not optimized and don't affect other labels. There
+         * is no viewport by default
+         */
+        virtual void set_viewport(const geom2::rectangle_i &viewport) = 0;
+        virtual void reset_viewport() = 0;
+        /*
+         * If labels don't fit in the budget or cover too much of the
+         * viewport, labels with the smallest priorities are hidden. Ties
+         * are broken by handles. Visible labels get a priority bonus, so
+         * labels don't flicker. Priority is 1 by default
+         */
+        virtual void set_label_priority(label_handle, double priority) = 0;
+        /*
+         * Sets max visible labels count. Unlimited by default
+         */
+        virtual void set_labels_budget(size_t max_count) = 0;
+        /*
+         * @return true if the label was visible in the last best_fit
+         */
+        virtual bool is_label_visible(screen_point_feature *) const = 0;
+        virtual bool is_label_visible(label_handle) const = 0;
+
+        /*
+         * @return statistics of the last best_fit call
+         */
+        virtual const optimizer_stats& get_stats() const = 0;
     };
 } // namespace labeling
 
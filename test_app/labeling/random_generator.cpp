@@ -0,0 +1,85 @@
+#include "random_generator.h"
+
+namespace labeling
+{
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    /*
+     * From
+     * http://prng.di.unimi.it/splitmix64.c
+     * Used to expand a seed to the generator state
+     */
+    static uint64_t splitmix64(uint64_t &x)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    random_generator::random_generator(uint64_t seed_value)
+    {
+        seed(seed_value);
+    }
+
+    void random_generator::seed(uint64_t seed_value)
+    {
+        for(uint64_t &part: s)
+        {
+            part = splitmix64(seed_value);
+        }
+    }
+
+    /*
+     * From
+     * http://prng.di.unimi.it/xoshiro256starstar.c
+     */
+    uint64_t random_generator::next()
+    {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    /*
+     * Lemire's multiply and reject method. Rejects the values that would
+     * make the result biased
+     */
+    uint32_t random_generator::uniform(uint32_t bound)
+    {
+        uint64_t m = (next() >> 32) * bound;
+        uint32_t low = static_cast<uint32_t>(m);
+        if(low < bound)
+        {
+            uint32_t threshold = (0u - bound) % bound;
+            while(low < threshold)
+            {
+                m = (next() >> 32) * bound;
+                low = static_cast<uint32_t>(m);
+            }
+        }
+        return static_cast<uint32_t>(m >> 32);
+    }
+
+    int random_generator::uniform(int min, int max)
+    {
+        uint32_t range = static_cast<uint32_t>(max) -
+                static_cast<uint32_t>(min) + 1;
+        return static_cast<int>(static_cast<uint32_t>(min) + uniform(range));
+    }
+
+    double random_generator::uniform_real()
+    {
+        // 53 high bits to the double mantissa
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+} // namespace labeling
@@ -0,0 +1,38 @@
+#ifndef RANDOM_GENERATOR_H
+#define RANDOM_GENERATOR_H
+#include <stdint.h>
+
+namespace labeling
+{
+    /*
+     * Small fast pseudo random generator(xoshiro256**)
+     *
+     * Unlike rand() it has no global state, so every optimizer(or every
+     * thread) might own one and get reproducible sequences for a seed
+     */
+    class random_generator
+    {
+    public:
+        explicit random_generator(uint64_t seed = 0);
+
+        void seed(uint64_t seed);
+        uint64_t next();
+
+        /*
+         * @return uniformly distributed integer from [0, bound).
+         * bound should be positive
+         */
+        uint32_t uniform(uint32_t bound);
+        /*
+         * @return uniformly distributed integer from [min, max]
+         */
+        int uniform(int min, int max);
+        /*
+         * @return uniformly distributed double from [0, 1)
+         */
+        double uniform_real();
+    private:
+        uint64_t s[4];
+    };
+} // namespace labeling
+#endif // RANDOM_GENERATOR_H
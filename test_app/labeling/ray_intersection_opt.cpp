@@ -2,12 +2,9 @@
 #include <chrono>
 #include <limits>
 #include <deque>
+#include <algorithm>
 #define _USE_MATH_DEFINES
 #include <math.h>
-#ifdef _DEBUG
-#include <QtDebug>
-#include <assert.h>
-#endif
 
 using namespace geom2;
 using std::chrono::high_resolution_clock;
@@ -23,17 +20,39 @@ namespace labeling
     static const int RAYS_COUNT = 8;
     static const int RAYS_LENGTH = 14;
     static const int SQR_MAX_DIST_FROM_BEST = 100*100;
+    static const size_t NO_LABEL = static_cast<size_t>(-1);
+
+    /*
+     * Checks rectangles intersection including borders
+     */
+    static bool rectangles_touch(const rectangle_i &l, const rectangle_i &r)
+    {
+        return l.left_bottom.x <= r.left_bottom.x + r.sz.w &&
+                r.left_bottom.x <= l.left_bottom.x + l.sz.w &&
+                l.left_bottom.y <= r.left_bottom.y + r.sz.h &&
+                r.left_bottom.y <= l.left_bottom.y + l.sz.h;
+    }
 } // namespace labeling
 
 namespace labeling
 {
     ray_intersection_opt::ray_intersection_opt()
+        :
+          used_rays(0)
     {}
 
     ray_intersection_opt::~ray_intersection_opt()
     {}
 
-    point_i ray_intersection_opt::rays_to_best_pos(size_t idx, const rays_list_t &rays)
+    base_optimizer* ray_intersection_opt::create_component_optimizer(
+            size_t /*task_idx*/)
+    {
+        return new ray_intersection_opt();
+    }
+
+    point_i ray_intersection_opt::rays_to_best_pos(
+            size_t idx,
+            const rays_range &rays) const
     {
         point_i where_min;
         int min_sqr_distance = std::numeric_limits<int>::max();
@@ -42,8 +61,8 @@ namespace labeling
             point_i closest;
             int distance =
                     point_seg_sqr_distance(
-                        points_list[idx]->get_prefered_positions()[0].second +
-                    points_list[idx]->get_screen_pivot(), ray, &closest);
+                        labels.get_first_prefered(idx) +
+                    labels.get_pivot(idx), ray, &closest);
             if(distance < min_sqr_distance)
             {
                 min_sqr_distance = distance;
@@ -54,127 +73,395 @@ namespace labeling
         return where_min;
     }
 
+    double ray_intersection_opt::get_available_space(const rays_range &rays)
+    {
+        double available_space = 0;
+        for(const ray_t &ray: rays)
+        {
+            // TODO change to integral e^(-dist)
+            available_space += points_distance(ray.start, ray.end);
+        }
+        return available_space;
+    }
+
+    ray_intersection_opt::rays_range ray_intersection_opt::to_range(
+            const rays_list_t &rays)
+    {
+        return rays_range{rays.data(), rays.data() + rays.size()};
+    }
+
+    ray_intersection_opt::rays_range ray_intersection_opt::get_rays(
+            size_t idx) const
+    {
+        const ray_t *first = rays.data() + rays_first[idx];
+        return rays_range{first, first + rays_count[idx]};
+    }
+
+    void ray_intersection_opt::store_rays(size_t idx,
+                                          const ray_t *first,
+                                          size_t count)
+    {
+        size_t old_count = rays_count[idx];
+        if(count <= old_count)
+        {
+            std::copy(first, first + count, rays.begin() + rays_first[idx]);
+            rays_count[idx] = count;
+            used_rays -= old_count - count;
+            return;
+        }
+
+        // Old place of the label rays becomes unused. Compaction takes
+        // time proportional to labels count, so it is done only when
+        // more than labels count rays are unused
+        rays_count[idx] = 0;
+        used_rays -= old_count;
+        if(rays.size() - used_rays > used_rays + rays_count.size())
+        {
+            compact_rays();
+        }
+        rays_first[idx] = rays.size();
+        rays.insert(rays.end(), first, first + count);
+        rays_count[idx] = count;
+        used_rays += count;
+    }
+
+    void ray_intersection_opt::compact_rays()
+    {
+        rays_back.clear();
+        for(size_t idx = 0; idx < rays_count.size(); ++idx)
+        {
+            auto label_first = rays.begin() + rays_first[idx];
+            rays_first[idx] = rays_back.size();
+            rays_back.insert(rays_back.end(), label_first,
+                             label_first + rays_count[idx]);
+        }
+        rays.swap(rays_back);
+    }
+
+    void ray_intersection_opt::collect_affected(
+            worker_scratch &scratch,
+            size_t moved_idx,
+            const state_t &state,
+            const rectangle_i &old_rect,
+            const rectangle_i &new_rect) const
+    {
+        std::vector<size_t> &affected = scratch.affected;
+        std::vector<bool> &is_affected = scratch.is_affected;
+        is_affected.resize(placed.size(), false);
+        if(moved_idx < placed.size() && !placed[moved_idx])
+        {
+            is_affected[moved_idx] = true;
+            affected.push_back(moved_idx);
+        }
+        auto add_affected = [&](size_t idx)
+        {
+            if(placed[idx] || is_affected[idx])
+            {
+                return;
+            }
+            rectangle_i reach_rect = get_reach_rect(idx, state[idx]);
+            if(rectangles_touch(reach_rect, old_rect) ||
+                    rectangles_touch(reach_rect, new_rect))
+            {
+                is_affected[idx] = true;
+                affected.push_back(idx);
+            }
+        };
+        reach_grid.for_each(old_rect, add_affected);
+        reach_grid.for_each(new_rect, add_affected);
+    }
+
+    void ray_intersection_opt::clear_affected(worker_scratch &scratch)
+    {
+        for(size_t idx: scratch.affected)
+        {
+            scratch.is_affected[idx] = false;
+        }
+        scratch.affected.clear();
+    }
+
+    double ray_intersection_opt::try_placement(const state_t &state,
+                                               const placement &moved,
+                                               worker_scratch &scratch) const
+    {
+        rectangle_i new_rect = {moved.offset + labels.get_pivot(moved.idx),
+                                labels.get_size(moved.idx)};
+        collect_affected(scratch, moved.idx, state,
+                         get_label_rect(state, moved.idx), new_rect);
+
+        // Only affected labels rays should be clipped again. The others
+        // keep their cached available space
+        scratch.stats.metric_calls += 1;
+        double min_available_space = std::numeric_limits<double>::max();
+        for(size_t idx: scratch.affected)
+        {
+            available_positions(state, idx, moved, scratch);
+            double available_space = get_available_space(
+                        to_range(scratch.rays));
+            min_available_space = std::min(min_available_space,
+                                           available_space);
+        }
+        for(size_t idx: by_space)
+        {
+            if(!scratch.is_affected[idx])
+            {
+                min_available_space = std::min(min_available_space,
+                                               points_space[idx]);
+                break;
+            }
+        }
+
+        clear_affected(scratch);
+        return min_available_space;
+    }
+
     void ray_intersection_opt::find_best_ray(
-            const std::vector<rays_list_t> &points_rays,
-            size_t in_process_count,
+            const state_t &state,
             size_t &idx_max_min,
             point_i &best_pos)
     {
-        double max_min_available_space = -1;
-        for(size_t idx = 0; idx < points_rays.size(); ++idx)
+        candidates.clear();
+        for(size_t idx = 0; idx < rays_count.size(); ++idx)
         {
-            const rays_list_t &rays = points_rays[idx];
-            point_i old_offset = points_list[idx]->get_label_offset();
-            point_i where_min = rays_to_best_pos(idx, rays);
-            points_list[idx]->set_label_offset(
-                        where_min - points_list[idx]->get_screen_pivot());
-
-            std::vector<rays_list_t> new_points_rays =
-                    get_points_rays(in_process_count);
-
-            double min_available_space = std::numeric_limits<double>::max();
-            for(const rays_list_t &rays: new_points_rays)
+            if(!placed[idx] && rays_count[idx])
             {
-                double available_space = 0;
-                for(const ray_t &ray: rays)
-                {
-                    // TODO change to integral e^(-dist)
-                    available_space += points_distance(ray.start, ray.end);
-                }
-                if(available_space < min_available_space)
-                {
-                    min_available_space = available_space;
-                }
+                candidates.push_back(idx);
             }
+        }
+        candidates_space.resize(candidates.size());
+        candidates_pos.resize(candidates.size());
+
+        // Placements are tried on the shared read-only state, so
+        // candidates might be evaluated in parallel
+        get_pool().run(candidates.size(), [&](size_t task_idx, size_t worker_idx)
+        {
+            size_t idx = candidates[task_idx];
+            point_i where_min = rays_to_best_pos(idx, get_rays(idx));
+            placement moved = {idx, clamp_offset(
+                                   idx, where_min - labels.get_pivot(idx))};
+            candidates_space[task_idx] =
+                    try_placement(state, moved, scratches[worker_idx]);
+            candidates_pos[task_idx] = moved.offset + labels.get_pivot(idx);
+        });
 
-            if(min_available_space > max_min_available_space)
+        // Ties are broken by the smallest index
+        double max_min_available_space = -1;
+        for(size_t task_idx = 0; task_idx < candidates.size(); ++task_idx)
+        {
+            if(candidates_space[task_idx] > max_min_available_space)
             {
-                max_min_available_space = min_available_space;
-                idx_max_min = idx;
-                best_pos = where_min;
+                max_min_available_space = candidates_space[task_idx];
+                idx_max_min = candidates[task_idx];
+                best_pos = candidates_pos[task_idx];
             }
-            points_list[idx]->set_label_offset(old_offset);
         }
     }
 
-    std::vector<ray_intersection_opt::rays_list_t>
-        ray_intersection_opt::get_points_rays(size_t points_to_locate)
+    void ray_intersection_opt::sort_by_space()
     {
-        std::vector<rays_list_t> points_rays(points_to_locate);
-        for(size_t idx = 0; idx < points_to_locate; ++idx)
+        by_space.clear();
+        for(size_t idx = 0; idx < placed.size(); ++idx)
         {
-            points_rays[idx] =
-                    available_positions(idx);
+            if(!placed[idx])
+            {
+                by_space.push_back(idx);
+            }
         }
-        return points_rays;
+        const std::vector<double> &space = points_space;
+        std::sort(by_space.begin(), by_space.end(),
+                  [&space](size_t l, size_t r)
+        {
+            return space[l] < space[r] || (space[l] == space[r] && l < r);
+        });
     }
 
-    void ray_intersection_opt::best_fit(float /*time_max*/)
+    void ray_intersection_opt::clip_points_rays(const state_t &state,
+                                                size_t idx,
+                                                worker_scratch &scratch) const
     {
-        auto fixed_begin = move_fixed_to_end();
-        size_t in_process_count = fixed_begin - points_list.begin();
+        placement none = {NO_LABEL, point_i()};
+        available_positions(state, idx, none, scratch);
+        scratch.clipped_labels.push_back(clipped_rays{
+                                             idx,
+                                             scratch.clipped.size(),
+                                             scratch.rays.size()});
+        scratch.clipped.insert(scratch.clipped.end(),
+                               scratch.rays.begin(), scratch.rays.end());
+    }
 
-        while(in_process_count)
+    void ray_intersection_opt::store_clipped()
+    {
+        for(worker_scratch &scratch: scratches)
         {
-            std::vector<rays_list_t> points_rays =
-                    get_points_rays(in_process_count);
-            size_t points_to_locate = in_process_count;
-            for(size_t idx = 0; idx < points_to_locate;)
+            for(const clipped_rays &clipped: scratch.clipped_labels)
             {
-                if (points_rays[idx].empty())
-                {
-                    points_to_locate -= 1;
-                    points_rays[idx] = std::move(points_rays[points_to_locate]);
-                    points_rays.erase(points_rays.end() - 1);
-                    swap(points_list[idx], points_list[points_to_locate]);
-                } else {
-                    idx += 1;
-                }
+                store_rays(clipped.idx, scratch.clipped.data() + clipped.first,
+                           clipped.count);
             }
-            points_rays.resize(points_to_locate);
+            scratch.clipped.clear();
+            scratch.clipped_labels.clear();
+        }
+    }
+
+    void ray_intersection_opt::init_points_rays(const state_t &state)
+    {
+        rays.clear();
+        rays_first.assign(state.size(), 0);
+        rays_count.assign(state.size(), 0);
+        used_rays = 0;
+        points_space.resize(state.size());
+        placed.assign(state.size(), false);
+        scratches.resize(get_pool().get_threads_count());
+        for(worker_scratch &scratch: scratches)
+        {
+            scratch.stats.clear();
+        }
 
-            if(points_rays.empty())
+        reach_rects.resize(state.size());
+        get_pool().run(state.size(), [&](size_t idx, size_t worker_idx)
+        {
+            worker_scratch &scratch = scratches[worker_idx];
+            clip_points_rays(state, idx, scratch);
+            points_space[idx] = get_available_space(to_range(scratch.rays));
+            reach_rects[idx] = get_reach_rect(idx, state[idx]);
+        });
+        store_clipped();
+        reach_grid.build(reach_rects);
+        sort_by_space();
+    }
+
+    void ray_intersection_opt::update_points_rays(const state_t &state,
+                                                  size_t moved_idx,
+                                                  const rectangle_i &old_rect,
+                                                  const rectangle_i &new_rect)
+    {
+        // Rays of placed labels are not used anymore
+        store_rays(moved_idx, nullptr, 0);
+        // Affected list of the first scratch is kept during the loop.
+        // clip_points_rays uses only clipping buffers of scratches
+        worker_scratch &scratch = scratches.front();
+        collect_affected(scratch, moved_idx, state, old_rect, new_rect);
+        const std::vector<size_t> &affected = scratch.affected;
+        get_pool().run(affected.size(), [&](size_t task_idx,
+                                            size_t worker_idx)
+        {
+            size_t idx = affected[task_idx];
+            worker_scratch &worker = scratches[worker_idx];
+            clip_points_rays(state, idx, worker);
+            points_space[idx] = get_available_space(to_range(worker.rays));
+        });
+        store_clipped();
+        clear_affected(scratch);
+        sort_by_space();
+    }
+
+    void ray_intersection_opt::optimize(float /*time_max*/)
+    {
+        auto start = high_resolution_clock::now();
+        stats.clear();
+
+        init_state(work_state);
+        state_t &state = work_state;
+        init_grid(state);
+        init_points_rays(state);
+        size_t in_process_count = state.size();
+        stats.init_time = ms_since(start);
+        stats.initial_metric = static_cast<double>(in_process_count);
+
+        auto optimization_start = high_resolution_clock::now();
+        while(in_process_count)
+        {
+            size_t idx = NO_LABEL;
+            point_i best_pos;
+            find_best_ray(state, idx, best_pos);
+            if(idx == NO_LABEL)
             {
+                // There are no available positions for not placed labels
                 break;
             }
+            stats.iterations += 1;
+            stats.accepted_moves += 1;
+            stats.rejected_moves += candidates.size() - 1;
 
-            size_t idx;
-            point_i best_pos;
-            find_best_ray(points_rays, in_process_count, idx, best_pos);
-
-            point_i new_offset = best_pos - points_list[idx]->get_screen_pivot();
-            points_list[idx]->set_label_offset(new_offset);
+            rectangle_i old_rect = get_label_rect(state, idx);
+            set_state_offset(state, idx,
+                             best_pos - labels.get_pivot(idx));
+            placed[idx] = true;
             in_process_count -= 1;
-            swap(points_list[idx], points_list[in_process_count]);
+            update_points_rays(state, idx,
+                               old_rect, get_label_rect(state, idx));
         }
+        stats.optimization_time = ms_since(optimization_start);
 
+        auto apply_start = high_resolution_clock::now();
+        apply_state(state);
+        stats.apply_time = ms_since(apply_start);
 
+        for(const worker_scratch &scratch: scratches)
+        {
+            stats.add_counters(scratch.stats);
+        }
+        stats.final_metric = static_cast<double>(in_process_count);
+        stats.unplaced_labels = in_process_count;
+        stats.scratch_memory = get_memory_usage() + get_buffers_memory();
+    }
 
-#ifdef _DEBUG
-//        in_process_count - amount of points that is not located
-        qDebug() << "labeled: " <<
-                    1.0 - in_process_count /
-                    (double)(fixed_begin - points_list.begin());
-#endif
-
+    size_t ray_intersection_opt::get_buffers_memory() const
+    {
+        size_t memory = (rays.capacity() + rays_back.capacity()) *
+                sizeof(ray_t) +
+                (rays_first.capacity() + rays_count.capacity()) *
+                sizeof(size_t) +
+                points_space.capacity() * sizeof(double) +
+                placed.capacity() / 8 +
+                by_space.capacity() * sizeof(size_t) +
+                reach_grid.get_memory_usage() +
+                reach_rects.capacity() * sizeof(rectangle_i) +
+                scratches.capacity() * sizeof(worker_scratch) +
+                candidates.capacity() * sizeof(size_t) +
+                candidates_space.capacity() * sizeof(double) +
+                candidates_pos.capacity() * sizeof(point_i) +
+                work_state.capacity() * sizeof(point_i);
+        for(const worker_scratch &scratch: scratches)
+        {
+            memory += scratch.affected.capacity() * sizeof(size_t) +
+                    scratch.is_affected.capacity() / 8 +
+                    scratch.mink_additions.get_memory_usage() +
+                    scratch.mink_mask.capacity() +
+                    scratch.rays_classes.capacity() +
+                    (scratch.rays.capacity() + scratch.rays_back.capacity() +
+                     scratch.clipped.capacity()) * sizeof(ray_t) +
+                    scratch.clipped_labels.capacity() * sizeof(clipped_rays);
+        }
+        return memory;
     }
 
     void ray_intersection_opt::intersect_rays(const rectangle_i & mink_addition,
-                                              rays_list_t &rays)
+                                              const rays_list_t &rays,
+                                              rays_list_t &available,
+                                              rays_classes_t &classes)
     {
-        rays_list_t available;
-
-        for(const ray_t &ray: rays)
+        available.clear();
+        // Most of rays are inside or outside of the Minkowski addition,
+        // only the rest are clipped one by one
+        classes.resize(rays.size());
+        segments_rect_classify(mink_addition, rays.data(), rays.size(),
+                               classes.data());
+        for(size_t k = 0; k < rays.size(); ++k)
         {
-            bool start_in_rect =
-                    point_in_rect(ray.start, mink_addition);
-            bool end_in_rect =
-                    point_in_rect(ray.end, mink_addition);
-            if(start_in_rect && end_in_rect)
+            const ray_t &ray = rays[k];
+            if(classes[k] == seg_inside)
             {
                 // ray of unavailable points
                 continue;
             }
+            if(classes[k] == seg_outside)
+            {
+                available.push_back(ray);
+                continue;
+            }
+            bool start_in_rect =
+                    point_in_rect(ray.start, mink_addition);
             point_i first_intersection;
             point_i second_intersection;
             double t1;
@@ -218,17 +505,16 @@ namespace labeling
                 }
             }
         }
-
-        rays = std::move(available);
     }
 
-    ray_intersection_opt::rays_list_t ray_intersection_opt::init_rays(
-            const screen_point_feature *point) const
+    void ray_intersection_opt::init_rays(size_t point_idx,
+                                         const point_i &offset,
+                                         rays_list_t &rays) const
     {
-        point_i cur_pos = point->get_label_offset() + point->get_screen_pivot();
-        point_i best_pos = point->get_screen_pivot() +
-                point->get_prefered_positions()[0].second;
-        rays_list_t rays;
+        point_i cur_pos = offset + labels.get_pivot(point_idx);
+        point_i best_pos = labels.get_pivot(point_idx) +
+                labels.get_first_prefered(point_idx);
+        rays.clear();
         for(int i = 0; i < RAYS_COUNT; ++i)
         {
             double deg = 2.0 * M_PI * i / RAYS_COUNT;
@@ -240,34 +526,81 @@ namespace labeling
                 rays.push_back(ray_t{cur_pos, end});
             }
         }
-        return rays;
     }
 
-    ray_intersection_opt::rays_list_t ray_intersection_opt::available_positions(
-            size_t point_idx) const
+    rectangle_i ray_intersection_opt::get_reach_rect(
+            size_t point_idx,
+            const point_i &offset) const
     {
+        // Rays are inside the square with RAYS_LENGTH half side around
+        // label position. Label rectangle touches Minkowski addition
+        // of this square and the label size if it can clip any ray
+        point_i cur_pos = offset + labels.get_pivot(point_idx);
+        size_i rays_size{2 * RAYS_LENGTH, 2 * RAYS_LENGTH};
+        return rectangle_i{cur_pos - point_i(RAYS_LENGTH, RAYS_LENGTH),
+                           rays_size + labels.get_size(point_idx)};
+    }
 
-        rays_list_t rays = init_rays(points_list[point_idx]);
+    void ray_intersection_opt::available_positions(
+            const state_t &state,
+            size_t point_idx,
+            const placement &moved,
+            worker_scratch &scratch) const
+    {
+        point_i offset =
+                point_idx == moved.idx ? moved.offset : state[point_idx];
+        rays_list_t &rays = scratch.rays;
+        init_rays(point_idx, offset, rays);
 
-        const size_i &label_size = points_list[point_idx]->get_label_size();
-        for(size_t j = 0; j < points_list.size(); ++j)
+        // Collect Minkowski additions of labels that might clip the rays
+        size_i label_size = labels.get_size(point_idx);
+        rectangles_soa_i &mink_additions = scratch.mink_additions;
+        mink_additions.clear();
+        auto add_mink_addition = [&](const rectangle_i &label_rect2)
         {
-            // remove segments from ray for label positions that
-            // intersects with other labels
-            if(point_idx == j)
+            mink_additions.push_back(rectangle_i{
+                                         label_rect2.left_bottom - label_size,
+                                         label_rect2.sz + label_size});
+        };
+        grid.for_each(get_reach_rect(point_idx, offset), [&](size_t j)
+        {
+            if(point_idx == j || moved.idx == j)
+            {
+                return;
+            }
+            add_mink_addition(get_label_rect(state, j));
+        });
+        if(moved.idx != NO_LABEL && moved.idx != point_idx)
+        {
+            add_mink_addition(rectangle_i{
+                                  moved.offset + labels.get_pivot(moved.idx),
+                                  labels.get_size(moved.idx)});
+        }
+
+        // Only Minkowski additions touching rays bounds might clip them
+        point_i cur_pos = offset + labels.get_pivot(point_idx);
+        rectangle_i rays_bounds = {cur_pos - point_i(RAYS_LENGTH, RAYS_LENGTH),
+                                   size_i{2 * RAYS_LENGTH, 2 * RAYS_LENGTH}};
+        scratch.mink_mask.resize(mink_additions.size());
+        rectangles_touch_mask(rays_bounds, mink_additions,
+                              scratch.mink_mask.data());
+        scratch.stats.rectangle_intersection_calls += mink_additions.size();
+        for(size_t k = 0; k < mink_additions.size() && !rays.empty(); ++k)
+        {
+            if(!scratch.mink_mask[k])
             {
                 continue;
             }
+            // remove segments from ray for label positions that
+            // intersects with other labels
             rectangle_i mink_addition =
-                {points_list[j]->get_screen_pivot() +
-                 points_list[j]->get_label_offset() - label_size,
-                 points_list[j]->get_label_size() + label_size};
-            intersect_rays(mink_addition, rays);
+                {point_i(mink_additions.x[k], mink_additions.y[k]),
+                 size_i{mink_additions.w[k], mink_additions.h[k]}};
+            scratch.stats.seg_rect_intersection_calls += rays.size();
+            intersect_rays(mink_addition, rays, scratch.rays_back,
+                           scratch.rays_classes);
+            rays.swap(scratch.rays_back);
         }
-
-
-        return rays;
     }
 
 } // namespace labeling
-
@@ -3,6 +3,7 @@
 
 #include "positions_optimizer.h"
 #include "base_optimizer.h"
+#include "batch_geometry.h"
 
 namespace labeling
 {
@@ -15,26 +16,163 @@ namespace labeling
     public:
         ray_intersection_opt();
         ~ray_intersection_opt();
-
-        void best_fit(float time_max);
+    protected:
+        void optimize(float time_max);
+        base_optimizer* create_component_optimizer(size_t task_idx);
     private:
         typedef geom2::segment_i ray_t;
         typedef std::vector<ray_t> rays_list_t;
+        // geom2::seg_rect_class of rays
+        typedef std::vector<unsigned char> rays_classes_t;
+        /*
+         * Rays of one label stored in a flat buffer
+         */
+        struct rays_range
+        {
+            const ray_t *first;
+            const ray_t *last;
+
+            const ray_t* begin() const { return first; }
+            const ray_t* end() const { return last; }
+            bool empty() const { return first == last; }
+            size_t size() const { return last - first; }
+        };
+        /*
+         * Label idx placed with offset. Used to try a placement without
+         * changing the state
+         */
+        struct placement
+        {
+            size_t idx;
+            geom2::point_i offset;
+        };
+        /*
+         * Rays of label idx clipped by a worker, count rays
+         * from first in the worker clipped buffer
+         */
+        struct clipped_rays
+        {
+            size_t idx;
+            size_t first;
+            size_t count;
+        };
+        /*
+         * Per worker buffers for labels affected by a placement and
+         * for rays clipping. Rays are clipped from rays to rays_back
+         * and the buffers are swapped after every Minkowski addition
+         */
+        struct worker_scratch
+        {
+            std::vector<size_t> affected;
+            std::vector<bool> is_affected;
+            geom2::rectangles_soa_i mink_additions;
+            std::vector<unsigned char> mink_mask;
+            rays_list_t rays;
+            rays_list_t rays_back;
+            rays_classes_t rays_classes;
+            // rays to store in the rays cache
+            rays_list_t clipped;
+            std::vector<clipped_rays> clipped_labels;
+            // kernels counters of the worker
+            optimizer_stats stats;
+        };
     private:
-        rays_list_t ray_intersection_opt::init_rays(
-                const screen_point_feature *point) const;
-        geom2::point_i rays_to_best_pos(size_t idx, const rays_list_t &rays);
-        std::vector<rays_list_t> get_points_rays(size_t points_to_locate);
-        bool fit_point(state_t &state, size_t point_idx) const;
-        void find_best_ray(
-                    const std::vector<rays_list_t> &points_rays,
-                    size_t in_process_count,
-                    size_t &idx,
-                    geom2::point_i &best_pos);
-        rays_list_t available_positions(size_t point_idx) const;
+        void init_rays(size_t point_idx,
+                       const geom2::point_i &offset,
+                       rays_list_t &rays) const;
+        geom2::point_i rays_to_best_pos(size_t idx,
+                                        const rays_range &rays) const;
+        void init_points_rays(const state_t &state);
+        void update_points_rays(const state_t &state,
+                                size_t moved_idx,
+                                const geom2::rectangle_i &old_rect,
+                                const geom2::rectangle_i &new_rect);
+        /*
+         * Clips rays of not moved label idx into the worker clipped
+         * buffer
+         */
+        void clip_points_rays(const state_t &state, size_t idx,
+                              worker_scratch &scratch) const;
+        /*
+         * Moves rays clipped by workers to the rays cache
+         */
+        void store_clipped();
+        void store_rays(size_t idx, const ray_t *first, size_t count);
+        void compact_rays();
+        rays_range get_rays(size_t idx) const;
+        void sort_by_space();
+        void collect_affected(worker_scratch &scratch,
+                              size_t moved_idx,
+                              const state_t &state,
+                              const geom2::rectangle_i &old_rect,
+                              const geom2::rectangle_i &new_rect) const;
+        static void clear_affected(worker_scratch &scratch);
+        double try_placement(const state_t &state,
+                             const placement &moved,
+                             worker_scratch &scratch) const;
+        void find_best_ray(const state_t &state,
+                           size_t &idx,
+                           geom2::point_i &best_pos);
+        /*
+         * Puts available positions rays of point_idx to scratch.rays
+         */
+        void available_positions(const state_t &state,
+                                 size_t point_idx,
+                                 const placement &moved,
+                                 worker_scratch &scratch) const;
+        geom2::rectangle_i get_reach_rect(size_t point_idx,
+                                          const geom2::point_i &offset) const;
+        /*
+         * @return bytes allocated by rays cache and workers buffers
+         */
+        size_t get_buffers_memory() const;
     private:
         static void intersect_rays(const geom2::rectangle_i & mink_addition,
-                                   rays_list_t &rays);
+                                   const rays_list_t &rays,
+                                   rays_list_t &available,
+                                   rays_classes_t &classes);
+        static double get_available_space(const rays_range &rays);
+        static rays_range to_range(const rays_list_t &rays);
+    private:
+        /*
+         * Rays cache. Contains rays of labels that are not placed yet
+         * clipped by all other labels and their summary length.
+         * Rays of label idx are rays_count[idx] rays from rays_first[idx]
+         * in the flat rays buffer. Rays that do not fit the old place are
+         * appended, the buffer is compacted to rays_back when the most
+         * of it is unused
+         */
+        rays_list_t rays;
+        rays_list_t rays_back;
+        std::vector<size_t> rays_first;
+        std::vector<size_t> rays_count;
+        size_t used_rays;
+        std::vector<double> points_space;
+        std::vector<bool> placed;
+        /*
+         * Not placed labels sorted by available space
+         */
+        std::vector<size_t> by_space;
+        /*
+         * Grid of not placed labels reach rectangles. A label might clip
+         * rays of another label only if its rectangle touches reach
+         * rectangle of the second one
+         */
+        labels_grid reach_grid;
+        std::vector<geom2::rectangle_i> reach_rects;
+        std::vector<worker_scratch> scratches;
+        /*
+         * Labels tried by find_best_ray and results of their placements
+         */
+        std::vector<size_t> candidates;
+        std::vector<double> candidates_space;
+        std::vector<geom2::point_i> candidates_pos;
+        /*
+         * State of the current optimize call. Kept with all buffers
+         * above between calls, so repeated calls on the same labels
+         * allocate nothing
+         */
+        state_t work_state;
     };
 } // namespace labeling
 #endif // RAY_INTERSECTION_OPT_H
@@ -0,0 +1,266 @@
+#include "scene_trace.h"
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define TRACE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace geom2;
+
+namespace labeling
+{
+    static const char TRACE_MAGIC[4] = {'L', 'T', 'R', 'C'};
+    static const uint32_t TRACE_VERSION = 1;
+
+    // Records are read in place, so they should keep 8 bytes alignment
+    static_assert(sizeof(trace_header) % 8 == 0 &&
+                  sizeof(trace_frame_header) % 8 == 0 &&
+                  sizeof(trace_point) % 8 == 0 &&
+                  sizeof(trace_prefered) % 8 == 0 &&
+                  sizeof(trace_obstacle) % 8 == 0,
+                  "trace records sizes should be multiples of 8");
+
+    trace_writer::trace_writer(const std::string &path)
+        :
+          file(fopen(path.c_str(), "wb")),
+          next_id(0)
+    {
+        if(file == nullptr)
+        {
+            return;
+        }
+        trace_header header = trace_header();
+        memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header.version = TRACE_VERSION;
+        fwrite(&header, sizeof(header), 1, file);
+    }
+
+    trace_writer::~trace_writer()
+    {
+        if(file != nullptr)
+        {
+            fclose(file);
+        }
+    }
+
+    bool trace_writer::is_open() const
+    {
+        return file != nullptr;
+    }
+
+    uint64_t trace_writer::get_id(const void *ptr, const ids_map_t &ids)
+    {
+        auto pos = ids.find(ptr);
+        uint64_t id = pos != ids.end() ? pos->second : next_id++;
+        new_ids[ptr] = id;
+        return id;
+    }
+
+    void trace_writer::write_frame(
+            const std::vector<const screen_point_feature*> &points,
+            const std::vector<const screen_obstacle*> &obstacles,
+            float time_max,
+            const rectangle_i *viewport)
+    {
+        if(file == nullptr)
+        {
+            return;
+        }
+
+        points_records.resize(points.size());
+        prefered_records.clear();
+        new_ids.clear();
+        for(size_t idx = 0; idx < points.size(); ++idx)
+        {
+            const screen_point_feature *point = points[idx];
+            const screen_point_feature::prefered_pos_list &prefered =
+                    point->get_prefered_positions();
+            trace_point &record = points_records[idx];
+            record = trace_point();
+            record.id = get_id(point, point_ids);
+            record.version = point->get_version();
+            record.pivot_x = point->get_screen_pivot().x;
+            record.pivot_y = point->get_screen_pivot().y;
+            record.offset_x = point->get_label_offset().x;
+            record.offset_y = point->get_label_offset().y;
+            record.w = point->get_label_size().w;
+            record.h = point->get_label_size().h;
+            record.fixed = point->is_label_fixed();
+            record.prefered_count = static_cast<uint32_t>(prefered.size());
+            for(const screen_point_feature::prefered_position &pos: prefered)
+            {
+                trace_prefered prefered_record = trace_prefered();
+                prefered_record.weight = pos.first;
+                prefered_record.x = pos.second.x;
+                prefered_record.y = pos.second.y;
+                prefered_records.push_back(prefered_record);
+            }
+        }
+        point_ids.swap(new_ids);
+
+        obstacles_records.resize(obstacles.size());
+        new_ids.clear();
+        for(size_t idx = 0; idx < obstacles.size(); ++idx)
+        {
+            const screen_obstacle *obstacle = obstacles[idx];
+            trace_obstacle &record = obstacles_records[idx];
+            record = trace_obstacle();
+            record.id = get_id(obstacle, obstacle_ids);
+            record.version = obstacle->get_version();
+            record.type = obstacle->get_type();
+            if(obstacle->get_type() == screen_obstacle::box)
+            {
+                const rectangle_i &box = *obstacle->get_box();
+                int32_t coords[4] = {box.left_bottom.x, box.left_bottom.y,
+                                     box.sz.w, box.sz.h};
+                memcpy(record.coords, coords, sizeof(coords));
+            } else {
+                const segment_i &seg = *obstacle->get_segment();
+                int32_t coords[4] = {seg.start.x, seg.start.y,
+                                     seg.end.x, seg.end.y};
+                memcpy(record.coords, coords, sizeof(coords));
+            }
+        }
+        obstacle_ids.swap(new_ids);
+
+        trace_frame_header header = trace_frame_header();
+        header.points_count = static_cast<uint32_t>(points_records.size());
+        header.obstacles_count =
+                static_cast<uint32_t>(obstacles_records.size());
+        header.prefered_count = static_cast<uint32_t>(prefered_records.size());
+        header.time_max = time_max;
+        if(viewport != nullptr)
+        {
+            int32_t coords[4] = {viewport->left_bottom.x,
+                                 viewport->left_bottom.y,
+                                 viewport->sz.w, viewport->sz.h};
+            header.has_viewport = 1;
+            memcpy(header.viewport, coords, sizeof(coords));
+        }
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(points_records.data(), sizeof(trace_point),
+               points_records.size(), file);
+        fwrite(prefered_records.data(), sizeof(trace_prefered),
+               prefered_records.size(), file);
+        fwrite(obstacles_records.data(), sizeof(trace_obstacle),
+               obstacles_records.size(), file);
+        fflush(file);
+    }
+
+    trace_reader::trace_reader()
+        :
+          data(nullptr),
+          size(0),
+          pos(0),
+          mapping(nullptr)
+    {}
+
+    trace_reader::~trace_reader()
+    {
+        close();
+    }
+
+    bool trace_reader::open(const std::string &path)
+    {
+        close();
+#ifdef TRACE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            return false;
+        }
+        struct stat file_stat;
+        if(fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+        {
+            size = static_cast<size_t>(file_stat.st_size);
+            mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping == MAP_FAILED)
+            {
+                mapping = nullptr;
+                size = 0;
+            } else {
+                madvise(mapping, size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(mapping);
+            }
+        }
+        ::close(fd);
+#else
+        FILE *file = fopen(path.c_str(), "rb");
+        if(file == nullptr)
+        {
+            return false;
+        }
+        char buffer[1 << 16];
+        size_t count;
+        while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            contents.insert(contents.end(), buffer, buffer + count);
+        }
+        fclose(file);
+        data = contents.data();
+        size = contents.size();
+#endif
+        const trace_header *header =
+                reinterpret_cast<const trace_header*>(data);
+        if(size < sizeof(trace_header) ||
+                memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) ||
+                header->version != TRACE_VERSION)
+        {
+            close();
+            return false;
+        }
+        rewind();
+        return true;
+    }
+
+    void trace_reader::close()
+    {
+#ifdef TRACE_MMAP
+        if(mapping != nullptr)
+        {
+            munmap(mapping, size);
+        }
+#endif
+        mapping = nullptr;
+        contents.clear();
+        data = nullptr;
+        size = 0;
+        pos = 0;
+    }
+
+    void trace_reader::rewind()
+    {
+        pos = sizeof(trace_header);
+    }
+
+    bool trace_reader::next_frame(trace_frame &frame)
+    {
+        if(size - pos < sizeof(trace_frame_header))
+        {
+            return false;
+        }
+        const trace_frame_header *header =
+                reinterpret_cast<const trace_frame_header*>(data + pos);
+        size_t frame_size = sizeof(trace_frame_header) +
+                header->points_count * sizeof(trace_point) +
+                header->prefered_count * sizeof(trace_prefered) +
+                header->obstacles_count * sizeof(trace_obstacle);
+        // The last frame might be cut if the recording was interrupted
+        if(size - pos < frame_size)
+        {
+            return false;
+        }
+        const char *records = data + pos + sizeof(trace_frame_header);
+        frame.header = header;
+        frame.points = reinterpret_cast<const trace_point*>(records);
+        records += header->points_count * sizeof(trace_point);
+        frame.prefered = reinterpret_cast<const trace_prefered*>(records);
+        records += header->prefered_count * sizeof(trace_prefered);
+        frame.obstacles = reinterpret_cast<const trace_obstacle*>(records);
+        pos += frame_size;
+        return true;
+    }
+} // namespace labeling
@@ -0,0 +1,168 @@
+#ifndef SCENE_TRACE_H
+#define SCENE_TRACE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "screen_point_feature.h"
+#include "screen_obstacle.h"
+
+namespace labeling
+{
+    /*
+     * Binary trace of the scenes passed to best_fit
+     *
+     * The file is trace_header followed by frames. A frame is
+     * trace_frame_header, points_count trace_point records,
+     * prefered_count trace_prefered records of all points in order and
+     * obstacles_count trace_obstacle records. Sizes of the records are
+     * multiples of 8 bytes, so a mapped file is read in place. Numbers
+     * are in the byte order of the recording host
+     */
+    struct trace_header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t reserved;
+    };
+
+    struct trace_frame_header
+    {
+        uint32_t points_count;
+        uint32_t obstacles_count;
+        uint32_t prefered_count;
+        float time_max;
+        int32_t has_viewport;
+        // x, y, w, h
+        int32_t viewport[4];
+        uint32_t reserved;
+    };
+
+    /*
+     * Points and obstacles keep their id while they are registered
+     */
+    struct trace_point
+    {
+        uint64_t id;
+        uint64_t version;
+        int32_t pivot_x;
+        int32_t pivot_y;
+        int32_t offset_x;
+        int32_t offset_y;
+        int32_t w;
+        int32_t h;
+        int32_t fixed;
+        uint32_t prefered_count;
+    };
+
+    struct trace_prefered
+    {
+        double weight;
+        int32_t x;
+        int32_t y;
+    };
+
+    struct trace_obstacle
+    {
+        uint64_t id;
+        uint64_t version;
+        int32_t type;
+        // box x, y, w, h or segment start x, y, end x, y
+        int32_t coords[4];
+        uint32_t reserved;
+    };
+
+    /*
+     * Frame records in the trace memory
+     */
+    struct trace_frame
+    {
+        const trace_frame_header *header;
+        const trace_point *points;
+        const trace_prefered *prefered;
+        const trace_obstacle *obstacles;
+    };
+
+    /*
+     * Appends frames to a trace file. Points and obstacles are identified
+     * by their addresses, an address missing in a frame gets a new id
+     * when it appears again
+     */
+    class trace_writer
+    {
+    public:
+        /*
+         * Creates the file. Check is_open before writing
+         */
+        explicit trace_writer(const std::string &path);
+        ~trace_writer();
+
+        bool is_open() const;
+        /*
+         * @param viewport is nullptr if there is no viewport
+         */
+        void write_frame(const std::vector<const screen_point_feature*> &points,
+                         const std::vector<const screen_obstacle*> &obstacles,
+                         float time_max,
+                         const geom2::rectangle_i *viewport);
+    private:
+        typedef std::unordered_map<const void*, uint64_t> ids_map_t;
+        /*
+         * Finds id of ptr in ids of the previous frame and adds it to
+         * new_ids
+         */
+        uint64_t get_id(const void *ptr, const ids_map_t &ids);
+
+        trace_writer(const trace_writer&) = delete;
+        trace_writer& operator=(const trace_writer&) = delete;
+    private:
+        FILE *file;
+        uint64_t next_id;
+        ids_map_t point_ids;
+        ids_map_t obstacle_ids;
+        ids_map_t new_ids;
+        std::vector<trace_point> points_records;
+        std::vector<trace_prefered> prefered_records;
+        std::vector<trace_obstacle> obstacles_records;
+    };
+
+    /*
+     * Reads a trace file mapped to memory(read to memory on systems
+     * without mmap)
+     */
+    class trace_reader
+    {
+    public:
+        trace_reader();
+        ~trace_reader();
+
+        /*
+         * @return false if the file can't be read or is not a trace
+         */
+        bool open(const std::string &path);
+        void close();
+        /*
+         * Reads the next frame. Frame records stay valid until the reader
+         * is closed
+         *
+         * @return false at the end of the trace or of its complete part
+         */
+        bool next_frame(trace_frame &frame);
+        /*
+         * Moves to the first frame
+         */
+        void rewind();
+    private:
+        trace_reader(const trace_reader&) = delete;
+        trace_reader& operator=(const trace_reader&) = delete;
+    private:
+        const char *data;
+        size_t size;
+        size_t pos;
+        // mapped memory or the file contents
+        void *mapping;
+        std::vector<char> contents;
+    };
+} // namespace labeling
+#endif // SCENE_TRACE_H
@@ -1,5 +1,6 @@
 #ifndef SCREEN_OBSTACLE
 #define SCREEN_OBSTACLE
+#include <stdint.h>
 #include "geometry.h"
 
 namespace labeling
@@ -24,6 +25,13 @@ namespace labeling
 
         virtual const geom2::rectangle_i* get_box() const = 0;
         virtual const geom2::segment_i* get_segment() const = 0;
+
+        /*
+         * Version stamp of the obstacle. It should change every time the
+         * geometry changes. 0 means the obstacle is not versioned and
+         * stays the same while it is registered
+         */
+        virtual uint64_t get_version() const { return 0; }
     };
 
 } // namespace labeling
@@ -1,5 +1,6 @@
 #ifndef SCREEN_POINT_FEATURE_H
 #define SCREEN_POINT_FEATURE_H
+#include <stdint.h>
 #include "geometry.h"
 
 namespace labeling
@@ -54,6 +55,15 @@ namespace labeling
          * item == prevered_position(1.0, point_i{0, 0})
          */
         virtual const prefered_pos_list& get_prefered_positions() const = 0;
+
+        /*
+         * Version stamp of the point. It should change every time the
+         * pivot, the label size, fixedness or prefered positions change.
+         * Offsets set by the positions optimizer don't count. 0 means the
+         * point is not versioned and is treated as changed by every
+         * incremental best_fit
+         */
+        virtual uint64_t get_version() const { return 0; }
     };
 } // namespace labeling
 #endif // SCREEN_POINT_FEATURE_H
@@ -1,15 +1,9 @@
 #include "sim_annealing_opt.h"
-#include "utils.h"
 #include <chrono>
 #include <math.h>
 #include <random>
 #include <algorithm>
 #include <limits>
-#ifdef _DEBUG
-#include <QtDebug>
-static double METRIC_CHANGE_SUMM = 0;
-static double FITS_COUNT = 0;
-#endif
 
 
 using namespace geom2;
@@ -21,11 +15,26 @@ typedef std::numeric_limits<double> double_limits;
 
 namespace labeling
 {
+    /*
+     * Correct values from 0 to +inf
+     * Max step of a label move as a part of the label size(geometric mean
+     * of its width and height). Chains start coarse with MAX_STEP and
+     * refine the step down to MIN_STEP as moves stop being accepted
+     */
+    const double MAX_STEP = 0.15;
+    const double MIN_STEP = 0.05;
+    /*
+     * Correct values from 0 to 1
+     * The step grows STEP_CHANGE times if the part of accepted moves is
+     * bigger than TARGET_ACCEPTANCE and shrinks otherwise
+     */
+    const double TARGET_ACCEPTANCE = 0.05;
+    const double STEP_CHANGE = 1.5;
     /*
      * Correct values from 1 to MAX_INT
-     * The bigger the less steps will be generated each iteration
+     * The step is adapted every STEP_ADAPT_INTERVAL iterations
      */
-    const int STATE_CHANGE_FACTOR = 10;
+    const int STEP_ADAPT_INTERVAL = 64;
     /*
      * Correct values from 1 to MAX_INT/max_points_count(to avoid an overflow)
      * Affects max iteration
@@ -36,16 +45,16 @@ namespace labeling
      *
      * MAX_ITERATIONS_FACTOR    optimization
      * 1                        20%
-     * 5                        43%
-     * 10                       61%
-     * 30                       84%
-     * 50                       91%
-     * 70                       92%
-     * 100                      95%
+     * 5                        64%
+     * 10                       83%
+     * 30                       98%
+     * 50                       99%
+     * 70                       100%
+     * 100                      100%
      * 200                      100%
-     * 400                      101%
+     * 400                      100%
      */
-    const int MAX_ITERATIONS_FACTOR = 100;
+    const int MAX_ITERATIONS_FACTOR = 70;
     /*
      * Correct values from 0 to +inf
      * Affect penalty for moving labels
@@ -66,185 +75,746 @@ namespace labeling
      * Affect penalty for label-prefered position weighted distances
      */
     const double PREFERED_POSITIONS_PENALTY = 5;
+    /*
+     * Correct values from 0 to +inf
+     * Parallel tempering temperatures of the hottest and the coldest
+     * replicas. Temperatures of the other replicas are geometric
+     * progression between them
+     */
+    const double TEMPERING_MAX_T = 1000;
+    const double TEMPERING_MIN_T = 1;
+    /*
+     * Correct values from 1 to MAX_INT/max_points_count
+     * Replicas exchange temperatures every
+     * SWAP_INTERVAL_FACTOR * points_count iterations
+     */
+    const int SWAP_INTERVAL_FACTOR = 1;
+    /*
+     * Correct values from 1 to MAX_INT
+     * Replicas check the time limit every TIME_CHECK_INTERVAL iterations
+     */
+    const int TIME_CHECK_INTERVAL = 64;
 } // namespace labeling
 
 namespace labeling
 {
     sim_annealing_opt::sim_annealing_opt()
+        :
+          replicas_count(1),
+          has_seed(false),
+          seed(0),
+          random(std::random_device()()),
+          resumable(false),
+          resumed_valid(false)
     {}
 
     sim_annealing_opt::~sim_annealing_opt()
     {}
 
-    double sim_annealing_opt::get_new_t(int iterations)
+    void sim_annealing_opt::set_replicas_count(size_t count)
+    {
+        replicas_count = std::max<size_t>(count, 1);
+    }
+
+    void sim_annealing_opt::set_seed(uint64_t new_seed)
+    {
+        has_seed = true;
+        seed = new_seed;
+        resumed_valid = false;
+    }
+
+    void sim_annealing_opt::reset_seed()
+    {
+        has_seed = false;
+    }
+
+    base_optimizer* sim_annealing_opt::create_component_optimizer(
+            size_t task_idx)
+    {
+        sim_annealing_opt *optimizer = new sim_annealing_opt();
+        optimizer->set_replicas_count(replicas_count);
+        optimizer->set_seed(has_seed ? seed + task_idx + 1 : random.next());
+        return optimizer;
+    }
+
+    bool sim_annealing_opt::can_decompose() const
+    {
+        return !resumable;
+    }
+
+    void sim_annealing_opt::set_resumable(bool new_resumable)
+    {
+        resumable = new_resumable;
+        resumed_valid = false;
+    }
+
+    double sim_annealing_opt::get_new_t(double iterations)
     {
         return 1.0 / iterations / iterations;
     }
 
-    bool sim_annealing_opt::do_jump(double t, double d_metrics)
+    double sim_annealing_opt::get_replica_t(size_t replica,
+                                            size_t replicas_count)
+    {
+        if(replicas_count < 2)
+        {
+            return TEMPERING_MIN_T;
+        }
+        return TEMPERING_MAX_T * pow(TEMPERING_MIN_T / TEMPERING_MAX_T,
+                                     replica / (replicas_count - 1.0));
+    }
+
+    bool sim_annealing_opt::time_is_over(time_point_t start, float time_max)
     {
-        return rand() < (RAND_MAX * exp(-d_metrics / t));
+        return duration_cast<milliseconds>(
+                    high_resolution_clock::now() - start).count() >= time_max;
+    }
+
+    bool sim_annealing_opt::do_jump(chain_t &chain, double d_metrics)
+    {
+        return chain.random.uniform_real() < exp(-d_metrics / chain.t);
     }
 
     sim_annealing_opt::dstate_t sim_annealing_opt::update_state(
-            const state_t &state)
+            chain_t &chain) const
     {
-        size_t idx = rand() % state.size();
-        const size_i &label_size = points_list[idx]->get_label_size();
-        int w = label_size.w / STATE_CHANGE_FACTOR + 1;
-        int h = label_size.h / STATE_CHANGE_FACTOR + 1;
+        size_t idx = chain.random.uniform(
+                    static_cast<uint32_t>(chain.state.size()));
+        double size = sqrt(static_cast<double>(labels.w[idx]) *
+                           labels.h[idx]);
+        int step = std::max(1, static_cast<int>(size * chain.step));
         int dx, dy;
         do
         {
-            dx = rand() % (2 * w + 1) - w;
-            dy = rand() % (2 * h + 1) - h;
+            dx = chain.random.uniform(-step, step);
+            dy = chain.random.uniform(-step, step);
         } while(!dx && ! dy);
-        point_i d_pos = point_i(dx, dy);
+        const point_i &offset = chain.state[idx];
+        point_i d_pos = clamp_offset(idx, offset + point_i(dx, dy)) - offset;
         return dstate_t(idx, d_pos);
     }
 
-    void sim_annealing_opt::best_fit(float time_max)
+    bool sim_annealing_opt::do_iteration(chain_t &chain) const
+    {
+        if(chain.window_tried == STEP_ADAPT_INTERVAL)
+        {
+            adapt_step(chain);
+        }
+        dstate_t d_state = update_state(chain);
+        chain.iterations += 1;
+        chain.window_tried += 1;
+        chain.stats.iterations += 1;
+
+        size_t i = d_state.first;
+        calc_metric(chain, i, d_state.second);
+        const candidate_t &candidate = chain.candidate;
+        long long old_free_overlap = 0;
+        long long old_fixed_overlap = 0;
+        for(const overlap_t &overlap: chain.overlaps[i])
+        {
+            if(overlap.idx < chain.state.size())
+            {
+                old_free_overlap += overlap.area;
+            } else {
+                old_fixed_overlap += overlap.area;
+            }
+        }
+        // Intersection of two not fixed labels is a part of both labels
+        // metrics
+        double d_metric = candidate.own_metric - chain.own_metrics[i] +
+                LABELS_INTERSECTION_PENALTY * static_cast<double>(
+                    2 * (candidate.free_overlap - old_free_overlap) +
+                    candidate.fixed_overlap - old_fixed_overlap);
+        if(d_metric < 0 || do_jump(chain, d_metric))
+        {
+            move_label(chain, i, chain.state[i] + d_state.second);
+            chain.energy += d_metric;
+            chain.stats.accepted_moves += 1;
+            chain.window_accepted += 1;
+            return true;
+        }
+        chain.stats.rejected_moves += 1;
+        return false;
+    }
+
+    void sim_annealing_opt::adapt_step(chain_t &chain)
+    {
+        if(chain.window_accepted > TARGET_ACCEPTANCE * chain.window_tried)
+        {
+            chain.step = std::min(chain.step * STEP_CHANGE, MAX_STEP);
+        } else {
+            chain.step = std::max(chain.step / STEP_CHANGE, MIN_STEP);
+        }
+        chain.window_tried = 0;
+        chain.window_accepted = 0;
+    }
+
+    void sim_annealing_opt::move_label(chain_t &chain,
+                                       size_t i,
+                                       const point_i &new_offset) const
+    {
+        size_t free_count = chain.state.size();
+        for(const overlap_t &overlap: chain.overlaps[i])
+        {
+            if(overlap.idx < free_count)
+            {
+                chain.metrics[overlap.idx] -= LABELS_INTERSECTION_PENALTY *
+                        static_cast<double>(overlap.area);
+                remove_overlap(chain.overlaps[overlap.idx], i);
+            }
+        }
+
+        rectangle_i new_rect = {new_offset + labels.get_pivot(i),
+                                labels.get_size(i)};
+        overlaps_list_t &overlaps = chain.overlaps[i];
+        fill_overlaps(chain, new_rect, overlaps);
+        for(const overlap_t &overlap: overlaps)
+        {
+            if(overlap.idx < free_count)
+            {
+                chain.metrics[overlap.idx] += LABELS_INTERSECTION_PENALTY *
+                        static_cast<double>(overlap.area);
+                chain.overlaps[overlap.idx].push_back(overlap_t{i,
+                                                                overlap.area});
+            }
+        }
+
+        const candidate_t &candidate = chain.candidate;
+        chain.own_metrics[i] = candidate.own_metric;
+        chain.metrics[i] = candidate.own_metric +
+                LABELS_INTERSECTION_PENALTY * static_cast<double>(
+                    candidate.free_overlap + candidate.fixed_overlap);
+        chain.on_obstacle[i] = candidate.on_obstacle;
+        set_state_offset(chain.state, chain.grid, i, new_offset);
+    }
+
+    void sim_annealing_opt::fill_overlaps(chain_t &chain,
+                                          const rectangle_i &rect,
+                                          overlaps_list_t &list) const
+    {
+        const candidate_t &candidate = chain.candidate;
+        list.clear();
+        for(size_t k = 0; k < candidate.free_idx.size(); ++k)
+        {
+            long long area = rectangle_intersection(
+                        rect, candidate.free_neighbours.get(k));
+            if(area > 0)
+            {
+                list.push_back(overlap_t{candidate.free_idx[k], area});
+            }
+        }
+        for(size_t k = 0; k < candidate.fixed_idx.size(); ++k)
+        {
+            long long area = rectangle_intersection(
+                        rect, candidate.fixed_neighbours.get(k));
+            if(area > 0)
+            {
+                list.push_back(overlap_t{candidate.fixed_idx[k], area});
+            }
+        }
+        chain.stats.rectangle_intersection_calls +=
+                candidate.free_idx.size() + candidate.fixed_idx.size();
+    }
+
+    void sim_annealing_opt::remove_overlap(overlaps_list_t &list, size_t idx)
+    {
+        for(size_t k = 0; k < list.size(); ++k)
+        {
+            if(list[k].idx == idx)
+            {
+                list[k] = list.back();
+                list.pop_back();
+                return;
+            }
+        }
+    }
+
+    void sim_annealing_opt::anneal(chain_t &chain,
+                                   time_point_t start,
+                                   float time_max,
+                                   int max_iterations) const
+    {
+        while(chain.iterations < max_iterations &&
+              chain.t > 0 &&
+              !time_is_over(start, time_max))
+        {
+            do_iteration(chain);
+            chain.t = get_new_t(chain.schedule_offset + chain.iterations);
+        }
+    }
+
+    void sim_annealing_opt::temper(std::vector<chain_t> &chains,
+                                   time_point_t start,
+                                   float time_max,
+                                   int max_iterations)
+    {
+        // ladder[k] is the index of the chain with k-th temperature
+        std::vector<size_t> ladder(chains.size());
+        for(size_t k = 0; k < chains.size(); ++k)
+        {
+            ladder[k] = k;
+            chains[k].t = get_replica_t(k, chains.size());
+        }
+        int swap_interval = SWAP_INTERVAL_FACTOR *
+                static_cast<int>(chains.front().state.size());
+
+        for(size_t round = 0;
+            chains.front().iterations < max_iterations &&
+            !time_is_over(start, time_max);
+            ++round)
+        {
+            int round_end = std::min(chains.front().iterations + swap_interval,
+                                     max_iterations);
+            get_pool().run(chains.size(), [&](size_t k, size_t /*worker_idx*/)
+            {
+                chain_t &chain = chains[k];
+                while(chain.iterations < round_end)
+                {
+                    if(chain.iterations % TIME_CHECK_INTERVAL == 0 &&
+                            time_is_over(start, time_max))
+                    {
+                        break;
+                    }
+                    do_iteration(chain);
+                }
+            });
+
+            // Try to exchange neighbour temperatures. Even and odd pairs
+            // are tried in turns
+            for(size_t k = round % 2; k + 1 < ladder.size(); k += 2)
+            {
+                chain_t &hot = chains[ladder[k]];
+                chain_t &cold = chains[ladder[k + 1]];
+                double d = (cold.energy - hot.energy) *
+                        (1.0 / cold.t - 1.0 / hot.t);
+                if(d >= 0 || random.uniform_real() < exp(d))
+                {
+                    std::swap(hot.t, cold.t);
+                    std::swap(ladder[k], ladder[k + 1]);
+                }
+            }
+            // All replicas should have the same iterations count
+            // before the next round
+            for(chain_t &chain: chains)
+            {
+                chain.iterations = round_end;
+            }
+        }
+    }
+
+    void sim_annealing_opt::init_chain(chain_t &chain)
+    {
+        init_grid(chain.state, chain.grid);
+        init_metric(chain);
+        chain.t = 1;
+        chain.iterations = 0;
+        chain.schedule_offset = 0;
+        chain.step = MAX_STEP;
+        chain.window_tried = 0;
+        chain.window_accepted = 0;
+        if(has_seed)
+        {
+            random.seed(seed);
+        }
+        chain.random.seed(random.next());
+    }
+
+    void sim_annealing_opt::optimize(float time_max)
     {
         auto start = high_resolution_clock::now();
+        stats.clear();
 
-        state_t state = init_state();
-        if(!state.size())
+        if(resumable && replicas_count < 2)
+        {
+            resume(start, time_max, 0, MAX_ITERATIONS_FACTOR);
+            return;
+        }
+        resumed_valid = false;
+
+        chain_t chain;
+        chain.state = init_state();
+        if(!chain.state.size())
         {
             return;
         }
-        std::vector<double> metrics = init_metric(state);
+        update_obstacles();
+        init_chain(chain);
+        stats.init_time = ms_since(start);
+        stats.initial_metric = chain.energy;
+        stats.add_counters(chain.stats);
+        chain.stats.clear();
 
-#ifdef _DEBUG
-        double metric_change = 0;
-#endif
-        double t = 1;
-        int iterations = 0;
+        auto optimization_start = high_resolution_clock::now();
         int max_iterations =
-                MAX_ITERATIONS_FACTOR * static_cast<int>(state.size());
-        int64_t current_time;
-        do
+                MAX_ITERATIONS_FACTOR * static_cast<int>(chain.state.size());
+        const chain_t *best = &chain;
+        std::vector<chain_t> chains;
+        if(replicas_count < 2)
         {
-            dstate_t d_state = update_state(state);
-
-            // This is not accurate d_metric calculation. But it works too
-            // Accurate calculation is "calc_metric(,, d_state.second) -
-            // calc_metric(,,zero_offset)"
-            double d_metric =
-                    calc_metric(state, d_state.first, d_state.second) -
-                    metrics[d_state.first];
-            if(d_metric < 0 || do_jump(t, d_metric))
-            {
-#ifdef _DEBUG
-                metric_change += d_metric;
-#endif
-                metrics[d_state.first] += d_metric;
-                state[d_state.first] += d_state.second;
-            }
-            iterations += 1;
-            t = get_new_t(iterations);
-            current_time =
-                    (duration_cast<milliseconds>(
-                         high_resolution_clock::now() - start)).count();
-        } while(t > 0 &&
-                current_time < time_max &&
-                iterations < max_iterations);
-
-
-        apply_state(state);
-#ifdef _DEBUG
-        METRIC_CHANGE_SUMM += metric_change;
-        FITS_COUNT += 1;
-        qDebug() << metric_change << " metric_change";
-        qDebug() << iterations << " iterations";
-        qDebug() << METRIC_CHANGE_SUMM / FITS_COUNT << " average change";
-#endif
-    }
-
-    std::vector<double> sim_annealing_opt::init_metric(const state_t &state)
-    {
-        std::vector<double> metrics(state.size());
-        point_i zero_offset;
-        for(size_t i = 0; i < state.size(); ++i)
+            anneal(chain, start, time_max, max_iterations);
+            stats.add_counters(chain.stats);
+        } else {
+            chains.resize(replicas_count, chain);
+            for(chain_t &replica: chains)
+            {
+                replica.random.seed(random.next());
+            }
+            temper(chains, start, time_max, max_iterations);
+            for(const chain_t &replica: chains)
+            {
+                stats.add_counters(replica.stats);
+                if(replica.energy < best->energy)
+                {
+                    best = &replica;
+                }
+            }
+        }
+        stats.optimization_time = ms_since(optimization_start);
+
+        auto apply_start = high_resolution_clock::now();
+        apply_state(best->state);
+        stats.apply_time = ms_since(apply_start);
+
+        finish_stats(*best);
+        stats.scratch_memory += get_chain_memory(chain);
+        for(const chain_t &replica: chains)
         {
-            metrics[i] = calc_metric(state, i, zero_offset);
+            stats.scratch_memory += get_chain_memory(replica);
         }
-        return metrics;
     }
 
-    double sim_annealing_opt::calc_metric(const state_t &state,
-                                         size_t i,
-                                         const point_i &offset_change) const
+    void sim_annealing_opt::step(int max_iterations)
     {
-        double summ = 0;
+        stats.clear();
+        resume(high_resolution_clock::now(),
+               std::numeric_limits<float>::infinity(), max_iterations, 0);
+    }
 
-        const screen_point_feature *point = points_list[i];
-        point_i new_offset = state[i] + offset_change;
+    void sim_annealing_opt::resume(time_point_t start,
+                                   float time_max,
+                                   int extra_iterations,
+                                   int per_label_iterations)
+    {
+        chain_t &chain = resumed_chain;
+        chain.stats.clear();
+        if(!sync_chain())
+        {
+            return;
+        }
+        stats.init_time = ms_since(start);
+        stats.initial_metric = chain.energy;
 
-        summ += OFFSET_FACTOR * sqr_points_distance(
-                    new_offset, point->get_label_offset());
+        auto optimization_start = high_resolution_clock::now();
+        int max_iterations = chain.iterations + extra_iterations +
+                per_label_iterations * static_cast<int>(chain.state.size());
+        anneal(chain, start, time_max, max_iterations);
+        stats.optimization_time = ms_since(optimization_start);
 
-        summ += PREFERED_POSITIONS_PENALTY * point_to_points_metric(
-                    new_offset, point->get_prefered_positions());
+        auto apply_start = high_resolution_clock::now();
+        apply_state(chain.state);
+        prev_points.assign(points_list.begin(),
+                           points_list.begin() + labels.size());
+        prev_labels = labels;
+        stats.apply_time = ms_since(apply_start);
 
-        rectangle_i label_rect =
-            {new_offset + point->get_screen_pivot(),
-             point->get_label_size()};
-        double labels_intersection = 0;
-        for(size_t j = 0; j < state.size(); ++j)
+        stats.add_counters(chain.stats);
+        finish_stats(chain);
+        stats.scratch_memory += get_chain_memory(chain) +
+                prev_labels.get_memory_usage() +
+                prev_points.capacity() * sizeof(screen_point_feature*) +
+                (prev_of.capacity() + new_of.capacity()) * sizeof(size_t) +
+                (dirty.capacity() + on_obstacle.capacity()) * sizeof(char) +
+                own_metrics.capacity() * sizeof(double) +
+                get_overlaps_memory(prev_overlaps);
+    }
+
+    void sim_annealing_opt::finish_stats(const chain_t &best)
+    {
+        stats.final_metric = best.energy;
+        stats.unplaced_labels = 0;
+        for(size_t i = 0; i < best.state.size(); ++i)
         {
-            if(i == j)
+            if(!best.overlaps[i].empty() || best.on_obstacle[i])
+            {
+                ++stats.unplaced_labels;
+            }
+        }
+        stats.scratch_memory = get_memory_usage();
+    }
+
+    size_t sim_annealing_opt::get_chain_memory(const chain_t &chain)
+    {
+        return chain.state.capacity() * sizeof(point_i) +
+                chain.grid.get_memory_usage() +
+                (chain.metrics.capacity() + chain.own_metrics.capacity()) *
+                sizeof(double) +
+                chain.on_obstacle.capacity() * sizeof(char) +
+                get_overlaps_memory(chain.overlaps) +
+                chain.candidate.free_neighbours.get_memory_usage() +
+                chain.candidate.fixed_neighbours.get_memory_usage() +
+                (chain.candidate.free_idx.capacity() +
+                 chain.candidate.fixed_idx.capacity()) * sizeof(size_t);
+    }
+
+    size_t sim_annealing_opt::get_overlaps_memory(
+            const std::vector<overlaps_list_t> &lists)
+    {
+        size_t result = lists.capacity() * sizeof(overlaps_list_t);
+        for(const overlaps_list_t &list: lists)
+        {
+            result += list.capacity() * sizeof(overlap_t);
+        }
+        return result;
+    }
+
+    bool sim_annealing_opt::sync_chain()
+    {
+        chain_t &chain = resumed_chain;
+        bool rebuild_all = obstacles_changed;
+        state_t state = init_state();
+        if(!state.size())
+        {
+            resumed_valid = false;
+            return false;
+        }
+        update_obstacles();
+        if(!resumed_valid || rebuild_all)
+        {
+            int iterations = chain.iterations;
+            double t = chain.t;
+            chain.state.swap(state);
+            init_grid(chain.state, chain.grid);
+            init_metric(chain);
+            if(resumed_valid)
+            {
+                chain.iterations = iterations;
+                chain.t = t;
+            } else {
+                init_chain(chain);
+                resumed_valid = true;
+            }
+            return true;
+        }
+
+        // Match labels with the previous call ones. Labels that changed
+        // anything but the offset, moved from outside or are new are dirty
+        size_t count = labels.size();
+        size_t free_count = state.size();
+        size_t prev_free_count = chain.state.size();
+        prev_idx.clear();
+        for(size_t k = 0; k < prev_points.size(); ++k)
+        {
+            prev_idx[prev_points[k]] = k;
+        }
+        new_of.assign(prev_points.size(), handles_table::NO_INDEX);
+        prev_of.assign(count, handles_table::NO_INDEX);
+        dirty.assign(count, 1);
+        own_metrics.resize(free_count);
+        on_obstacle.resize(free_count);
+        for(size_t idx = 0; idx < count; ++idx)
+        {
+            auto it = prev_idx.find(points_list[idx]);
+            if(it == prev_idx.end())
             {
                 continue;
             }
-            rectangle_i label_rect2 =
-                {state[j] + points_list[j]->get_screen_pivot(),
-                 points_list[j]->get_label_size()};
-            labels_intersection +=
-                    rectangle_intersection(label_rect, label_rect2);
+            size_t prev = it->second;
+            new_of[prev] = idx;
+            point_i prev_offset = prev < prev_free_count ?
+                        chain.state[prev] : prev_labels.get_offset(prev);
+            if(!labels.same_label(idx, prev_labels, prev) ||
+                    labels.offset_x[idx] != prev_offset.x ||
+                    labels.offset_y[idx] != prev_offset.y)
+            {
+                continue;
+            }
+            dirty[idx] = 0;
+            prev_of[idx] = prev;
+            if(idx < free_count)
+            {
+                // Moving penalty is counted from the current offset now,
+                // like in a new best_fit
+                own_metrics[idx] = chain.own_metrics[prev] -
+                        OFFSET_FACTOR * sqr_points_distance(
+                            prev_offset, prev_labels.get_offset(prev));
+                on_obstacle[idx] = chain.on_obstacle[prev];
+            }
         }
-        for(size_t j = state.size(); j < points_list.size(); ++j)
+
+        chain.state.swap(state);
+        init_grid(chain.state, chain.grid);
+        chain.own_metrics.swap(own_metrics);
+        chain.on_obstacle.swap(on_obstacle);
+        prev_overlaps.swap(chain.overlaps);
+        chain.overlaps.resize(free_count);
+        chain.metrics.resize(free_count);
+
+        // Clean labels keep their intersections with clean labels
+        for(size_t idx = 0; idx < free_count; ++idx)
         {
-            rectangle_i label_rect2 = to_label_rect(points_list[j]);
-            labels_intersection += rectangle_intersection(label_rect, label_rect2);
+            overlaps_list_t &list = chain.overlaps[idx];
+            list.clear();
+            if(dirty[idx])
+            {
+                continue;
+            }
+            for(const overlap_t &overlap: prev_overlaps[prev_of[idx]])
+            {
+                size_t other = new_of[overlap.idx];
+                if(other != handles_table::NO_INDEX && !dirty[other])
+                {
+                    list.push_back(overlap_t{other, overlap.area});
+                }
+            }
+        }
+        // Dirty labels find their intersections again and add them to
+        // the clean labels lists
+        point_i zero_offset;
+        for(size_t idx = 0; idx < count; ++idx)
+        {
+            if(!dirty[idx])
+            {
+                continue;
+            }
+            rectangle_i rect = get_label_rect(chain.state, idx);
+            // Fixed labels have no own metric, they only add overlaps
+            if(idx < free_count)
+            {
+                calc_metric(chain, idx, zero_offset);
+                chain.own_metrics[idx] = chain.candidate.own_metric;
+                chain.on_obstacle[idx] = chain.candidate.on_obstacle;
+            }
+            chain.grid.for_each(rect, [&](size_t j)
+            {
+                if(j == idx || j >= free_count || dirty[j])
+                {
+                    return;
+                }
+                long long area = rectangle_intersection(
+                            rect, get_label_rect(chain.state, j));
+                if(area > 0)
+                {
+                    chain.overlaps[j].push_back(overlap_t{idx, area});
+                }
+            });
+            if(idx < free_count)
+            {
+                fill_overlaps(chain, rect, chain.overlaps[idx]);
+            }
         }
-        summ += LABELS_INTERSECTION_PENALTY * labels_intersection;
 
-        double obstacles_intersection = 0;
-        for(screen_obstacle *obstacle_ptr: obstacles_list)
+        chain.energy = 0;
+        for(size_t idx = 0; idx < free_count; ++idx)
         {
-            switch (obstacle_ptr->get_type()) {
-            case screen_obstacle::box:
-                obstacles_intersection +=
-                        rectangle_intersection(label_rect,
-                                               *(obstacle_ptr->get_box()));
-                break;
-            case screen_obstacle::segment:
-                obstacles_intersection +=
-                        get_sqr_seg_rect_intersection(
-                            *(obstacle_ptr->get_segment()),
-                            label_rect);
-                break;
+            long long overlap_summ = 0;
+            for(const overlap_t &overlap: chain.overlaps[idx])
+            {
+                overlap_summ += overlap.area;
             }
+            chain.metrics[idx] = chain.own_metrics[idx] +
+                    LABELS_INTERSECTION_PENALTY *
+                    static_cast<double>(overlap_summ);
+            chain.energy += chain.metrics[idx];
         }
-        summ += OBSTACLES_INTERSECTION_PENALTY * obstacles_intersection;
 
-        return summ;
+        // The counter is rebased when it gets close to an overflow, the
+        // offset keeps the temperature going on from where it was
+        if(chain.iterations > std::numeric_limits<int>::max() / 2)
+        {
+            chain.schedule_offset += chain.iterations;
+            chain.iterations = 0;
+        }
+        return true;
     }
 
-    double sim_annealing_opt::point_to_points_metric(
-            const point_i &point,
-            const screen_point_feature::prefered_pos_list &points)
+    void sim_annealing_opt::init_metric(chain_t &chain) const
     {
-        if(points.size() == 0)
+        size_t count = chain.state.size();
+        chain.metrics.resize(count);
+        chain.own_metrics.resize(count);
+        chain.overlaps.resize(count);
+        chain.on_obstacle.resize(count);
+        chain.energy = 0;
+        point_i zero_offset;
+        for(size_t i = 0; i < count; ++i)
         {
-            return sqr_points_distance(point, point_i());
+            chain.metrics[i] = calc_metric(chain, i, zero_offset);
+            chain.own_metrics[i] = chain.candidate.own_metric;
+            chain.on_obstacle[i] = chain.candidate.on_obstacle;
+            fill_overlaps(chain, get_label_rect(chain.state, i),
+                          chain.overlaps[i]);
+            chain.energy += chain.metrics[i];
         }
+    }
+
+    double sim_annealing_opt::calc_metric(chain_t &chain,
+                                         size_t i,
+                                         const point_i &offset_change) const
+    {
+        const state_t &state = chain.state;
+        candidate_t &candidate = chain.candidate;
+
+        point_i new_offset = state[i] + offset_change;
+
+        double own_metric = OFFSET_FACTOR * sqr_points_distance(
+                    new_offset, labels.get_offset(i));
+
+        own_metric += PREFERED_POSITIONS_PENALTY * point_to_points_metric(
+                    new_offset, i);
+
+        rectangle_i label_rect =
+            {new_offset + labels.get_pivot(i), labels.get_size(i)};
+        double obstacles_intersection = obstacles.intersection(label_rect);
+        own_metric += OBSTACLES_INTERSECTION_PENALTY * obstacles_intersection;
+        candidate.own_metric = own_metric;
+        candidate.on_obstacle = obstacles_intersection > 0;
+
+        // Only labels from grid cells touched by label_rect might intersect
+        // it. Fixed labels are indexed too(after the state ones)
+        candidate.free_neighbours.clear();
+        candidate.fixed_neighbours.clear();
+        candidate.free_idx.clear();
+        candidate.fixed_idx.clear();
+        chain.grid.for_each(label_rect, [&](size_t j)
+        {
+            if(i == j)
+            {
+                return;
+            }
+            if(j < state.size())
+            {
+                candidate.free_neighbours.push_back(get_label_rect(state, j));
+                candidate.free_idx.push_back(j);
+            } else {
+                candidate.fixed_neighbours.push_back(get_label_rect(state, j));
+                candidate.fixed_idx.push_back(j);
+            }
+        });
+        candidate.free_overlap = rectangles_intersection_summ(
+                    label_rect, candidate.free_neighbours);
+        candidate.fixed_overlap = rectangles_intersection_summ(
+                    label_rect, candidate.fixed_neighbours);
+
+        chain.stats.metric_calls += 1;
+        chain.stats.rectangle_intersection_calls +=
+                candidate.free_idx.size() + candidate.fixed_idx.size();
+        chain.stats.obstacles_queries += 1;
+
+        return own_metric + LABELS_INTERSECTION_PENALTY * static_cast<double>(
+                    candidate.free_overlap + candidate.fixed_overlap);
+    }
+
+    double sim_annealing_opt::point_to_points_metric(const point_i &point,
+                                                     size_t idx) const
+    {
         double min_distance = double_limits::max();
-        for(const screen_point_feature::prefered_position &second_point: points)
+        for(size_t k = labels.prefered_begin[idx];
+            k < labels.prefered_begin[idx + 1]; ++k)
         {
             double cur_distance =
-                    second_point.first *
-                    sqr_points_distance(point, second_point.second);
+                    labels.prefered_weight[k] *
+                    sqr_points_distance(point, point_i(labels.prefered_x[k],
+                                                       labels.prefered_y[k]));
             min_distance = min(min_distance, cur_distance);
         }
         return min_distance;
@@ -3,6 +3,10 @@
 
 #include "positions_optimizer.h"
 #include "base_optimizer.h"
+#include "batch_geometry.h"
+#include "random_generator.h"
+#include <chrono>
+#include <unordered_map>
 
 namespace labeling
 {
@@ -12,22 +16,205 @@ namespace labeling
      */
     class sim_annealing_opt : public base_optimizer
     {
+        // Benchmarks calc_metric
+        friend struct sim_annealing_opt_bench;
     public:
         sim_annealing_opt();
         ~sim_annealing_opt();
-        void best_fit(float time_max);
+
+        /*
+         * Sets the number of replicas. 1 means one annealing chain(default).
+         * Bigger values enable parallel tempering: replicas are run at
+         * different temperatures on the thread pool and periodically
+         * exchange temperatures
+         */
+        void set_replicas_count(size_t count);
+
+        /*
+         * Makes every best_fit call start from the given seed, so the
+         * same scene always gets the same placement. By default the
+         * optimizer is seeded once from std::random_device
+         */
+        void set_seed(uint64_t seed);
+        void reset_seed();
+
+        /*
+         * Resumable mode keeps the annealing chain(state, metrics,
+         * temperature, iterations count and buffers) between calls, so
+         * every call continues the schedule instead of starting from the
+         * top. Only labels that were added, removed or moved since the
+         * previous call get their metrics and intersections recalculated.
+         * Parallel tempering(replicas_count > 1) always starts from scratch
+         */
+        void set_resumable(bool resumable);
+        /*
+         * Runs at most max_iterations iterations of the resumable chain
+         * and applies the result. Lets the caller spread the optimization
+         * over several event loop slices
+         */
+        void step(int max_iterations);
+    protected:
+        void optimize(float time_max);
+        /*
+         * Component optimizers get the replicas count and seeds derived
+         * from the seed of this one
+         */
+        base_optimizer* create_component_optimizer(size_t task_idx);
+        /*
+         * The resumable chain spans all labels, so resumable mode is
+         * never split into components
+         */
+        bool can_decompose() const;
     private:
         typedef std::pair<size_t, geom2::point_i> dstate_t;
+        /*
+         * Intersection area of a label with label idx
+         */
+        struct overlap_t
+        {
+            size_t idx;
+            long long area;
+        };
+        typedef std::vector<overlap_t> overlaps_list_t;
+        /*
+         * Label at a tried position. Filled by calc_metric
+         */
+        struct candidate_t
+        {
+            // metric terms that don't depend on other labels
+            double own_metric;
+            // intersections summ with not fixed and fixed labels
+            long long free_overlap;
+            long long fixed_overlap;
+            bool on_obstacle;
+            // labels that might intersect the candidate
+            geom2::rectangles_soa_i free_neighbours;
+            geom2::rectangles_soa_i fixed_neighbours;
+            std::vector<size_t> free_idx;
+            std::vector<size_t> fixed_idx;
+        };
+        /*
+         * Markov chain of states
+         */
+        struct chain_t
+        {
+            state_t state;
+            labels_grid grid;
+            /*
+             * metrics[i] is own_metrics[i] plus penalty for intersections
+             * listed in overlaps[i]
+             */
+            std::vector<double> metrics;
+            std::vector<double> own_metrics;
+            /*
+             * Sparse overlaps cache. overlaps[i] lists all labels that
+             * intersect label i. Intersections of two not fixed labels
+             * are listed for both of them
+             */
+            std::vector<overlaps_list_t> overlaps;
+            std::vector<char> on_obstacle;
+            // summ of metrics
+            double energy;
+            double t;
+            int iterations;
+            // iterations the schedule went through before the counter was
+            // rebased, the temperature is get_new_t(offset + iterations)
+            double schedule_offset;
+            /*
+             * Max step of update_state as a part of the label size and
+             * moves tried and accepted since the last step adaptation
+             */
+            double step;
+            int window_tried;
+            int window_accepted;
+            random_generator random;
+            // iterations and kernels counters
+            optimizer_stats stats;
+            candidate_t candidate;
+        };
     private:
-        dstate_t update_state(const state_t &state);
-        double calc_metric(const state_t &state, size_t i,
-                           const geom2::point_i &new_offset) const;
-        std::vector<double> init_metric(const state_t &state);
+        dstate_t update_state(chain_t &chain) const;
+        bool do_iteration(chain_t &chain) const;
+        /*
+         * Grows the step while enough moves are accepted and shrinks it
+         * otherwise
+         */
+        static void adapt_step(chain_t &chain);
+        void anneal(chain_t &chain, time_point_t start, float time_max,
+                    int max_iterations) const;
+        void temper(std::vector<chain_t> &chains, time_point_t start,
+                    float time_max, int max_iterations);
+        /*
+         * @return metric of label i moved by offset_change. Fills
+         * chain.candidate
+         */
+        double calc_metric(chain_t &chain, size_t i,
+                           const geom2::point_i &offset_change) const;
+        /*
+         * Fills list with intersections of the candidate at rect
+         */
+        void fill_overlaps(chain_t &chain, const geom2::rectangle_i &rect,
+                           overlaps_list_t &list) const;
+        /*
+         * Moves label i to the candidate position updating metrics of
+         * the labels it intersected before and intersects now
+         */
+        void move_label(chain_t &chain, size_t i,
+                        const geom2::point_i &new_offset) const;
+        void init_metric(chain_t &chain) const;
+        void init_chain(chain_t &chain);
+        /*
+         * Brings the resumable chain up to date with the labels list.
+         * @return false if there is nothing to optimize
+         */
+        bool sync_chain();
+        /*
+         * Syncs the resumable chain and runs at most
+         * extra_iterations + per_label_iterations * labels_count iterations
+         */
+        void resume(time_point_t start, float time_max,
+                    int extra_iterations, int per_label_iterations);
+        /*
+         * Fills metric and unplaced labels of the best chain and memory
+         * used by the optimizer without chains
+         */
+        void finish_stats(const chain_t &best);
+        static size_t get_chain_memory(const chain_t &chain);
+        static size_t get_overlaps_memory(
+                const std::vector<overlaps_list_t> &lists);
+        static void remove_overlap(overlaps_list_t &list, size_t idx);
+        /*
+         * Minimal weighted squared distance from point to label idx
+         * prefered positions
+         */
+        double point_to_points_metric(const geom2::point_i &point,
+                                      size_t idx) const;
     private:
-        static bool do_jump(double t, double d_metrics);
-        static double get_new_t(int iterations);
-        static double point_to_points_metric(const geom2::point_i &point,
-                      const screen_point_feature::prefered_pos_list &points);
+        static bool do_jump(chain_t &chain, double d_metrics);
+        static double get_new_t(double iterations);
+        static double get_replica_t(size_t replica, size_t replicas_count);
+        static bool time_is_over(time_point_t start, float time_max);
+    private:
+        size_t replicas_count;
+        bool has_seed;
+        uint64_t seed;
+        // seeds chains and exchanges replicas temperatures
+        random_generator random;
+
+        bool resumable;
+        bool resumed_valid;
+        chain_t resumed_chain;
+        // labels of the previous resumable call
+        points_list_t prev_points;
+        labels_snapshot prev_labels;
+        // sync_chain buffers
+        std::unordered_map<screen_point_feature*, size_t> prev_idx;
+        std::vector<size_t> prev_of;
+        std::vector<size_t> new_of;
+        std::vector<char> dirty;
+        std::vector<double> own_metrics;
+        std::vector<char> on_obstacle;
+        std::vector<overlaps_list_t> prev_overlaps;
     };
 } // namespace labeling
 #endif // SIM_ANNEALING_OPT_H
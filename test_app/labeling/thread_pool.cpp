@@ -0,0 +1,127 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace labeling
+{
+    /*
+     * Pool and worker running tasks in the current thread. Used to run
+     * nested calls in place
+     */
+    static thread_local const thread_pool *current_pool = nullptr;
+    static thread_local size_t current_worker = 0;
+
+    thread_pool::thread_pool(size_t threads_count)
+        :
+          cur_task(nullptr),
+          cur_tasks_count(0),
+          next_task(0),
+          generation(0),
+          running_workers(0),
+          stopping(false)
+    {
+        if(!threads_count)
+        {
+            threads_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for(size_t worker_idx = 1; worker_idx < threads_count; ++worker_idx)
+        {
+            workers.push_back(std::thread(&thread_pool::worker_loop,
+                                          this, worker_idx));
+        }
+    }
+
+    thread_pool::~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for(std::thread &worker: workers)
+        {
+            worker.join();
+        }
+    }
+
+    size_t thread_pool::get_threads_count() const
+    {
+        return workers.size() + 1;
+    }
+
+    void thread_pool::run_task(size_t tasks_count, const task_t &task)
+    {
+        if(workers.empty() || tasks_count < 2 || current_pool == this)
+        {
+            size_t worker_idx = current_pool == this ? current_worker : 0;
+            for(size_t task_idx = 0; task_idx < tasks_count; ++task_idx)
+            {
+                task(task_idx, worker_idx);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cur_task = &task;
+            cur_tasks_count = tasks_count;
+            next_task = 0;
+            running_workers = workers.size();
+            generation += 1;
+        }
+        start_cv.notify_all();
+
+        run_tasks(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this]() { return running_workers == 0; });
+        cur_task = nullptr;
+    }
+
+    void thread_pool::run_tasks(size_t worker_idx)
+    {
+        const thread_pool *prev_pool = current_pool;
+        size_t prev_worker = current_worker;
+        current_pool = this;
+        current_worker = worker_idx;
+        while(true)
+        {
+            size_t task_idx = next_task.fetch_add(1);
+            if(task_idx >= cur_tasks_count)
+            {
+                break;
+            }
+            (*cur_task)(task_idx, worker_idx);
+        }
+        current_pool = prev_pool;
+        current_worker = prev_worker;
+    }
+
+    void thread_pool::worker_loop(size_t worker_idx)
+    {
+        size_t seen_generation = 0;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&]()
+                {
+                    return stopping || generation != seen_generation;
+                });
+                if(stopping)
+                {
+                    return;
+                }
+                seen_generation = generation;
+            }
+
+            run_tasks(worker_idx);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            running_workers -= 1;
+            if(!running_workers)
+            {
+                done_cv.notify_one();
+            }
+        }
+    }
+} // namespace labeling
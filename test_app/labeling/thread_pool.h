@@ -0,0 +1,67 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace labeling
+{
+    /*
+     * Fixed size pool of worker threads used by optimizers to run
+     * independent tasks in parallel
+     */
+    class thread_pool
+    {
+    public:
+        typedef std::function<void(size_t task_idx, size_t worker_idx)> task_t;
+    public:
+        /*
+         * @param threads_count is the number of threads running tasks
+         * including the calling one. 0 means hardware concurrency
+         */
+        explicit thread_pool(size_t threads_count = 0);
+        ~thread_pool();
+
+        size_t get_threads_count() const;
+
+        /*
+         * Calls task(task_idx, worker_idx) for every task_idx from
+         * 0 to tasks_count - 1 and waits until all calls are finished.
+         * worker_idx is less than get_threads_count(), calls with the same
+         * worker_idx never run at the same time.
+         * Nested calls from tasks are run in the calling thread with the
+         * calling task worker_idx.
+         * Should not be called from several threads at once.
+         * The task is passed to workers by reference, so run allocates
+         * nothing for any task size
+         */
+        template<class F>
+        void run(size_t tasks_count, const F &task);
+    private:
+        void run_task(size_t tasks_count, const task_t &task);
+        void worker_loop(size_t worker_idx);
+        void run_tasks(size_t worker_idx);
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable start_cv;
+        std::condition_variable done_cv;
+        const task_t *cur_task;
+        size_t cur_tasks_count;
+        std::atomic<size_t> next_task;
+        size_t generation;
+        size_t running_workers;
+        bool stopping;
+    };
+
+    template<class F>
+    void thread_pool::run(size_t tasks_count, const F &task)
+    {
+        // std::function keeps reference wrappers without heap allocation
+        run_task(tasks_count, task_t(std::cref(task)));
+    }
+} // namespace labeling
+#endif // THREAD_POOL_H
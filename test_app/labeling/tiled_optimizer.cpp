@@ -0,0 +1,746 @@
+#include "tiled_optimizer.h"
+#include "optimizer_factory.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace geom2;
+using std::chrono::high_resolution_clock;
+using std::chrono::duration;
+
+namespace labeling
+{
+    /*
+     * Correct values from 2 to +inf
+     * The halo shrinks only if it is HALO_SHRINK_FACTOR times wider
+     * than required
+     */
+    static const int HALO_SHRINK_FACTOR = 4;
+    static const uint64_t HASH_SEED = 14695981039346656037ULL;
+    static const uint64_t HASH_PRIME = 1099511628211ULL;
+
+    /*
+     * Label seen by a tile optimizer. Own labels of the tile keep their
+     * fixedness, halo labels are fixed. Offsets are copied, so tiles
+     * never write to labels while other tiles read them
+     */
+    struct tile_point : public screen_point_feature
+    {
+        screen_point_feature *source;
+        point_i offset;
+        bool fixed;
+
+        const point_i& get_screen_pivot() const
+        {
+            return source->get_screen_pivot();
+        }
+        const size_i& get_label_size() const
+        {
+            return source->get_label_size();
+        }
+        const point_i& get_label_offset() const { return offset; }
+        void set_label_offset(const point_i &new_offset)
+        {
+            offset = new_offset;
+        }
+        bool is_label_fixed() const { return fixed; }
+        const prefered_pos_list& get_prefered_positions() const
+        {
+            return source->get_prefered_positions();
+        }
+        uint64_t get_version() const { return source->get_version(); }
+    };
+
+    /*
+     * Optimizer and buffers of a pool worker. Tile labels are registered
+     * before and unregistered after every tile
+     */
+    struct tiled_optimizer::worker_state
+    {
+        std::unique_ptr<base_optimizer> optimizer;
+        std::vector<tile_point> proxies;
+        std::vector<screen_point_feature*> points;
+        std::vector<label_handle> handles;
+        std::vector<obstacle_handle> obstacles_handles;
+    };
+
+    /*
+     * FNV-1a over 64 bit words
+     */
+    class signature_hash
+    {
+    public:
+        signature_hash() : value(HASH_SEED) {}
+
+        void add(int64_t word)
+        {
+            value = (value ^ static_cast<uint64_t>(word)) * HASH_PRIME;
+        }
+        void add(double word)
+        {
+            int64_t bits;
+            memcpy(&bits, &word, sizeof(bits));
+            add(bits);
+        }
+        void add(const point_i &p)
+        {
+            add(static_cast<int64_t>(p.x));
+            add(static_cast<int64_t>(p.y));
+        }
+        void add(const size_i &sz)
+        {
+            add(static_cast<int64_t>(sz.w));
+            add(static_cast<int64_t>(sz.h));
+        }
+        uint64_t get() const { return value; }
+    private:
+        uint64_t value;
+    };
+
+    static double ms_since(high_resolution_clock::time_point start)
+    {
+        return duration<double, std::milli>(high_resolution_clock::now() -
+                                            start).count();
+    }
+
+    tiled_optimizer::tiled_optimizer(const std::string &optimizer_name,
+                                     int tile_size,
+                                     size_t threads_count)
+        :
+          optimizer_name(optimizer_name),
+          tile_size(std::max(tile_size, 1)),
+          pool(threads_count),
+          optimized_tiles_count(0),
+          halo_width(0),
+          incremental(false)
+    {
+        workers.resize(pool.get_threads_count());
+        for(std::unique_ptr<worker_state> &worker: workers)
+        {
+            worker.reset(new worker_state());
+            worker->optimizer.reset(create_optimizer(optimizer_name));
+            worker->optimizer->set_threads_count(1);
+        }
+    }
+
+    tiled_optimizer::~tiled_optimizer()
+    {
+    }
+
+    label_handle tiled_optimizer::register_label(
+            screen_point_feature *point_ptr)
+    {
+        label_handle handle = {labels_handles.push_back()};
+        labels.push_back(label_entry{point_ptr, 1, true});
+        labels_by_ptr[point_ptr] = handle;
+        return handle;
+    }
+
+    void tiled_optimizer::unregister_label(screen_point_feature *point_ptr)
+    {
+        auto pos = labels_by_ptr.find(point_ptr);
+        if(pos != labels_by_ptr.end())
+        {
+            unregister_label(pos->second);
+        }
+    }
+
+    void tiled_optimizer::unregister_label(label_handle handle)
+    {
+        size_t idx = labels_handles.get_index(handle.value);
+        if(idx != handles_table::NO_INDEX)
+        {
+            remove_label(idx);
+        }
+    }
+
+    void tiled_optimizer::register_labels(screen_point_feature *const *points,
+                                          size_t count,
+                                          label_handle *handles)
+    {
+        for(size_t k = 0; k < count; ++k)
+        {
+            label_handle handle = register_label(points[k]);
+            if(handles != nullptr)
+            {
+                handles[k] = handle;
+            }
+        }
+    }
+
+    void tiled_optimizer::unregister_labels(const label_handle *handles,
+                                            size_t count)
+    {
+        for(size_t k = 0; k < count; ++k)
+        {
+            unregister_label(handles[k]);
+        }
+    }
+
+    obstacle_handle tiled_optimizer::register_obstacle(
+            screen_obstacle *obstacle_ptr)
+    {
+        obstacle_handle handle = {obstacles_handles.push_back()};
+        obstacles.push_back(obstacle_ptr);
+        obstacles_by_ptr[obstacle_ptr] = handle;
+        return handle;
+    }
+
+    void tiled_optimizer::unregister_obstacle(screen_obstacle *obstacle_ptr)
+    {
+        auto pos = obstacles_by_ptr.find(obstacle_ptr);
+        if(pos != obstacles_by_ptr.end())
+        {
+            unregister_obstacle(pos->second);
+        }
+    }
+
+    void tiled_optimizer::unregister_obstacle(obstacle_handle handle)
+    {
+        size_t idx = obstacles_handles.get_index(handle.value);
+        if(idx != handles_table::NO_INDEX)
+        {
+            remove_obstacle(idx);
+        }
+    }
+
+    void tiled_optimizer::best_fit(float time_max)
+    {
+        auto start = high_resolution_clock::now();
+        stats.clear();
+        optimized_tiles_count = 0;
+        select_visible();
+        update_halo_width(find_halo_width());
+        // Tiles closer than stride tiles to each other are in different
+        // phases
+        int stride = 1 + (halo_width + tile_size - 1) / tile_size;
+        assign_tiles(stride);
+        size_t phases_count = static_cast<size_t>(stride * stride);
+        stats.init_time = ms_since(start);
+
+        size_t threads_count = workers.size();
+        for(size_t phase = 0; phase < phases_count; ++phase)
+        {
+            phase_tiles.clear();
+            dirty_tiles.clear();
+            for(auto &item: tiles)
+            {
+                if(get_phase(item.second, stride) == static_cast<int>(phase))
+                {
+                    phase_tiles.push_back(&item.second);
+                }
+            }
+            // The same tiles go to the same tasks on every call
+            std::sort(phase_tiles.begin(), phase_tiles.end(),
+                      [](const tile *l, const tile *r)
+            {
+                return l->row != r->row ? l->row < r->row : l->col < r->col;
+            });
+            for(tile *cur_tile: phase_tiles)
+            {
+                uint64_t signature = get_signature(*cur_tile);
+                if(!incremental || !cur_tile->has_results ||
+                        cur_tile->signature != signature)
+                {
+                    cur_tile->signature = signature;
+                    dirty_tiles.push_back(cur_tile);
+                }
+            }
+
+            // The rest of the time is split between the rest of the
+            // phases and between waves of tiles run one after another
+            size_t waves = (dirty_tiles.size() + threads_count - 1) /
+                    threads_count;
+            double time_left = time_max - ms_since(start);
+            float tile_time = static_cast<float>(
+                        std::max(time_left, 0.0) /
+                        (phases_count - phase) / std::max(waves, size_t(1)));
+            pool.run(dirty_tiles.size(),
+                     [this, tile_time](size_t task_idx, size_t worker_idx)
+            {
+                optimize_tile(*dirty_tiles[task_idx], *workers[worker_idx],
+                              tile_time);
+            });
+
+            auto apply_start = high_resolution_clock::now();
+            for(tile *cur_tile: phase_tiles)
+            {
+                apply_tile(*cur_tile);
+            }
+            stats.apply_time += ms_since(apply_start);
+            for(tile *cur_tile: dirty_tiles)
+            {
+                stats.add_counters(cur_tile->stats);
+                stats.initial_metric += cur_tile->stats.initial_metric;
+                stats.final_metric += cur_tile->stats.final_metric;
+                stats.unplaced_labels += cur_tile->stats.unplaced_labels;
+            }
+            optimized_tiles_count += dirty_tiles.size();
+        }
+
+        for(const std::unique_ptr<worker_state> &worker: workers)
+        {
+            stats.scratch_memory +=
+                    worker->optimizer->get_stats().scratch_memory +
+                    worker->proxies.capacity() * sizeof(tile_point);
+        }
+        stats.scratch_memory += visibility.get_memory_usage();
+        stats.optimization_time = ms_since(start) - stats.init_time -
+                stats.apply_time;
+    }
+
+    void tiled_optimizer::set_incremental(bool new_incremental)
+    {
+        incremental = new_incremental;
+    }
+
+    void tiled_optimizer::set_viewport(const rectangle_i &new_viewport)
+    {
+        visibility.set_viewport(new_viewport);
+    }
+
+    void tiled_optimizer::reset_viewport()
+    {
+        visibility.reset_viewport();
+    }
+
+    void tiled_optimizer::set_label_priority(label_handle handle,
+                                             double priority)
+    {
+        size_t idx = labels_handles.get_index(handle.value);
+        if(idx != handles_table::NO_INDEX)
+        {
+            labels[idx].priority = priority;
+        }
+    }
+
+    void tiled_optimizer::set_labels_budget(size_t max_count)
+    {
+        visibility.set_labels_budget(max_count);
+    }
+
+    bool tiled_optimizer::is_label_visible(
+            screen_point_feature *point_ptr) const
+    {
+        auto pos = labels_by_ptr.find(point_ptr);
+        return pos != labels_by_ptr.end() && is_label_visible(pos->second);
+    }
+
+    bool tiled_optimizer::is_label_visible(label_handle handle) const
+    {
+        size_t idx = labels_handles.get_index(handle.value);
+        return idx != handles_table::NO_INDEX && labels[idx].visible;
+    }
+
+    const optimizer_stats& tiled_optimizer::get_stats() const
+    {
+        return stats;
+    }
+
+    size_t tiled_optimizer::get_tiles_count() const
+    {
+        return tiles.size();
+    }
+
+    size_t tiled_optimizer::get_optimized_tiles_count() const
+    {
+        return optimized_tiles_count;
+    }
+
+    void tiled_optimizer::select_visible()
+    {
+        if(visibility.selects_all())
+        {
+            for(label_entry &entry: labels)
+            {
+                entry.visible = true;
+            }
+            return;
+        }
+        visibility.clear();
+        for(size_t idx = 0; idx < labels.size(); ++idx)
+        {
+            const label_entry &entry = labels[idx];
+            visibility.add(entry.point, entry.priority, entry.visible,
+                           labels_handles.get_handle(idx));
+        }
+        visibility.select();
+        for(size_t idx = 0; idx < labels.size(); ++idx)
+        {
+            labels[idx].visible = visibility.is_visible(idx);
+        }
+    }
+
+    int tiled_optimizer::find_halo_width() const
+    {
+        // Reach of every visible label lies within extent of its pivot.
+        // Optimized labels stay in their reach, so the extent covers the
+        // reach of the next call too and optimizing alone doesn't change
+        // the halo
+        int extent = 0;
+        for(const label_entry &entry: labels)
+        {
+            if(!entry.visible)
+            {
+                continue;
+            }
+            const screen_point_feature *point = entry.point;
+            point_i min_offset = point->get_label_offset();
+            point_i max_offset = min_offset;
+            for(const screen_point_feature::prefered_position &pos:
+                point->get_prefered_positions())
+            {
+                min_offset.x = std::min(min_offset.x, pos.second.x);
+                min_offset.y = std::min(min_offset.y, pos.second.y);
+                max_offset.x = std::max(max_offset.x, pos.second.x);
+                max_offset.y = std::max(max_offset.y, pos.second.y);
+            }
+            const size_i &size = point->get_label_size();
+            rectangle_i reach = get_reach_rect(point_i(0, 0), size,
+                                               min_offset, max_offset);
+            reach = get_reach_rect(point_i(0, 0), size, reach.left_bottom,
+                                   reach.right_up() - point_i(size.w, size.h));
+            point_i right_up = reach.right_up();
+            extent = std::max(extent, std::max(abs(reach.left_bottom.x),
+                                               abs(reach.left_bottom.y)));
+            extent = std::max(extent, std::max(abs(right_up.x),
+                                               abs(right_up.y)));
+        }
+        // Reaches of two labels might intersect if their pivots are
+        // closer than two extents
+        return 2 * extent;
+    }
+
+    void tiled_optimizer::update_halo_width(int required_width)
+    {
+        // The width is a power of two that grows at once and shrinks only
+        // when it is HALO_SHRINK_FACTOR times wider than required, so the
+        // halo and the tiles signatures rarely change
+        if(required_width > halo_width ||
+                required_width * HALO_SHRINK_FACTOR <= halo_width)
+        {
+            halo_width = 1;
+            while(halo_width < required_width && halo_width < (1 << 30))
+            {
+                halo_width *= 2;
+            }
+        }
+    }
+
+    void tiled_optimizer::assign_tiles(int stride)
+    {
+        for(auto &item: tiles)
+        {
+            item.second.labels.clear();
+            item.second.halo.clear();
+            item.second.obstacles.clear();
+        }
+        // Hidden labels keep their offsets and don't affect tiles
+        for(size_t idx = 0; idx < labels.size(); ++idx)
+        {
+            if(!labels[idx].visible)
+            {
+                continue;
+            }
+            const point_i &pivot = labels[idx].point->get_screen_pivot();
+            int col = get_tile_coord(pivot.x);
+            int row = get_tile_coord(pivot.y);
+            auto pos = tiles.find(get_tile_key(col, row));
+            if(pos == tiles.end())
+            {
+                tile new_tile;
+                new_tile.col = col;
+                new_tile.row = row;
+                new_tile.signature = 0;
+                new_tile.has_results = false;
+                pos = tiles.insert(std::make_pair(get_tile_key(col, row),
+                                                  new_tile)).first;
+            }
+            pos->second.labels.push_back(idx);
+        }
+        // Tiles without labels lose their results
+        for(auto it = tiles.begin(); it != tiles.end();)
+        {
+            if(it->second.labels.empty())
+            {
+                it = tiles.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        auto by_label_handle = [this](size_t l, size_t r)
+        {
+            return labels_handles.get_handle(l) <
+                    labels_handles.get_handle(r);
+        };
+        int range = (halo_width + tile_size - 1) / tile_size;
+        for(auto &item: tiles)
+        {
+            tile &cur_tile = item.second;
+            std::sort(cur_tile.labels.begin(), cur_tile.labels.end(),
+                      by_label_handle);
+        }
+        for(auto &item: tiles)
+        {
+            tile &cur_tile = item.second;
+            int phase = get_phase(cur_tile, stride);
+            int min_x = cur_tile.col * tile_size - halo_width;
+            int max_x = (cur_tile.col + 1) * tile_size + halo_width;
+            int min_y = cur_tile.row * tile_size - halo_width;
+            int max_y = (cur_tile.row + 1) * tile_size + halo_width;
+            for(int row = cur_tile.row - range;
+                row <= cur_tile.row + range; ++row)
+            {
+                for(int col = cur_tile.col - range;
+                    col <= cur_tile.col + range; ++col)
+                {
+                    // Tiles of later phases place their labels around
+                    // labels of this one
+                    auto pos = tiles.find(get_tile_key(col, row));
+                    if(pos == tiles.end() ||
+                            get_phase(pos->second, stride) >= phase)
+                    {
+                        continue;
+                    }
+                    for(size_t idx: pos->second.labels)
+                    {
+                        const point_i &pivot =
+                                labels[idx].point->get_screen_pivot();
+                        if(pivot.x >= min_x && pivot.x < max_x &&
+                                pivot.y >= min_y && pivot.y < max_y)
+                        {
+                            cur_tile.halo.push_back(idx);
+                        }
+                    }
+                }
+            }
+            std::sort(cur_tile.halo.begin(), cur_tile.halo.end(),
+                      by_label_handle);
+        }
+
+        for(size_t idx = 0; idx < obstacles.size(); ++idx)
+        {
+            rectangle_i box = to_obstacle_box(obstacles[idx]);
+            int min_x = box.left_bottom.x - halo_width;
+            int max_x = box.left_bottom.x + box.sz.w + halo_width;
+            int min_y = box.left_bottom.y - halo_width;
+            int max_y = box.left_bottom.y + box.sz.h + halo_width;
+            int min_col = get_tile_coord(min_x);
+            int max_col = get_tile_coord(max_x);
+            int min_row = get_tile_coord(min_y);
+            int max_row = get_tile_coord(max_y);
+            double cells = (static_cast<double>(max_col) - min_col + 1) *
+                    (static_cast<double>(max_row) - min_row + 1);
+            if(cells > tiles.size())
+            {
+                // Huge obstacles check every tile instead of every cell
+                for(auto &item: tiles)
+                {
+                    tile &cur_tile = item.second;
+                    if(cur_tile.col >= min_col && cur_tile.col <= max_col &&
+                            cur_tile.row >= min_row &&
+                            cur_tile.row <= max_row)
+                    {
+                        cur_tile.obstacles.push_back(idx);
+                    }
+                }
+                continue;
+            }
+            for(int row = min_row; row <= max_row; ++row)
+            {
+                for(int col = min_col; col <= max_col; ++col)
+                {
+                    auto pos = tiles.find(get_tile_key(col, row));
+                    if(pos != tiles.end())
+                    {
+                        pos->second.obstacles.push_back(idx);
+                    }
+                }
+            }
+        }
+        for(auto &item: tiles)
+        {
+            std::vector<size_t> &tile_obstacles = item.second.obstacles;
+            std::sort(tile_obstacles.begin(), tile_obstacles.end(),
+                      [this](size_t l, size_t r)
+            {
+                return obstacles_handles.get_handle(l) <
+                        obstacles_handles.get_handle(r);
+            });
+        }
+    }
+
+    uint64_t tiled_optimizer::get_signature(const tile &cur_tile) const
+    {
+        // Start offsets of not fixed own labels don't count, kept results
+        // are as good for any of them
+        signature_hash hash;
+        hash.add(static_cast<int64_t>(cur_tile.labels.size()));
+        for(size_t idx: cur_tile.labels)
+        {
+            const label_entry &entry = labels[idx];
+            const screen_point_feature *point = entry.point;
+            hash.add(static_cast<int64_t>(labels_handles.get_handle(idx)));
+            hash.add(point->get_screen_pivot());
+            hash.add(point->get_label_size());
+            hash.add(entry.priority);
+            hash.add(static_cast<int64_t>(point->is_label_fixed()));
+            if(point->is_label_fixed())
+            {
+                hash.add(point->get_label_offset());
+            }
+            const screen_point_feature::prefered_pos_list &prefered =
+                    point->get_prefered_positions();
+            hash.add(static_cast<int64_t>(prefered.size()));
+            for(const screen_point_feature::prefered_position &pos: prefered)
+            {
+                hash.add(pos.first);
+                hash.add(pos.second);
+            }
+        }
+        hash.add(static_cast<int64_t>(cur_tile.halo.size()));
+        for(size_t idx: cur_tile.halo)
+        {
+            const screen_point_feature *point = labels[idx].point;
+            hash.add(static_cast<int64_t>(labels_handles.get_handle(idx)));
+            hash.add(point->get_screen_pivot());
+            hash.add(point->get_label_offset());
+            hash.add(point->get_label_size());
+        }
+        hash.add(static_cast<int64_t>(cur_tile.obstacles.size()));
+        for(size_t idx: cur_tile.obstacles)
+        {
+            const screen_obstacle *obstacle = obstacles[idx];
+            hash.add(static_cast<int64_t>(
+                         obstacles_handles.get_handle(idx)));
+            hash.add(static_cast<int64_t>(obstacle->get_type()));
+            if(obstacle->get_type() == screen_obstacle::box)
+            {
+                hash.add(obstacle->get_box()->left_bottom);
+                hash.add(obstacle->get_box()->sz);
+            } else {
+                hash.add(obstacle->get_segment()->start);
+                hash.add(obstacle->get_segment()->end);
+            }
+        }
+        return hash.get();
+    }
+
+    void tiled_optimizer::optimize_tile(tile &cur_tile, worker_state &worker,
+                                        float time_max)
+    {
+        base_optimizer &optimizer = *worker.optimizer;
+        size_t own_count = cur_tile.labels.size();
+        worker.proxies.resize(own_count + cur_tile.halo.size());
+        size_t count = 0;
+        for(size_t idx: cur_tile.labels)
+        {
+            tile_point &proxy = worker.proxies[count++];
+            proxy.source = labels[idx].point;
+            proxy.offset = proxy.source->get_label_offset();
+            proxy.fixed = proxy.source->is_label_fixed();
+        }
+        for(size_t idx: cur_tile.halo)
+        {
+            tile_point &proxy = worker.proxies[count++];
+            proxy.source = labels[idx].point;
+            proxy.offset = proxy.source->get_label_offset();
+            proxy.fixed = true;
+        }
+        worker.points.resize(count);
+        for(size_t k = 0; k < count; ++k)
+        {
+            worker.points[k] = &worker.proxies[k];
+        }
+        worker.handles.resize(count);
+        optimizer.register_labels(worker.points.data(), count,
+                                  worker.handles.data());
+        for(size_t k = 0; k < own_count; ++k)
+        {
+            optimizer.set_label_priority(
+                        worker.handles[k],
+                        labels[cur_tile.labels[k]].priority);
+        }
+        worker.obstacles_handles.resize(cur_tile.obstacles.size());
+        for(size_t k = 0; k < cur_tile.obstacles.size(); ++k)
+        {
+            worker.obstacles_handles[k] = optimizer.register_obstacle(
+                        obstacles[cur_tile.obstacles[k]]);
+        }
+        // Tile optimizers have no viewport and budget, all the tile
+        // labels are visible
+        optimizer.best_fit(time_max);
+
+        cur_tile.offsets.resize(own_count);
+        for(size_t k = 0; k < own_count; ++k)
+        {
+            cur_tile.offsets[k] = worker.proxies[k].offset;
+        }
+        cur_tile.stats = optimizer.get_stats();
+        cur_tile.has_results = true;
+        optimizer.unregister_labels(worker.handles.data(), count);
+        for(obstacle_handle handle: worker.obstacles_handles)
+        {
+            optimizer.unregister_obstacle(handle);
+        }
+    }
+
+    void tiled_optimizer::apply_tile(const tile &cur_tile)
+    {
+        for(size_t k = 0; k < cur_tile.labels.size(); ++k)
+        {
+            const label_entry &entry = labels[cur_tile.labels[k]];
+            const point_i &offset = entry.point->get_label_offset();
+            const point_i &new_offset = cur_tile.offsets[k];
+            if(!entry.point->is_label_fixed() &&
+                    (offset.x != new_offset.x || offset.y != new_offset.y))
+            {
+                entry.point->set_label_offset(new_offset);
+            }
+        }
+    }
+
+    int tiled_optimizer::get_phase(const tile &cur_tile, int stride)
+    {
+        int col = (cur_tile.col % stride + stride) % stride;
+        int row = (cur_tile.row % stride + stride) % stride;
+        return row * stride + col;
+    }
+
+    uint64_t tiled_optimizer::get_tile_key(int col, int row)
+    {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(col)) << 32) |
+                static_cast<uint32_t>(row);
+    }
+
+    int tiled_optimizer::get_tile_coord(int value) const
+    {
+        // Rounds down for negative values too
+        return value >= 0 ? value / tile_size :
+                            -((-(value + 1)) / tile_size) - 1;
+    }
+
+    void tiled_optimizer::remove_label(size_t idx)
+    {
+        labels_by_ptr.erase(labels[idx].point);
+        size_t last = labels.size() - 1;
+        std::swap(labels[idx], labels[last]);
+        labels_handles.swap(idx, last);
+        labels.pop_back();
+        labels_handles.pop_back();
+    }
+
+    void tiled_optimizer::remove_obstacle(size_t idx)
+    {
+        obstacles_by_ptr.erase(obstacles[idx]);
+        size_t last = obstacles.size() - 1;
+        std::swap(obstacles[idx], obstacles[last]);
+        obstacles_handles.swap(idx, last);
+        obstacles.pop_back();
+        obstacles_handles.pop_back();
+    }
+} // namespace labeling
@@ -0,0 +1,160 @@
+#ifndef TILED_OPTIMIZER_H
+#define TILED_OPTIMIZER_H
+#include "base_optimizer.h"
+#include "handles_table.h"
+#include "thread_pool.h"
+#include "visibility_selector.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace labeling
+{
+    /*
+     * Splits the world into square tiles and optimizes every tile by a
+     * separate optimizer on the thread pool
+     *
+     * Visible labels are selected for the whole world first by the
+     * visibility_selector base_optimizer uses too. Tiles get only the
+     * visible labels, hidden ones keep their offsets.
+     * A visible label belongs to the tile with its pivot. The halo of a
+     * tile is as wide as the distance at which labels might interact, it
+     * is found from the labels reach by every best_fit. Tiles are
+     * optimized in phases, tiles of one phase are farther than the halo
+     * from each other and run in parallel. Labels of earlier phases tiles
+     * in the halo are registered in the tile optimizer as fixed ones, so
+     * later tiles place their labels around the placed ones and tile
+     * borders are stitched without overlaps.
+     * Tiles keep the offsets found for them. In incremental mode a tile
+     * with the same labels, halo and obstacles as in its last
+     * optimization takes the kept offsets and is not optimized again, so
+     * the cost grows with the changed tiles count only
+     */
+    class tiled_optimizer : public positions_optimizer
+    {
+    public:
+        /*
+         * @param optimizer_name is one of optimizer_names()
+         * @param tile_size is the tile side in pixels
+         * @param threads_count is the number of tiles optimized at once.
+         * 0 means hardware concurrency
+         */
+        explicit tiled_optimizer(const std::string &optimizer_name,
+                                 int tile_size = 1024,
+                                 size_t threads_count = 0);
+        ~tiled_optimizer();
+
+        label_handle register_label(screen_point_feature *);
+        void unregister_label(screen_point_feature *);
+        void unregister_label(label_handle);
+        void register_labels(screen_point_feature *const *points,
+                             size_t count,
+                             label_handle *handles);
+        void unregister_labels(const label_handle *handles, size_t count);
+
+        obstacle_handle register_obstacle(screen_obstacle *);
+        void unregister_obstacle(screen_obstacle *);
+        void unregister_obstacle(obstacle_handle);
+
+        void best_fit(float time_max);
+
+        /*
+         * Incremental mode reuses offsets of tiles that didn't change.
+         * Off by default
+         */
+        void set_incremental(bool incremental);
+        void set_viewport(const geom2::rectangle_i &viewport);
+        void reset_viewport();
+        void set_label_priority(label_handle handle, double priority);
+        void set_labels_budget(size_t max_count);
+        bool is_label_visible(screen_point_feature *point_ptr) const;
+        bool is_label_visible(label_handle handle) const;
+
+        /*
+         * Counters are summed over the tiles optimized by the last
+         * best_fit
+         */
+        const optimizer_stats& get_stats() const;
+        /*
+         * @return tiles with labels and tiles optimized by the last
+         * best_fit
+         */
+        size_t get_tiles_count() const;
+        size_t get_optimized_tiles_count() const;
+    private:
+        struct label_entry
+        {
+            screen_point_feature *point;
+            double priority;
+            // visibility selected by the last best_fit
+            bool visible;
+        };
+        struct tile
+        {
+            int col;
+            int row;
+            // indices of own labels, halo labels of earlier phases and
+            // obstacles sorted by handles. Rebuilt by every best_fit
+            std::vector<size_t> labels;
+            std::vector<size_t> halo;
+            std::vector<size_t> obstacles;
+            // inputs hash and results of the last optimization
+            uint64_t signature;
+            bool has_results;
+            std::vector<geom2::point_i> offsets;
+            optimizer_stats stats;
+        };
+        struct worker_state;
+    private:
+        /*
+         * Sets visible flags of all labels
+         */
+        void select_visible();
+        /*
+         * @return distance between pivots at which visible labels might
+         * interact
+         */
+        int find_halo_width() const;
+        /*
+         * Sets halo_width to a power of two not less than required_width
+         */
+        void update_halo_width(int required_width);
+        void assign_tiles(int stride);
+        static int get_phase(const tile &cur_tile, int stride);
+        uint64_t get_signature(const tile &cur_tile) const;
+        void optimize_tile(tile &cur_tile, worker_state &worker,
+                           float time_max);
+        void apply_tile(const tile &cur_tile);
+        static uint64_t get_tile_key(int col, int row);
+        int get_tile_coord(int value) const;
+        void remove_label(size_t idx);
+        void remove_obstacle(size_t idx);
+    private:
+        std::string optimizer_name;
+        int tile_size;
+        thread_pool pool;
+        std::vector<std::unique_ptr<worker_state>> workers;
+
+        std::vector<label_entry> labels;
+        handles_table labels_handles;
+        std::unordered_map<screen_point_feature*, label_handle> labels_by_ptr;
+        std::vector<screen_obstacle*> obstacles;
+        handles_table obstacles_handles;
+        std::unordered_map<screen_obstacle*, obstacle_handle>
+            obstacles_by_ptr;
+
+        std::unordered_map<uint64_t, tile> tiles;
+        // best_fit buffers
+        std::vector<tile*> phase_tiles;
+        std::vector<tile*> dirty_tiles;
+        size_t optimized_tiles_count;
+        // halo width of the last best_fit
+        int halo_width;
+
+        bool incremental;
+        visibility_selector visibility;
+        optimizer_stats stats;
+    };
+} // namespace labeling
+#endif // TILED_OPTIMIZER_H
@@ -1,4 +1,17 @@
 #include "utils.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace labeling
+{
+    /*
+     * Correct values from 0 to +inf
+     * Optimizers rarely move labels further than REACH_FACTOR label sizes
+     * from their current offsets and prefered positions. Component
+     * optimizers of base_optimizer and tiles of tiled_optimizer rely on it
+     */
+    static const int REACH_FACTOR = 1;
+} // namespace labeling
 
 namespace labeling {
     geom2::rectangle_i to_label_rect(const screen_point_feature *point)
@@ -7,4 +20,31 @@ namespace labeling {
                     point->get_label_offset(),
                     point->get_label_size()};
     }
+
+    geom2::rectangle_i to_obstacle_box(const screen_obstacle *obstacle)
+    {
+        if(obstacle->get_type() == screen_obstacle::box)
+        {
+            return *obstacle->get_box();
+        }
+        const geom2::segment_i &seg = *obstacle->get_segment();
+        geom2::point_i left_bottom(std::min(seg.start.x, seg.end.x),
+                                   std::min(seg.start.y, seg.end.y));
+        return geom2::rectangle_i{left_bottom,
+                    geom2::size_i{std::abs(seg.end.x - seg.start.x),
+                                  std::abs(seg.end.y - seg.start.y)}};
+    }
+
+    geom2::rectangle_i get_reach_rect(const geom2::point_i &pivot,
+                                      const geom2::size_i &size,
+                                      const geom2::point_i &min_offset,
+                                      const geom2::point_i &max_offset)
+    {
+        geom2::point_i margin(REACH_FACTOR * size.w, REACH_FACTOR * size.h);
+        return geom2::rectangle_i{pivot + min_offset - margin,
+                    geom2::size_i{max_offset.x - min_offset.x +
+                                  2 * margin.x + size.w,
+                                  max_offset.y - min_offset.y +
+                                  2 * margin.y + size.h}};
+    }
 } // namespace labeling
@@ -1,10 +1,24 @@
 #ifndef UTILS
 #define UTILS
 #include "screen_point_feature.h"
+#include "screen_obstacle.h"
 
 namespace labeling
 {
     geom2::rectangle_i to_label_rect(const screen_point_feature *point);
+    /*
+     * @return bounding box of the obstacle
+     */
+    geom2::rectangle_i to_obstacle_box(const screen_obstacle *obstacle);
+    /*
+     * Reach of a label is its rectangles at offsets from min_offset to
+     * max_offset expanded by REACH_FACTOR label sizes. Labels might
+     * interact only if their reaches intersect
+     */
+    geom2::rectangle_i get_reach_rect(const geom2::point_i &pivot,
+                                      const geom2::size_i &size,
+                                      const geom2::point_i &min_offset,
+                                      const geom2::point_i &max_offset);
 } // namespace labeling
 
 #endif // UTILS
@@ -0,0 +1,129 @@
+#include "visibility_selector.h"
+#include <algorithm>
+#include <limits>
+
+using namespace geom2;
+
+namespace labeling
+{
+    /*
+     * Correct values from 0 to +inf
+     * Labels are hidden if their area summ would be bigger than
+     * MAX_LABELS_DENSITY of the viewport area
+     */
+    static const double MAX_LABELS_DENSITY = 0.5;
+    /*
+     * Correct values from 1 to +inf
+     * Labels that are visible compete for visibility with priority
+     * multiplied by VISIBLE_PRIORITY_FACTOR
+     */
+    static const double VISIBLE_PRIORITY_FACTOR = 1.25;
+    static const size_t NO_BUDGET = static_cast<size_t>(-1);
+} // namespace labeling
+
+namespace labeling
+{
+    visibility_selector::visibility_selector()
+        :
+          has_viewport(false),
+          labels_budget(NO_BUDGET)
+    {}
+
+    void visibility_selector::set_viewport(const rectangle_i &new_viewport)
+    {
+        has_viewport = true;
+        viewport = new_viewport;
+    }
+
+    void visibility_selector::reset_viewport()
+    {
+        has_viewport = false;
+    }
+
+    void visibility_selector::set_labels_budget(size_t max_count)
+    {
+        labels_budget = max_count;
+    }
+
+    bool visibility_selector::selects_all() const
+    {
+        return !has_viewport && labels_budget == NO_BUDGET;
+    }
+
+    void visibility_selector::clear()
+    {
+        pivots.clear();
+        areas.clear();
+        fixed.clear();
+        scores.clear();
+        handles.clear();
+    }
+
+    void visibility_selector::add(const screen_point_feature *point,
+                                  double priority,
+                                  bool was_visible,
+                                  uint64_t handle)
+    {
+        const size_i &size = point->get_label_size();
+        pivots.push_back(point->get_screen_pivot());
+        areas.push_back(static_cast<double>(size.w) * size.h);
+        fixed.push_back(point->is_label_fixed());
+        scores.push_back(was_visible ? priority * VISIBLE_PRIORITY_FACTOR :
+                                       priority);
+        handles.push_back(handle);
+    }
+
+    void visibility_selector::select()
+    {
+        size_t count = handles.size();
+        visible.assign(count, 0);
+        order.clear();
+        for(size_t idx = 0; idx < count; ++idx)
+        {
+            if(!has_viewport || point_in_rect(pivots[idx], viewport))
+            {
+                order.push_back(idx);
+            }
+        }
+        // Fixed labels go first, then labels by priority
+        std::sort(order.begin(), order.end(), [this](size_t l, size_t r)
+        {
+            if(fixed[l] != fixed[r])
+            {
+                return fixed[l] > fixed[r];
+            }
+            if(scores[l] != scores[r])
+            {
+                return scores[l] > scores[r];
+            }
+            return handles[l] < handles[r];
+        });
+
+        double max_area = std::numeric_limits<double>::infinity();
+        if(has_viewport)
+        {
+            max_area = MAX_LABELS_DENSITY * viewport.sz.w * viewport.sz.h;
+        }
+        size_t visible_count = 0;
+        double area_summ = 0;
+        for(size_t idx: order)
+        {
+            if(visible_count < labels_budget &&
+                    area_summ + areas[idx] <= max_area)
+            {
+                visible[idx] = 1;
+                area_summ += areas[idx];
+                ++visible_count;
+            }
+        }
+    }
+
+    size_t visibility_selector::get_memory_usage() const
+    {
+        return pivots.capacity() * sizeof(point_i) +
+                (areas.capacity() + scores.capacity()) * sizeof(double) +
+                (fixed.capacity() + visible.capacity()) * sizeof(char) +
+                handles.capacity() * sizeof(uint64_t) +
+                order.capacity() * sizeof(size_t);
+    }
+} // namespace labeling
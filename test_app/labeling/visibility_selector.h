@@ -0,0 +1,79 @@
+#ifndef VISIBILITY_SELECTOR_H
+#define VISIBILITY_SELECTOR_H
+#include "screen_point_feature.h"
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace labeling
+{
+    /*
+     * Chooses visible labels by the viewport, the labels budget and the
+     * labels density
+     *
+     * Labels with pivots outside of the viewport are hidden. The others
+     * are taken while they fit in the budget and the density limit, fixed
+     * labels first, then labels by priority. Ties are broken by handles.
+     * Labels visible in the previous selection get a priority bonus, so
+     * labels near the limits don't blink. Buffers are reused between
+     * selections
+     */
+    class visibility_selector
+    {
+    public:
+        visibility_selector();
+
+        void set_viewport(const geom2::rectangle_i &viewport);
+        void reset_viewport();
+        void set_labels_budget(size_t max_count);
+        /*
+         * @return true if there is no viewport and no budget, then all
+         * labels are visible and select is not needed
+         */
+        bool selects_all() const;
+
+        /*
+         * Starts a new selection
+         */
+        void clear();
+        /*
+         * Appends a label to the selection
+         *
+         * @param was_visible is the label visibility in the previous
+         * selection
+         */
+        void add(const screen_point_feature *point, double priority,
+                 bool was_visible, uint64_t handle);
+        /*
+         * Chooses visible labels among the added ones
+         */
+        void select();
+        /*
+         * @return visibility of the label added idx-th
+         */
+        bool is_visible(size_t idx) const;
+        /*
+         * @return bytes allocated by the buffers
+         */
+        size_t get_memory_usage() const;
+    private:
+        bool has_viewport;
+        geom2::rectangle_i viewport;
+        size_t labels_budget;
+        // added labels
+        std::vector<geom2::point_i> pivots;
+        std::vector<double> areas;
+        std::vector<char> fixed;
+        std::vector<double> scores;
+        std::vector<uint64_t> handles;
+        // select buffers
+        std::vector<size_t> order;
+        std::vector<char> visible;
+    };
+
+    inline bool visibility_selector::is_visible(size_t idx) const
+    {
+        return visible[idx] != 0;
+    }
+} // namespace labeling
+#endif // VISIBILITY_SELECTOR_H
@@ -1,5 +1,6 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include <cstdlib>
 #include <limits>
 #include <qelapsedtimer.h>
 #include <qpainter.h>
@@ -9,6 +10,8 @@
 #include "test_point_feature.h"
 #include "labeling/sim_annealing_opt.h"
 #include "labeling/ray_intersection_opt.h"
+#include "labeling/conflict_graph_opt.h"
+#include "labeling/async_optimizer.h"
 #include "geom2_to_qt.h"
 #include "labeling/utils.h"
 
@@ -24,15 +27,31 @@ MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
     timer(new QTimer()),
-    pos_optimizer(new labeling::ray_intersection_opt())
-//    pos_optimizer(new labeling::sim_annealing_opt())
+    // Labels are optimized on a separate thread while the points move
+    pos_optimizer(new labeling::async_optimizer(
+                      new labeling::ray_intersection_opt()))
+//                      new labeling::sim_annealing_opt()))
+//                      new labeling::conflict_graph_opt()))
 {
     ui->setupUi(this);
+    pos_optimizer->set_incremental(true);
 
     field_size.w = size().width();
     field_size.h = size().height();
+    pos_optimizer->set_viewport(rectangle_i{point_i(0, 0), field_size});
     fill_screen(INIT_POINTS_COUNT, INIT_OBSTACLES_COUNT);
 
+    const char *trace_path = getenv(TRACE_PATH_ENV);
+    if(trace_path != nullptr)
+    {
+        trace.reset(new labeling::trace_writer(trace_path));
+        if(!trace->is_open())
+        {
+            qWarning("can't create trace %s", trace_path);
+            trace.reset();
+        }
+    }
+
     connect(timer.get(), SIGNAL(timeout()), this, SLOT(update()));
     update();
     timer->start(UPDATE_TIME_MS);
@@ -87,24 +106,62 @@ void MainWindow::update()
         static_cast<test_point_feature&>(*point_u_ptr).update_position();
     }
 
+    if(trace)
+    {
+        write_trace();
+    }
+
     QElapsedTimer ellapsed_timer;
     ellapsed_timer.start();
     pos_optimizer->best_fit(TIME_TO_OPTIMIZE);
     qint32 ellapsed_ms = ellapsed_timer.nsecsElapsed() / 1000 / 1000;
 
+    // Stats are of the last finished optimization
+    const labeling::optimizer_stats &stats = pos_optimizer->get_stats();
+    double optimization_ms = stats.init_time + stats.optimization_time +
+            stats.apply_time;
     QString newStatus = QString("time limit: %1 ms\n"
                                 "actual time: %2 ms\n"
+                                "gui thread time: %10 ms\n"
                                 "obstacles count: %3\n"
-                                "points count: %4\n")
+                                "points count: %4\n"
+                                "iterations: %5\n"
+                                "accepted moves: %6\n"
+                                "metric: %7 -> %8\n"
+                                "unplaced labels: %9\n")
             .arg(TIME_TO_OPTIMIZE)
-            .arg(ellapsed_ms)
+            .arg(optimization_ms)
             .arg(screen_obstacles.size())
-            .arg(screen_points.size());
+            .arg(screen_points.size())
+            .arg(stats.iterations)
+            .arg(stats.accepted_moves)
+            .arg(stats.initial_metric)
+            .arg(stats.final_metric)
+            .arg(stats.unplaced_labels)
+            .arg(ellapsed_ms);
     ui->status_label->setText(newStatus);
 
     QMainWindow::update();
 }
 
+void MainWindow::write_trace()
+{
+    std::vector<const screen_point_feature*> points;
+    points.reserve(screen_points.size());
+    for(auto &point_u_ptr: screen_points)
+    {
+        points.push_back(point_u_ptr.get());
+    }
+    std::vector<const screen_obstacle*> obstacles;
+    obstacles.reserve(screen_obstacles.size());
+    for(auto &obstacle_u_ptr: screen_obstacles)
+    {
+        obstacles.push_back(obstacle_u_ptr.get());
+    }
+    rectangle_i viewport{point_i(0, 0), field_size};
+    trace->write_frame(points, obstacles, TIME_TO_OPTIMIZE, &viewport);
+}
+
 void MainWindow::paintEvent(QPaintEvent *)
 {
     QPainter painter(this);
@@ -129,6 +186,17 @@ void MainWindow::paintEvent(QPaintEvent *)
         auto point_color = point->is_label_fixed() ? Qt::darkCyan : Qt::blue;
         painter.setPen(QPen(point_color, 10));
         painter.drawPoint(to_qt(point->get_screen_pivot()));
+        painter.setPen(QPen(Qt::red, 1));
+        painter.setOpacity(0.2);
+        for(const point_i &track_point: point->get_track())
+        {
+            painter.drawPoint(to_qt(track_point));
+        }
+        painter.setOpacity(1);
+        if(!pos_optimizer->is_label_visible(point))
+        {
+            continue;
+        }
         painter.setPen(QPen(point_color, 1));
         QPoint label_left_bottom =
                 to_qt(point->get_screen_pivot() +
@@ -151,13 +219,6 @@ void MainWindow::paintEvent(QPaintEvent *)
         painter.setPen(QPen(point_color, 3));
         painter.drawRect(QRect(label_left_bottom,
                                to_qt(point->get_label_size())));
-        painter.setPen(QPen(Qt::red, 1));
-        painter.setOpacity(0.2);
-        for(const point_i &track_point: point->get_track())
-        {
-            painter.drawPoint(to_qt(track_point));
-        }
-        painter.setOpacity(1);
     }
 }
 
@@ -179,11 +240,15 @@ void MainWindow::mousePressEvent(QMouseEvent *event)
                         pos) < 10)
             {
                 pos_optimizer->unregister_label(point);
-                screen_points.erase(it);
+                // Order of points does not matter, so remove by swapping
+                // with the last one
+                std::swap(*it, screen_points.back());
+                screen_points.pop_back();
                 return;
             }
             rectangle_i label_rect = labeling::to_label_rect(point);
-            if(point_in_rect(pos, label_rect))
+            if(pos_optimizer->is_label_visible(point) &&
+                    point_in_rect(pos, label_rect))
             {
                 point->set_fixed(!point->is_label_fixed());
                 return;
@@ -6,6 +6,7 @@
 #include <memory>
 #include <vector>
 #include "labeling/positions_optimizer.h"
+#include "labeling/scene_trace.h"
 
 const int UPDATE_TIME_MS = 100;
 const float TIME_TO_OPTIMIZE = 80;
@@ -14,6 +15,9 @@ const double MAX_POINT_ROT = 2 * 3.14 / 360 * 0.2;
 const double FIXED_POINT_P = 0;
 const int INIT_POINTS_COUNT = 25;
 const int INIT_OBSTACLES_COUNT = 0;
+// Scenes passed to best_fit are recorded to the file named by this
+// environment variable
+const char TRACE_PATH_ENV[] = "LABELING_TRACE";
 
 namespace Ui {
 class MainWindow;
@@ -50,7 +54,10 @@ private:
     screen_obstacles_t screen_obstacles;
     screen_points_t screen_points;
     geom2::size_i field_size;
+    // nullptr if scenes are not recorded
+    std::unique_ptr<labeling::trace_writer> trace;
 private:
+    void write_trace();
     int labels_intersection();
 };
 
@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "labeling/labels_grid.h"
+#include "labeling/optimizer_factory.h"
+#include "labeling/scene_trace.h"
+#include "labeling/sim_annealing_opt.h"
+#include "labeling/utils.h"
+
+using namespace geom2;
+using namespace labeling;
+using std::chrono::high_resolution_clock;
+using std::chrono::duration;
+
+namespace
+{
+    const char DEFAULT_OPTIMIZER[] = "ray_intersection";
+    const double PERCENTILES[] = {0.5, 0.9, 0.99, 1.0};
+    const char *const PERCENTILES_NAMES[] = {"p50", "p90", "p99", "max"};
+
+    /*
+     * Point with the state of a trace_point record
+     */
+    class replay_point_feature : public screen_point_feature
+    {
+    public:
+        replay_point_feature()
+            :
+              fixed(false),
+              version(0)
+        {}
+
+        /*
+         * Copies the record. The recorded offset is taken by new and
+         * fixed labels only, others keep the offset found by the
+         * replayed optimizer
+         */
+        void assign(const trace_point &record,
+                    const trace_prefered *prefered_records,
+                    bool is_new)
+        {
+            pivot = point_i(record.pivot_x, record.pivot_y);
+            label_size = size_i{record.w, record.h};
+            fixed = record.fixed != 0;
+            if(is_new || fixed)
+            {
+                offset = point_i(record.offset_x, record.offset_y);
+            }
+            prefered.resize(record.prefered_count);
+            for(size_t k = 0; k < prefered.size(); ++k)
+            {
+                const trace_prefered &pos = prefered_records[k];
+                prefered[k] = prefered_position(pos.weight,
+                                                point_i(pos.x, pos.y));
+            }
+            version = record.version;
+        }
+
+        const point_i& get_screen_pivot() const { return pivot; }
+        const size_i& get_label_size() const { return label_size; }
+        const point_i& get_label_offset() const { return offset; }
+        void set_label_offset(const point_i &new_offset)
+        {
+            offset = new_offset;
+        }
+        bool is_label_fixed() const { return fixed; }
+        const prefered_pos_list& get_prefered_positions() const
+        {
+            return prefered;
+        }
+        uint64_t get_version() const { return version; }
+    private:
+        point_i pivot;
+        size_i label_size;
+        point_i offset;
+        bool fixed;
+        prefered_pos_list prefered;
+        uint64_t version;
+    };
+
+    /*
+     * Obstacle with the state of a trace_obstacle record
+     */
+    class replay_obstacle : public screen_obstacle
+    {
+    public:
+        replay_obstacle()
+            :
+              t(screen_obstacle::box),
+              version(0)
+        {}
+
+        void assign(const trace_obstacle &record)
+        {
+            t = record.type == screen_obstacle::segment ?
+                        screen_obstacle::segment : screen_obstacle::box;
+            const int32_t *coords = record.coords;
+            box = rectangle_i{point_i(coords[0], coords[1]),
+                              size_i{coords[2], coords[3]}};
+            segment = segment_i{point_i(coords[0], coords[1]),
+                                point_i(coords[2], coords[3])};
+            version = record.version;
+        }
+
+        type get_type() const { return t; }
+        const rectangle_i* get_box() const { return &box; }
+        const segment_i* get_segment() const { return &segment; }
+        uint64_t get_version() const { return version; }
+    private:
+        type t;
+        rectangle_i box;
+        segment_i segment;
+        uint64_t version;
+    };
+
+    /*
+     * Points and obstacles of the current frame registered in the
+     * optimizer. Items are matched with the records by id
+     */
+    class replay_scene
+    {
+    public:
+        explicit replay_scene(positions_optimizer &optimizer)
+            :
+              optimizer(optimizer),
+              frame_idx(0)
+        {}
+
+        void apply(const trace_frame &frame)
+        {
+            ++frame_idx;
+            const trace_frame_header &header = *frame.header;
+            const trace_prefered *prefered = frame.prefered;
+            frame_points.resize(header.points_count);
+            for(size_t k = 0; k < header.points_count; ++k)
+            {
+                const trace_point &record = frame.points[k];
+                point_entry &entry = points[record.id];
+                bool is_new = !entry.point;
+                if(is_new)
+                {
+                    entry.point.reset(new replay_point_feature());
+                }
+                entry.point->assign(record, prefered, is_new);
+                prefered += record.prefered_count;
+                if(is_new)
+                {
+                    entry.handle = optimizer.register_label(
+                                entry.point.get());
+                }
+                entry.frame_idx = frame_idx;
+                frame_points[k] = &entry;
+            }
+            for(size_t k = 0; k < header.obstacles_count; ++k)
+            {
+                const trace_obstacle &record = frame.obstacles[k];
+                obstacle_entry &entry = obstacles[record.id];
+                bool is_new = !entry.obstacle;
+                if(is_new)
+                {
+                    entry.obstacle.reset(new replay_obstacle());
+                }
+                entry.obstacle->assign(record);
+                if(is_new)
+                {
+                    entry.handle = optimizer.register_obstacle(
+                                entry.obstacle.get());
+                }
+                entry.frame_idx = frame_idx;
+            }
+            remove_missing();
+
+            if(header.has_viewport)
+            {
+                const int32_t *coords = header.viewport;
+                optimizer.set_viewport(
+                            rectangle_i{point_i(coords[0], coords[1]),
+                                        size_i{coords[2], coords[3]}});
+            } else {
+                optimizer.reset_viewport();
+            }
+        }
+
+        /*
+         * Points in the order of the last applied frame
+         */
+        size_t points_count() const { return frame_points.size(); }
+        const replay_point_feature& point(size_t idx) const
+        {
+            return *frame_points[idx]->point;
+        }
+        label_handle handle(size_t idx) const
+        {
+            return frame_points[idx]->handle;
+        }
+
+        template<class F>
+        void for_each_obstacle(F f) const
+        {
+            for(const auto &item: obstacles)
+            {
+                f(*item.second.obstacle);
+            }
+        }
+    private:
+        struct point_entry
+        {
+            std::unique_ptr<replay_point_feature> point;
+            label_handle handle;
+            size_t frame_idx;
+        };
+        struct obstacle_entry
+        {
+            std::unique_ptr<replay_obstacle> obstacle;
+            obstacle_handle handle;
+            size_t frame_idx;
+        };
+    private:
+        /*
+         * Unregisters items missing in the frame. Ids are sorted, so the
+         * optimizer gets the same calls on every replay
+         */
+        void remove_missing()
+        {
+            removed.clear();
+            for(const auto &item: points)
+            {
+                if(item.second.frame_idx != frame_idx)
+                {
+                    removed.push_back(item.first);
+                }
+            }
+            std::sort(removed.begin(), removed.end());
+            for(uint64_t id: removed)
+            {
+                optimizer.unregister_label(points[id].handle);
+                points.erase(id);
+            }
+
+            removed.clear();
+            for(const auto &item: obstacles)
+            {
+                if(item.second.frame_idx != frame_idx)
+                {
+                    removed.push_back(item.first);
+                }
+            }
+            std::sort(removed.begin(), removed.end());
+            for(uint64_t id: removed)
+            {
+                optimizer.unregister_obstacle(obstacles[id].handle);
+                obstacles.erase(id);
+            }
+        }
+    private:
+        positions_optimizer &optimizer;
+        size_t frame_idx;
+        std::unordered_map<uint64_t, point_entry> points;
+        std::unordered_map<uint64_t, obstacle_entry> obstacles;
+        std::vector<point_entry*> frame_points;
+        std::vector<uint64_t> removed;
+    };
+
+    /*
+     * Placement quality of a frame after best_fit
+     */
+    struct frame_quality
+    {
+        // share of the labels shown
+        double visible;
+        // share of the shown labels that intersect other shown labels
+        // or obstacles
+        double overlapped;
+        // intersection area of the shown labels with each other and
+        // with obstacle boxes
+        double overlap_area;
+        // mean distance from the shown labels to their first prefered
+        // position
+        double prefered_distance;
+    };
+
+    /*
+     * Buffers reused by measure between frames
+     */
+    struct quality_buffers
+    {
+        labels_grid grid;
+        // rectangles of the shown labels
+        std::vector<rectangle_i> rects;
+        std::vector<char> overlapped;
+    };
+
+    frame_quality measure(const replay_scene &cur_scene,
+                          const positions_optimizer &optimizer,
+                          quality_buffers &buffers)
+    {
+        frame_quality quality = frame_quality();
+        size_t count = cur_scene.points_count();
+        std::vector<rectangle_i> &rects = buffers.rects;
+        rects.clear();
+        for(size_t idx = 0; idx < count; ++idx)
+        {
+            if(!optimizer.is_label_visible(cur_scene.handle(idx)))
+            {
+                continue;
+            }
+            const replay_point_feature &point = cur_scene.point(idx);
+            rects.push_back(to_label_rect(&point));
+            const screen_point_feature::prefered_pos_list &prefered =
+                    point.get_prefered_positions();
+            point_i target = prefered.empty() ? point_i(0, 0) :
+                                                prefered.front().second;
+            quality.prefered_distance +=
+                    points_distance(point.get_label_offset(), target);
+        }
+        size_t visible_count = rects.size();
+        if(!visible_count)
+        {
+            return quality;
+        }
+        std::vector<char> &overlapped = buffers.overlapped;
+        overlapped.assign(visible_count, 0);
+        buffers.grid.build(rects);
+
+        for(size_t idx = 0; idx < visible_count; ++idx)
+        {
+            buffers.grid.for_each(rects[idx], [&](size_t other)
+            {
+                if(other <= idx)
+                {
+                    return;
+                }
+                double area = rectangle_intersection(rects[idx],
+                                                     rects[other]);
+                if(area > 0)
+                {
+                    quality.overlap_area += area;
+                    overlapped[idx] = overlapped[other] = 1;
+                }
+            });
+        }
+        cur_scene.for_each_obstacle([&](const screen_obstacle &obstacle)
+        {
+            rectangle_i box = to_obstacle_box(&obstacle);
+            buffers.grid.for_each(box, [&](size_t idx)
+            {
+                if(obstacle.get_type() == screen_obstacle::box)
+                {
+                    double area = rectangle_intersection(rects[idx], box);
+                    if(area > 0)
+                    {
+                        quality.overlap_area += area;
+                        overlapped[idx] = 1;
+                    }
+                } else if(get_sqr_seg_rect_intersection(
+                              *obstacle.get_segment(), rects[idx]) > 0) {
+                    overlapped[idx] = 1;
+                }
+            });
+        });
+
+        quality.visible = static_cast<double>(visible_count) / count;
+        size_t overlapped_count = std::count(overlapped.begin(),
+                                             overlapped.end(), 1);
+        quality.overlapped =
+                static_cast<double>(overlapped_count) / visible_count;
+        quality.prefered_distance /= visible_count;
+        return quality;
+    }
+
+    /*
+     * @param sorted_values should be sorted and not empty
+     */
+    double percentile(const std::vector<double> &sorted_values, double p)
+    {
+        size_t idx = static_cast<size_t>(p * (sorted_values.size() - 1) +
+                                         0.5);
+        return sorted_values[idx];
+    }
+
+    void print_usage(const char *name)
+    {
+        printf("usage: %s [-o optimizer] [-t best_fit_time_ms] "
+               "[-j threads] [-s seed] [-n] trace_file\n"
+               "-t overrides time limits of the recorded frames\n"
+               "-n turns incremental best_fit off\n"
+               "optimizers are", name);
+        for(const std::string &optimizer_name: optimizer_names())
+        {
+            printf(" %s", optimizer_name.c_str());
+        }
+        printf(", default is %s\n", DEFAULT_OPTIMIZER);
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string optimizer_name = DEFAULT_OPTIMIZER;
+    float time_max = -1;
+    size_t threads_count = 0;
+    bool has_seed = false;
+    uint64_t seed = 0;
+    bool incremental = true;
+    std::string path;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            optimizer_name = argv[++i];
+        } else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+            time_max = static_cast<float>(atof(argv[++i]));
+        } else if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads_count = static_cast<size_t>(atol(argv[++i]));
+        } else if(!strcmp(argv[i], "-s") && i + 1 < argc) {
+            has_seed = true;
+            seed = static_cast<uint64_t>(strtoull(argv[++i], nullptr, 10));
+        } else if(!strcmp(argv[i], "-n")) {
+            incremental = false;
+        } else if(path.empty() && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    std::unique_ptr<base_optimizer> optimizer(
+                create_optimizer(optimizer_name));
+    if(path.empty() || !optimizer)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    trace_reader reader;
+    if(!reader.open(path))
+    {
+        fprintf(stderr, "can't read trace %s\n", path.c_str());
+        return 1;
+    }
+
+    optimizer->set_threads_count(threads_count);
+    optimizer->set_incremental(incremental);
+    sim_annealing_opt *annealing =
+            dynamic_cast<sim_annealing_opt*>(optimizer.get());
+    if(annealing != nullptr && has_seed)
+    {
+        annealing->set_seed(seed);
+    }
+
+    replay_scene cur_scene(*optimizer);
+    quality_buffers buffers;
+    std::vector<double> frame_times;
+    frame_quality summ = frame_quality();
+    size_t max_points = 0;
+    trace_frame frame;
+    while(reader.next_frame(frame))
+    {
+        cur_scene.apply(frame);
+        max_points = std::max(max_points, cur_scene.points_count());
+        float frame_time_max = time_max >= 0 ? time_max :
+                                               frame.header->time_max;
+        auto start = high_resolution_clock::now();
+        optimizer->best_fit(frame_time_max);
+        frame_times.push_back(duration<double, std::milli>(
+                                  high_resolution_clock::now() -
+                                  start).count());
+
+        frame_quality quality = measure(cur_scene, *optimizer, buffers);
+        summ.visible += quality.visible;
+        summ.overlapped += quality.overlapped;
+        summ.overlap_area += quality.overlap_area;
+        summ.prefered_distance += quality.prefered_distance;
+    }
+    if(frame_times.empty())
+    {
+        fprintf(stderr, "trace %s has no frames\n", path.c_str());
+        return 1;
+    }
+
+    size_t frames_count = frame_times.size();
+    printf("optimizer %s, %zu frames, up to %zu labels\n",
+           optimizer_name.c_str(), frames_count, max_points);
+    std::sort(frame_times.begin(), frame_times.end());
+    printf("frame time ms:");
+    for(size_t k = 0; k < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); ++k)
+    {
+        printf(" %s %.3f", PERCENTILES_NAMES[k],
+               percentile(frame_times, PERCENTILES[k]));
+    }
+    printf("\n");
+    printf("mean per frame: visible %.4f, overlapped %.4f, "
+           "overlap area %.1f, prefered distance %.2f\n",
+           summ.visible / frames_count, summ.overlapped / frames_count,
+           summ.overlap_area / frames_count,
+           summ.prefered_distance / frames_count);
+    return 0;
+}
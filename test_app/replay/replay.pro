@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Replays recorded scene traces through positions optimizers
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = replay
+TEMPLATE = app
+
+CONFIG += console c++11
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += main.cpp
+
+win32:CONFIG(release, debug|release): LABELING_DIR = $$OUT_PWD/../labeling/release
+else:win32:CONFIG(debug, debug|release): LABELING_DIR = $$OUT_PWD/../labeling/debug
+else: LABELING_DIR = $$OUT_PWD/../labeling
+
+LIBS += -L$$LABELING_DIR -llabeling
+win32-g++|unix: PRE_TARGETDEPS += $$LABELING_DIR/liblabeling.a
+else: PRE_TARGETDEPS += $$LABELING_DIR/labeling.lib
+
+unix: LIBS += -lpthread
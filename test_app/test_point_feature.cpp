@@ -21,7 +21,8 @@ namespace labeling
           offset_changed(false),
           label_offset(40, 40),
           exact_offset(static_cast<point_d>(label_offset)),
-          track(TRACK_LEN, position)
+          track(TRACK_LEN, position),
+          version(1)
     {
         label_size.h = 40;
         label_size.w = 100;
@@ -67,6 +68,12 @@ namespace labeling
     void test_point_feature::set_fixed(bool fixed)
     {
         is_fixed = fixed;
+        ++version;
+    }
+
+    uint64_t test_point_feature::get_version() const
+    {
+        return version;
     }
 
     const std::deque<geom2::point_i>& test_point_feature::get_track() const
@@ -95,17 +102,35 @@ namespace labeling
         exact_position.y =
                 fmod(exact_position.y + rotated_speed.y + field_size.h,
                      field_size.h);
-        position = static_cast<point_i>(exact_position);
-        rotated_prefered_positions.clear();
-        for(const prefered_position &pos: prefered_positions)
+        point_i new_position = static_cast<point_i>(exact_position);
+        bool changed = new_position.x != position.x ||
+                new_position.y != position.y;
+        position = new_position;
+        for(size_t k = 0; k < prefered_positions.size(); ++k)
         {
+            const prefered_position &pos = prefered_positions[k];
             point_i offset_to_center = static_cast<point_i>(label_size) / 2;
             point_i new_pos = static_cast<point_i>(
                         rotate(pos.second +
                                offset_to_center,
                                cur_rotation)) - offset_to_center;
-            rotated_prefered_positions.push_back(prefered_position(pos.first,
-                                                                   new_pos));
+            if(k == rotated_prefered_positions.size())
+            {
+                rotated_prefered_positions.push_back(
+                            prefered_position(pos.first, new_pos));
+                changed = true;
+                continue;
+            }
+            point_i &old_pos = rotated_prefered_positions[k].second;
+            if(old_pos.x != new_pos.x || old_pos.y != new_pos.y)
+            {
+                old_pos = new_pos;
+                changed = true;
+            }
+        }
+        if(changed)
+        {
+            ++version;
         }
     }
 
@@ -26,6 +26,7 @@ namespace labeling
         void set_fixed(bool fixed);
 
         const prefered_pos_list& get_prefered_positions() const;
+        uint64_t get_version() const;
 
         void update_position();
         const std::deque<geom2::point_i>& get_track() const;
@@ -44,6 +45,7 @@ namespace labeling
         geom2::point_d exact_offset;
         double rotation;
         double cur_rotation;
+        uint64_t version;
     };
 } // namespace labeling
 